@@ -1,17 +1,140 @@
 /*
+    Template parameters:
+        CPU6502<CLK, BUS, VARIANT, CACHE, ACCURACY>
+        VARIANT is one of NMOS6502, NES2A03, CMOS65C02, Rockwell65C02,
+            WDC65C02; if omitted it is chosen by EMULATE_65C02 and
+            EMULATE_WDC_65C02.  ops6502.h defines them and their
+            opcodes: cpu6502_opcodes<VARIANT> says which CPU6502 runs
+            and their lengths, modes, and cycles.
+        CACHE is CPU6502NoBlockCache (default) or CPU6502BlockCache,
+            which only pays off when BUS::read is costly; see below
+        ACCURACY is one of
+            CPU6502InstructionExact (default) - every instruction takes
+                its documented cycles, including page crossings
+            CPU6502Warp - no cycle accounting: clk is never called, and
+                total_cycles, run() budgets and timed bus accesses count
+                instructions instead of cycles
+            CPU6502BusExact - as CPU6502InstructionExact, and internal
+                cycles make the dummy accesses the CPU makes: reads of
+                the next opcode, the stack, and partially indexed
+                addresses, the NMOS double write or CMOS double read of
+                read-modify-write instructions, JSR's read of the stack
+                and BRK's read of the byte after it.  Only the 65C02
+                decimal cycle and the cycles a hook credits stay
+                internal, and JSR reads its high address byte before
+                its pushes rather than after.
+
     Public methods:
         CPU6502(CLK& clk, BUS& bus); - construct using clk and bus
         cycle() - issue one instruction and add necessary cycles to clk
+        run(budget) - issue instructions until at least budget cycles have
+            passed or request_stop() is called; returns the number of
+            cycles run
+        run_until(c) - run() until total_cycles reaches c
+        request_stop() - make run() return at the next instruction boundary
+        get_p(), set_p(v) - read or write the packed status register
+        invalidate_code(page) - drop cached code after changing memory
+            without going through the CPU
+        set_irq(source, asserted) - drive one of irq_sources wired-OR
+            level IRQ inputs; taken while any is asserted and I is clear
+        set_nmi(asserted) - drive the NMI input; taken once per
+            asserting edge
+        request_reset() - take a reset at the next instruction boundary
+            The inputs may be driven from any thread without stopping
+            the CPU; they are sampled at instruction boundaries.
+        halted() - true after WAI or STP until an interrupt wakes the
+            CPU; run() passes halted time in one step.  May be called
+            from any thread.
+        wait_until_woken() - block the calling thread while halted()
+            until another thread drives an input that wakes the CPU,
+            for a host that would rather sleep than run() halted time
+            An opcode the variant doesn't implement leaves the CPU halted
+            TRAPPED, with pc and trap_opcode naming it, until a reset.
+        hook(entry, handler, context, cycles) - run handler(context, cpu)
+            in place of the routine at entry whenever JSR or JMP goes
+            there; see "High-level emulation" below
+        unhook(entry) - run the routine at entry again
         reset() - reset CPU state
         irq() - put CPU in IRQ
         nmi() - put CPU in NMI
 
+    High-level emulation:
+        A hook is native code standing in for a guest routine, such as
+        character output or multiply.  It reads and writes memory with
+        hook_read() and hook_write(), which make no bus cycles, and
+        changes registers and flags directly.  The CPU then credits the
+        hook's cycles and returns as RTS would.  Hooks are looked up only
+        when JSR or JMP lands on a hooked address, so other code runs as
+        before; a routine entered any other way runs as guest code.
+        JIT6502 doesn't take hooks.
+
+        If verify_hooks is set, the CPU instead runs the hook against a
+        scratch copy of the memory it writes, then runs the real routine
+        until it returns.  hook_mismatches counts calls where the
+        routine's registers, flags, or any byte the hook wrote end up
+        differing, or where the routine left some way other than RTS
+        (RTI, extra pulls, TXS) and so popped past its caller's stack;
+        hook_mismatch_entry names the last.  Bytes only the routine
+        writes aren't compared, and hooks aren't taken while a routine
+        is being verified.
+
     CLK template parameter must provide methods:
         void add_cpu_cycles(int N); - add N CPU cycles to the clock
 
+    CLK template parameter may provide:
+        static constexpr CPU6502ClockReporting cpu_clock_reporting;
+            PER_INSTRUCTION (default) - one add_cpu_cycles() per instruction
+            PER_ACCESS - add_cpu_cycles() before every bus access and
+                internal cycle, for hosts that need per-access timing
+            PER_SLICE - one add_cpu_cycles() per run() call
+        uint64_t cpu_cycles_until_event(); - cycles past those already
+            added before any device changes state or raises an
+            interrupt.  If provided, run() skips whole iterations of
+            idle loops (JMP *, a branch to itself, or a load of one
+            location, an optional immediate AND, ORA, EOR or compare,
+            and a branch back) up to that point.  The skipped
+            iterations make no bus accesses.
+        void cpu_instruction_done(); - called after every instruction
+            and halted cycle, before the interrupt inputs are sampled
+            for the next; an interrupt is part of the instruction that
+            follows it.  CPU6502Stepper stops between instructions here.
+    CPU6502Scheduler is a stock CLK that provides cpu_cycles_until_event()
+    and fires device events at their deadlines.
+
     BUS template parameter must provide methods:
         uint8_t read(uint16_t addr);
         void write(uint16_t addr, uint8_t data);
+    or be CPU6502PageBus or derived from it, in which case the CPU reads
+    and writes memory pages directly and calls only device handlers.
+    CPU6502MapBus is a stock BUS for a memory map fixed at compile time.
+
+    BUS template parameter may also provide:
+        uint8_t read(uint16_t addr, uint64_t cycle);
+        void write(uint16_t addr, uint8_t data, uint64_t cycle);
+            If provided, the CPU makes its bus accesses through these,
+            with cycle the total_cycles run including the access, so a
+            device can catch its state up to the exact cycle it is
+            touched rather than being ticked every instruction.  This
+            holds whatever the clock reporting.  The untimed read() is
+            still used to look at code and idle loops without accessing
+            the bus.  CPU6502PageBus device handlers aren't passed the
+            cycle; it is the CPU's total_cycles when they are called.
+        static constexpr bool cpu_owns_bus = true;
+            If provided, the CPU holds the bus by value, constructed with
+            CPU6502(CLK& clk), rather than by reference, so the compiler
+            can see that bus accesses don't change CPU state.
+        uint8_t* ram_page(uint8_t page);
+            The memory behind page if it is plain RAM, or nullptr.  If
+            provided, and ACCURACY doesn't make dummy accesses, run()
+            runs block copies (LDA (zp),Y / STA (zp),Y / INY / BNE),
+            fills (STA abs,X / DEX / BNE) and shift-and-add multiplies
+            (LSR zp / BCC / CLC / ADC zp / ROR A / ROR zp / DEX / BNE)
+            natively, directly on that memory, with the same registers,
+            flags and cycles as running them.  A pass that would touch
+            a page that isn't RAM, write the loop's own code or the zero
+            page pointers, or run past the end of the slice or the next
+            clock event is interpreted instead.  CPU6502PageBus and
+            CPU6502MapBus provide ram_page().
 */
 
 // verify timing
@@ -27,23 +150,789 @@
 
 #include <stdlib.h>
 #include <assert.h>
+#include <limits.h>
 #include <vector>
+#include <memory>
+#include <array>
+#include <unordered_map>
+#include <type_traits>
+#include <utility>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <tuple>
+#include <bitset>
+#include <map>
+#include "ops6502.h"
+
+// Dispatch through a table of label addresses ("computed goto") where the
+// compiler supports it, otherwise fall back to a switch in a loop.
+// Define CPU6502_THREADED_DISPATCH to 0 to force the switch.
+#ifndef CPU6502_THREADED_DISPATCH
+#if defined(__GNUC__) || defined(__clang__)
+#define CPU6502_THREADED_DISPATCH 1
+#else
+#define CPU6502_THREADED_DISPATCH 0
+#endif
+#endif /* CPU6502_THREADED_DISPATCH */
+
+enum class CPU6502ClockReporting {
+    PER_ACCESS,
+    PER_INSTRUCTION,
+    PER_SLICE,
+};
+
+template<class CLK, class = void>
+struct CPU6502ClockReportingOf
+{
+    static constexpr CPU6502ClockReporting value = CPU6502ClockReporting::PER_INSTRUCTION;
+};
+
+template<class CLK>
+struct CPU6502ClockReportingOf<CLK, std::void_t<decltype(CLK::cpu_clock_reporting)>>
+{
+    static constexpr CPU6502ClockReporting value = CLK::cpu_clock_reporting;
+};
+
+template<class BUS, class = void>
+struct CPU6502TimedBus : std::false_type {};
+
+template<class BUS>
+struct CPU6502TimedBus<BUS, std::void_t<decltype(std::declval<BUS&>().read(uint16_t(), uint64_t()))>> : std::true_type {};
+
+template<class BUS, class = void>
+struct CPU6502OwnsBus : std::false_type {};
+
+template<class BUS>
+struct CPU6502OwnsBus<BUS, std::void_t<decltype(BUS::cpu_owns_bus)>> : std::bool_constant<BUS::cpu_owns_bus> {};
+
+template<class BUS, class = void>
+struct CPU6502RamPages : std::false_type {};
+
+template<class BUS>
+struct CPU6502RamPages<BUS, std::void_t<decltype(std::declval<BUS&>().ram_page(uint8_t()))>> : std::true_type {};
+
+template<class CLK, class = void>
+struct CPU6502SkipsIdleLoops : std::false_type {};
+
+template<class CLK>
+struct CPU6502SkipsIdleLoops<CLK, std::void_t<decltype(std::declval<CLK&>().cpu_cycles_until_event())>> : std::true_type {};
+
+template<class CLK, class = void>
+struct CPU6502TracksInstructions : std::false_type {};
+
+template<class CLK>
+struct CPU6502TracksInstructions<CLK, std::void_t<decltype(std::declval<CLK&>().cpu_instruction_done())>> : std::true_type {};
+
+// Code cache policies, passed as the CACHE template parameter
+
+// Fetch every opcode and operand from the bus
+struct CPU6502NoBlockCache
+{
+    static constexpr bool enabled = false;
+
+    struct Entry
+    {
+    };
+
+    struct Block
+    {
+    };
+};
+
+// Predecode straight-line code into blocks of entries holding the opcode
+// and operand bytes, so instructions are not re-fetched from the
+// bus every time they run.  Blocks end at control flow and are chained to
+// their successors.  A write through the CPU to a page holding cached code
+// invalidates every block on that page; a host that changes memory behind
+// the CPU's back must call CPU6502::invalidate_code(page).  Pages with
+// read side effects must be marked with set_cacheable(page, false).
+//
+// Entries carry no handler or cycle cost; handlers still decode and
+// count cycles as they run, so only the fetches are saved.  That is
+// worth it only when BUS::read is costly, such as a bus dispatching
+// every access through per-region handlers, where a checksum loop ran
+// 1.2 to 1.6 times as fast.  With an inlined array bus the lookups cost
+// about what they save and can make the CPU slower, and CPU6502PageBus
+// already fetches through a pointer into the page, so leave the cache
+// off for those.  JIT6502 is the tier for larger gains.
+struct CPU6502BlockCache
+{
+    static constexpr bool enabled = true;
+    static constexpr int max_block_length = 32;
+    static constexpr size_t max_dead_blocks = 1024;
+
+    struct Entry
+    {
+        uint16_t pc;
+        uint8_t bytes[3]; // opcode and operands
+    };
+
+    struct Block
+    {
+        uint16_t start;
+        bool valid = true;
+        int count = 0;
+        Entry entries[max_block_length];
+        struct {
+            uint16_t pc;
+            Block* block;
+        } links[2] = {{0, nullptr}, {0, nullptr}};
+        int next_link = 0;
+    };
+
+    std::vector<std::unique_ptr<Block>> blocks;
+    std::unordered_map<uint16_t, Block*> blocks_by_start;
+    std::vector<Block*> page_blocks[256];
+    bool code_page[256] = {};
+    bool cacheable[256];
+    size_t dead_blocks = 0;
+
+    CPU6502BlockCache()
+    {
+        std::fill(cacheable, cacheable + 256, true);
+    }
+
+    // Control flow, WAI, and STP end a block
+    template<class VARIANT>
+    static constexpr bool ends_block(uint8_t op)
+    {
+        return (cpu6502_opcodes<VARIANT>[op].writes & CPU6502Opcode::PC) ||
+            (VARIANT::wait_stop && ((op == 0xCB) || (op == 0xDB)));
+    }
+
+    bool has_code(uint8_t page) const
+    {
+        return code_page[page];
+    }
+
+    void invalidate_page(uint8_t page)
+    {
+        for(Block* block: page_blocks[page]) {
+            if(block->valid) {
+                block->valid = false;
+                auto found = blocks_by_start.find(block->start);
+                if((found != blocks_by_start.end()) && (found->second == block)) {
+                    blocks_by_start.erase(found);
+                }
+                dead_blocks++;
+            }
+        }
+        page_blocks[page].clear();
+        code_page[page] = false;
+    }
+
+    void set_cacheable(uint8_t page, bool c)
+    {
+        if(!c) {
+            invalidate_page(page);
+        }
+        cacheable[page] = c;
+    }
+
+    void flush()
+    {
+        blocks.clear();
+        blocks_by_start.clear();
+        for(int page = 0; page < 256; page++) {
+            page_blocks[page].clear();
+            code_page[page] = false;
+        }
+        dead_blocks = 0;
+    }
+
+    // Find the block starting at pc, preferring a link from the block
+    // that just finished.  Returns nullptr if pc isn't cacheable.
+    template<class VARIANT, class BUS>
+    Block* find(uint16_t pc, Block* from, BUS& bus)
+    {
+        if(from && from->valid) {
+            for(auto& link: from->links) {
+                if(link.block && (link.pc == pc) && link.block->valid) {
+                    return link.block;
+                }
+            }
+        }
+        if(dead_blocks > max_dead_blocks) {
+            flush();
+            from = nullptr;
+        }
+        Block* block;
+        auto found = blocks_by_start.find(pc);
+        if(found != blocks_by_start.end()) {
+            block = found->second;
+        } else {
+            block = build<VARIANT>(pc, bus);
+            if(!block) {
+                return nullptr;
+            }
+        }
+        if(from && from->valid) {
+            from->links[from->next_link] = {pc, block};
+            from->next_link ^= 1;
+        }
+        return block;
+    }
+
+    template<class VARIANT, class BUS>
+    Block* build(uint16_t start, BUS& bus)
+    {
+        auto block = std::make_unique<Block>();
+        block->start = start;
+        uint16_t address = start;
+        while(block->count < max_block_length) {
+            uint8_t op = bus.read(address);
+            int length = cpu6502_opcodes<VARIANT>[op].length;
+            bool all_cacheable = true;
+            for(int i = 0; i < length; i++) {
+                all_cacheable = all_cacheable && cacheable[((address + i) & 0xFFFF) >> 8];
+            }
+            if(!all_cacheable) {
+                break;
+            }
+            Entry& entry = block->entries[block->count++];
+            entry.pc = address;
+            entry.bytes[0] = op;
+            for(int i = 1; i < length; i++) {
+                entry.bytes[i] = bus.read(address + i);
+            }
+            for(int i = 0; i < length; i++) {
+                uint8_t page = ((address + i) & 0xFFFF) >> 8;
+                if(page_blocks[page].empty() || (page_blocks[page].back() != block.get())) {
+                    page_blocks[page].push_back(block.get());
+                }
+                code_page[page] = true;
+            }
+            address += length;
+            if(ends_block<VARIANT>(op)) {
+                break;
+            }
+        }
+        if(block->count == 0) {
+            return nullptr;
+        }
+        Block* result = block.get();
+        blocks.push_back(std::move(block));
+        blocks_by_start[start] = result;
+        return result;
+    }
+};
+
+// Accuracy policies, passed as the ACCURACY template parameter
+
+struct CPU6502InstructionExact
+{
+    static constexpr bool counts_cycles = true;
+    static constexpr bool dummy_accesses = false;
+};
+
+struct CPU6502Warp
+{
+    static constexpr bool counts_cycles = false;
+    static constexpr bool dummy_accesses = false;
+};
+
+struct CPU6502BusExact
+{
+    static constexpr bool counts_cycles = true;
+    static constexpr bool dummy_accesses = true;
+};
+
+// Stock BUS mapping each of the 256 pages to host memory or a device.
+// Memory pages are accessed inline by the CPU; ROM pages ignore writes
+// and unmapped pages read as 0xFF.  Device pages call the read and write
+// handlers they were mapped with.  Pages may be remapped at any time,
+// from a device or the clock, through the map and unmap methods, which
+// count remaps so the CPU notices at its next fetch; remapping a page
+// holding cached or translated code must be followed by
+// invalidate_code(page).
+struct CPU6502PageBus
+{
+    typedef uint8_t (*ReadHandler)(void* device, uint16_t addr);
+    typedef void (*WriteHandler)(void* device, uint16_t addr, uint8_t data);
+
+    // Memory behind each page, or nullptr if the page is a device
+    const uint8_t* read_memory[256];
+    uint8_t* write_memory[256];
+
+    struct Device
+    {
+        ReadHandler read;
+        WriteHandler write;
+        void* device;
+    } devices[256];
+
+    uint8_t unmapped[256];
+    uint8_t ignored[256]; // sink for writes to ROM and unmapped pages
+
+    // Calls to the map and unmap methods
+    uint32_t remaps = 0;
+
+    CPU6502PageBus()
+    {
+        std::fill(unmapped, unmapped + 256, 0xFF);
+        unmap(0, 256);
+    }
+
+    void map_ram(uint8_t first_page, int page_count, uint8_t* memory)
+    {
+        assert(first_page + page_count <= 256);
+        remaps++;
+        for(int i = 0; i < page_count; i++) {
+            read_memory[first_page + i] = memory + i * 256;
+            write_memory[first_page + i] = memory + i * 256;
+        }
+    }
+
+    void map_rom(uint8_t first_page, int page_count, const uint8_t* memory)
+    {
+        assert(first_page + page_count <= 256);
+        remaps++;
+        for(int i = 0; i < page_count; i++) {
+            read_memory[first_page + i] = memory + i * 256;
+            write_memory[first_page + i] = ignored;
+        }
+    }
+
+    void map_io(uint8_t first_page, int page_count, ReadHandler read, WriteHandler write, void* device)
+    {
+        assert(first_page + page_count <= 256);
+        remaps++;
+        for(int i = 0; i < page_count; i++) {
+            read_memory[first_page + i] = nullptr;
+            write_memory[first_page + i] = nullptr;
+            devices[first_page + i] = {read, write, device};
+        }
+    }
+
+    // DEVICE provides read(addr) and write(addr, data) like a BUS
+    template<class DEVICE>
+    void map_device(uint8_t first_page, int page_count, DEVICE& device)
+    {
+        map_io(first_page, page_count,
+            [](void* d, uint16_t addr) -> uint8_t { return static_cast<DEVICE*>(d)->read(addr); },
+            [](void* d, uint16_t addr, uint8_t data) { static_cast<DEVICE*>(d)->write(addr, data); },
+            &device);
+    }
+
+    void unmap(uint8_t first_page, int page_count)
+    {
+        assert(first_page + page_count <= 256);
+        remaps++;
+        for(int i = 0; i < page_count; i++) {
+            read_memory[first_page + i] = unmapped;
+            write_memory[first_page + i] = ignored;
+        }
+    }
+
+    uint8_t read_device(uint16_t addr)
+    {
+        const Device& d = devices[addr >> 8];
+        return d.read(d.device, addr);
+    }
+
+    void write_device(uint16_t addr, uint8_t data)
+    {
+        const Device& d = devices[addr >> 8];
+        d.write(d.device, addr, data);
+    }
+
+    uint8_t read(uint16_t addr)
+    {
+        const uint8_t* memory = read_memory[addr >> 8];
+        return memory ? memory[addr & 0xFF] : read_device(addr);
+    }
+
+    // Only RAM pages read and write the same memory
+    uint8_t* ram_page(uint8_t page)
+    {
+        return (read_memory[page] == write_memory[page]) ? write_memory[page] : nullptr;
+    }
+
+    void write(uint16_t addr, uint8_t data)
+    {
+        uint8_t* memory = write_memory[addr >> 8];
+        if(memory) {
+            memory[addr & 0xFF] = data;
+        } else {
+            write_device(addr, data);
+        }
+    }
+};
+
+// Regions of a CPU6502MapBus, each covering FIRST through LAST
+
+// RAM, read and written inline
+template<uint16_t FIRST, uint16_t LAST>
+struct CPU6502MapRam
+{
+    static_assert(FIRST <= LAST);
+    static constexpr uint16_t first = FIRST;
+    static constexpr uint16_t last = LAST;
+
+    uint8_t memory[LAST - FIRST + 1] = {};
+
+    uint8_t read(uint16_t addr)
+    {
+        return memory[addr - FIRST];
+    }
+
+    void write(uint16_t addr, uint8_t data)
+    {
+        memory[addr - FIRST] = data;
+    }
+
+    // Pages only partly in the region aren't RAM to the CPU
+    uint8_t* ram_page(uint8_t page)
+    {
+        uint32_t start = page * 256;
+        return ((start >= FIRST) && (start + 255 <= LAST)) ? memory + (start - FIRST) : nullptr;
+    }
+};
+
+// ROM, read inline; writes are ignored.  The host fills memory.
+template<uint16_t FIRST, uint16_t LAST>
+struct CPU6502MapRom
+{
+    static_assert(FIRST <= LAST);
+    static constexpr uint16_t first = FIRST;
+    static constexpr uint16_t last = LAST;
+
+    uint8_t memory[LAST - FIRST + 1] = {};
+
+    uint8_t read(uint16_t addr)
+    {
+        return memory[addr - FIRST];
+    }
+
+    void write(uint16_t, uint8_t)
+    {
+    }
+
+    uint8_t* ram_page(uint8_t)
+    {
+        return nullptr;
+    }
+};
+
+// DEVICE provides read(addr) and write(addr, data) like a BUS and is
+// passed full addresses.  It is held by value, so it may be a small
+// struct pointing at the real device.
+template<uint16_t FIRST, uint16_t LAST, class DEVICE>
+struct CPU6502MapDevice
+{
+    static_assert(FIRST <= LAST);
+    static constexpr uint16_t first = FIRST;
+    static constexpr uint16_t last = LAST;
+
+    DEVICE device;
+
+    uint8_t read(uint16_t addr)
+    {
+        return device.read(addr);
+    }
+
+    void write(uint16_t addr, uint8_t data)
+    {
+        device.write(addr, data);
+    }
+
+    uint8_t* ram_page(uint8_t)
+    {
+        return nullptr;
+    }
+};
+
+// Stock BUS for a memory map fixed at compile time, such as
+//
+//     typedef CPU6502MapBus<
+//         CPU6502MapRam<0x0000, 0x7FFF>,
+//         CPU6502MapDevice<0xA000, 0xA00F, VIA>,
+//         CPU6502MapRom<0xC000, 0xFFFF>> Bus;
+//     CPU6502<Clock, Bus> cpu(clock);
+//     cpu.bus.region<CPU6502MapRom<0xC000, 0xFFFF>>().memory[...] = ...;
+//
+// Regions may not overlap.  An access is decoded by comparing the
+// address with each region's constant bounds in turn, which the compiler
+// reduces to a few compares and folds into CPU6502's read() and write().
+// Unmapped addresses read as 0xFF and ignore writes.  The CPU holds the
+// bus by value.
+template<class... REGIONS>
+struct CPU6502MapBus
+{
+    static constexpr bool cpu_owns_bus = true;
+
+    std::tuple<REGIONS...> regions;
+
+    template<class REGION>
+    REGION& region()
+    {
+        return std::get<REGION>(regions);
+    }
+
+    static constexpr bool disjoint()
+    {
+        constexpr uint16_t firsts[] = {REGIONS::first...};
+        constexpr uint16_t lasts[] = {REGIONS::last...};
+        for(size_t i = 0; i < sizeof...(REGIONS); i++) {
+            for(size_t j = i + 1; j < sizeof...(REGIONS); j++) {
+                if((firsts[i] <= lasts[j]) && (firsts[j] <= lasts[i])) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    static_assert(disjoint(), "CPU6502MapBus regions overlap");
+
+    template<class REGION>
+    static constexpr bool contains(uint16_t addr)
+    {
+        return (addr >= REGION::first) && (addr <= REGION::last);
+    }
+
+    uint8_t read(uint16_t addr)
+    {
+        uint8_t data = 0xFF;
+        std::apply([&](auto&... r) {
+            ((contains<std::remove_reference_t<decltype(r)>>(addr) ? (data = r.read(addr), true) : false) || ...);
+        }, regions);
+        return data;
+    }
+
+    void write(uint16_t addr, uint8_t data)
+    {
+        std::apply([&](auto&... r) {
+            ((contains<std::remove_reference_t<decltype(r)>>(addr) ? (r.write(addr, data), true) : false) || ...);
+        }, regions);
+    }
+
+    uint8_t* ram_page(uint8_t page)
+    {
+        uint8_t* memory = nullptr;
+        std::apply([&](auto&... r) {
+            ((contains<std::remove_reference_t<decltype(r)>>(page * 256) ? (memory = r.ram_page(page), true) : false) || ...);
+        }, regions);
+        return memory;
+    }
+};
+
+// Stock CLK keeping device events in a min-heap keyed by absolute CPU
+// cycle, so devices sleep until their next deadline instead of being
+// ticked.  Events whose deadline has been reached fire from
+// add_cpu_cycles(), in deadline order and then in the order they were
+// scheduled, and may schedule more.  An event fires at the first report
+// at or past its deadline, so with PER_INSTRUCTION reporting it can be
+// late by the rest of the instruction; it is passed its deadline so it
+// can schedule the next one without drift.  cpu_cycles_until_event()
+// lets the CPU skip idle loops and halted time exactly up to the next
+// deadline.
+struct CPU6502Scheduler
+{
+    typedef void (*EventHandler)(void* device, uint64_t when);
+
+    // Cycles added so far
+    uint64_t now = 0;
+
+    struct Event
+    {
+        uint64_t when;
+        uint64_t order;
+        EventHandler handler;
+        void* device;
+
+        bool operator>(const Event& other) const
+        {
+            return (when != other.when) ? (when > other.when) : (order > other.order);
+        }
+    };
+    std::vector<Event> events; // heap, earliest first
+    uint64_t scheduled = 0;
+
+    // Deadline of events.front(), or UINT64_MAX if there are none
+    uint64_t next_event = UINT64_MAX;
+
+    void add_cpu_cycles(int N)
+    {
+        now += N;
+        if(now >= next_event) {
+            fire_events();
+        }
+    }
+
+    uint64_t cpu_cycles_until_event() const
+    {
+        return (next_event > now) ? (next_event - now) : 0;
+    }
+
+    void schedule(uint64_t when, EventHandler handler, void* device)
+    {
+        events.push_back({when, scheduled++, handler, device});
+        std::push_heap(events.begin(), events.end(), std::greater<Event>());
+        next_event = events.front().when;
+    }
+
+    void schedule_in(uint64_t cycles, EventHandler handler, void* device)
+    {
+        schedule(now + cycles, handler, device);
+    }
+
+    // DEVICE provides event(when)
+    template<class DEVICE>
+    void schedule(uint64_t when, DEVICE& device)
+    {
+        schedule(when, [](void* d, uint64_t when) { static_cast<DEVICE*>(d)->event(when); }, &device);
+    }
+
+    // Drop every pending event for device
+    void cancel(void* device)
+    {
+        events.erase(std::remove_if(events.begin(), events.end(), [device](const Event& e) { return e.device == device; }), events.end());
+        std::make_heap(events.begin(), events.end(), std::greater<Event>());
+        next_event = events.empty() ? UINT64_MAX : events.front().when;
+    }
+
+    void fire_events()
+    {
+        while(!events.empty() && (events.front().when <= now)) {
+            std::pop_heap(events.begin(), events.end(), std::greater<Event>());
+            Event event = events.back();
+            events.pop_back();
+            next_event = events.empty() ? UINT64_MAX : events.front().when;
+            event.handler(event.device, event.when);
+        }
+    }
+
+    // Run cpu for at least cycle_budget cycles in slices ending at each
+    // deadline, so events fire on time with PER_SLICE reporting too.
+    // Assumes cpu reports every cycle it runs to this clock.
+    template<class CPU>
+    uint64_t run(CPU& cpu, uint64_t cycle_budget)
+    {
+        uint64_t ran = 0;
+        while(ran < cycle_budget) {
+            uint64_t slice = std::min(cycle_budget - ran, std::max<uint64_t>(cpu_cycles_until_event(), 1));
+            ran += cpu.run(slice);
+        }
+        return ran;
+    }
+};
 
-#ifndef EMULATE_65C02
+// Results of decimal mode ADC and SBC for every A, operand, and carry,
+// built on first use.  The NMOS tables follow the MAME algorithm that
+// m6502.h uses, where N, V and Z come from intermediate sums; on CMOS
+// parts N and Z reflect the decimal result.  V and C are the same on
+// both.
+template<bool CMOS>
+struct CPU6502DecimalTables
+{
+    struct Entry
+    {
+        uint8_t result;
+        uint8_t p; // N, V, Z and C as in P
+    };
 
-#define EMULATE_65C02 1
+    static constexpr uint8_t N = 0x80;
+    static constexpr uint8_t V = 0x40;
+    static constexpr uint8_t Z = 0x02;
+    static constexpr uint8_t C = 0x01;
+
+    // Indexed by index(a, m, carry); carry is the C flag for SBC too
+    Entry adc[2 * 256 * 256];
+    Entry sbc[2 * 256 * 256];
 
-#ifndef EMULATE_WDC_65C02
-#define EMULATE_WDC_65C02 1
-#endif /* EMULATE_WDC_65C02 */
+    static constexpr int index(uint8_t a, uint8_t m, bool carry)
+    {
+        return (carry ? 0x10000 : 0) | (a << 8) | m;
+    }
+
+    static const CPU6502DecimalTables& get()
+    {
+        static const std::unique_ptr<CPU6502DecimalTables> tables(new CPU6502DecimalTables);
+        return *tables;
+    }
 
-#endif /* EMULATE_65C02 */
+    CPU6502DecimalTables()
+    {
+        for(int c = 0; c < 2; c++) {
+            for(int a = 0; a < 256; a++) {
+                for(int m = 0; m < 256; m++) {
+                    adc[index(a, m, c)] = make_adc(a, m, c);
+                    sbc[index(a, m, c)] = make_sbc(a, m, c ? 0 : 1);
+                }
+            }
+        }
+    }
 
-template<class CLK, class BUS>
+    static Entry make_adc(uint8_t a, uint8_t val, uint8_t c)
+    {
+        uint8_t p = 0;
+        uint8_t al = (a & 0x0F) + (val & 0x0F) + c;
+        if (al > 9) {
+            al += 6;
+        }
+        uint8_t ah = (a >> 4) + (val >> 4) + (al > 0x0F);
+        if (0 == (uint8_t)(a + val + c)) {
+            p |= Z;
+        }
+        else if (ah & 0x08) {
+            p |= N;
+        }
+        if (~(a^val) & (a^(ah<<4)) & 0x80) {
+            p |= V;
+        }
+        if (ah > 9) {
+            ah += 6;
+        }
+        if (ah > 15) {
+            p |= C;
+        }
+        return finish((ah<<4) | (al & 0x0F), p);
+    }
+
+    static Entry make_sbc(uint8_t a, uint8_t val, uint8_t c)
+    {
+        uint8_t p = 0;
+        uint16_t diff = a - val - c;
+        uint8_t al = (a & 0x0F) - (val & 0x0F) - c;
+        if ((int8_t)al < 0) {
+            al -= 6;
+        }
+        uint8_t ah = (a>>4) - (val>>4) - ((int8_t)al < 0);
+        if (0 == (uint8_t)diff) {
+            p |= Z;
+        }
+        else if (diff & 0x80) {
+            p |= N;
+        }
+        if ((a^val) & (a^diff) & 0x80) {
+            p |= V;
+        }
+        if (!(diff & 0xFF00)) {
+            p |= C;
+        }
+        if (ah & 0x80) {
+            ah -= 6;
+        }
+        return finish((ah<<4) | (al & 0x0F), p);
+    }
+
+    static Entry finish(uint8_t result, uint8_t p)
+    {
+        if constexpr (CMOS) {
+            p = (p & (V | C)) | (result & N) | ((result == 0) ? Z : 0);
+        }
+        return {result, p};
+    }
+};
+
+template<class CLK, class BUS, class VARIANT = CPU6502DefaultVariant, class CACHE = CPU6502NoBlockCache, class ACCURACY = CPU6502InstructionExact>
 struct CPU6502
 {
+    static constexpr bool owns_bus = CPU6502OwnsBus<BUS>::value;
+
     CLK &clk;
-    BUS &bus;
+    std::conditional_t<owns_bus, BUS, BUS&> bus;
 
     static constexpr uint8_t N = 0x80;
     static constexpr uint8_t V = 0x40;
@@ -53,34 +942,549 @@ struct CPU6502
     static constexpr uint8_t I = 0x04;
     static constexpr uint8_t Z = 0x02;
     static constexpr uint8_t C = 0x01;
-    uint8_t a, x, y, s, p;
+    uint8_t a, x, y, s;
     uint16_t pc = 0;
 
-    enum Exception {
-        NONE,
-        RESET,
-        NMI,
-        BRK,
-        INT,
-    } exception;
+    // Status register, kept unpacked and only packed by get_p() when it
+    // is observed.  N and Z are evaluated lazily from result bytes: N is
+    // bit 7 of n_result and Z is set when z_result is 0.  B and B2
+    // always read as 1.
+    uint8_t n_result, z_result;
+    bool c_flag, v_flag, d_flag, i_flag;
+
+    uint8_t get_p() const
+    {
+        return ((n_result & 0x80) ? N : 0) |
+            (v_flag ? V : 0) |
+            B2 | B |
+            (d_flag ? D : 0) |
+            (i_flag ? I : 0) |
+            ((z_result == 0) ? Z : 0) |
+            (c_flag ? C : 0);
+    }
+
+    void set_p(uint8_t v)
+    {
+        n_result = v & N;
+        v_flag = v & V;
+        d_flag = v & D;
+        i_flag = v & I;
+        z_result = (v & Z) ? 0 : 1;
+        c_flag = v & C;
+    }
+
+    // Interrupt inputs.  Everything pending is folded into one word so
+    // instruction boundaries test it with a single branch.
+    enum : uint32_t {
+        RESET_PENDING = 0x01,
+        NMI_PENDING = 0x02, // latched on NMI's asserting edge
+        NMI_LINE = 0x04,
+        IRQ_LINES = 0xFFFFFF00, // one bit per source
+    };
+    static constexpr int irq_sources = 24;
+    std::atomic<uint32_t> interrupts{RESET_PENDING};
+
+    // WAI leaves the CPU WAITING until any interrupt input is active,
+    // masked or not, STP leaves it STOPPED until a reset is pending, and
+    // an unhandled opcode leaves it TRAPPED, also until a reset
+    enum Halt {
+        RUNNING,
+        WAITING,
+        STOPPED,
+        TRAPPED,
+    };
+    std::atomic<Halt> halt{RUNNING};
+
+    // The unhandled opcode, at pc, when TRAPPED
+    uint8_t trap_opcode = 0;
+
+    // XXX For debugging, normally couldn't set CPU PC directly
+    void set_pc(uint16_t addr)
+    {
+        pc = addr;
+        interrupts.fetch_and(~uint32_t(RESET_PENDING | NMI_PENDING));
+    }
+
+    static constexpr CPU6502ClockReporting clock_reporting = CPU6502ClockReportingOf<CLK>::value;
+
+    // Cycles run since construction
+    uint64_t total_cycles = 0;
+
+    // Portion of total_cycles already passed to clk.add_cpu_cycles()
+    uint64_t reported_cycles = 0;
+
+    bool stop_requested = false;
+
+    static constexpr bool skip_idle_loops = CPU6502SkipsIdleLoops<CLK>::value && ACCURACY::counts_cycles;
+
+    // cycle_end of the running execute(), for skipping idle loops
+    uint64_t slice_end = 0;
+
+    // Last backward branch found not to close an idle loop
+    uint32_t busy_branch = 0x10000;
+
+    // Last idle loop branch taken, and total_cycles when it was
+    uint32_t idle_branch = 0x10000;
+    uint64_t idle_branch_cycle = 0;
+
+    static constexpr bool run_loop_idioms = CPU6502RamPages<BUS>::value && !ACCURACY::dummy_accesses;
+
+    // Last backward branch found not to close a loop idiom
+    uint32_t plain_loop = 0x10000;
+
+    void add_cycles(int N)
+    {
+        if constexpr (!ACCURACY::counts_cycles) {
+            return;
+        }
+        if constexpr (clock_reporting == CPU6502ClockReporting::PER_ACCESS) {
+            clk.add_cpu_cycles(N);
+            reported_cycles += N;
+        }
+        total_cycles += N;
+    }
+
+    void report_cycles()
+    {
+        if constexpr (!ACCURACY::counts_cycles) {
+            reported_cycles = total_cycles;
+            return;
+        }
+        while(total_cycles != reported_cycles) {
+            int N = (total_cycles - reported_cycles > INT_MAX) ? INT_MAX : int(total_cycles - reported_cycles);
+            clk.add_cpu_cycles(N);
+            reported_cycles += N;
+        }
+    }
+
+    void retire_instruction()
+    {
+        if constexpr (!ACCURACY::counts_cycles) {
+            total_cycles++;
+        }
+        if constexpr (clock_reporting == CPU6502ClockReporting::PER_INSTRUCTION) {
+            report_cycles();
+        }
+    }
+
+    void instruction_done()
+    {
+        if constexpr (CPU6502TracksInstructions<CLK>::value) {
+            clk.cpu_instruction_done();
+        }
+    }
+
+    void request_stop()
+    {
+        stop_requested = true;
+    }
+
+    void set_irq(int source, bool asserted)
+    {
+        uint32_t line = 0x100u << source;
+        if(asserted) {
+            interrupts.fetch_or(line, std::memory_order_release);
+        } else {
+            interrupts.fetch_and(~line, std::memory_order_release);
+        }
+        interrupts.notify_all();
+    }
+
+    void set_nmi(bool asserted)
+    {
+        uint32_t was = interrupts.load(std::memory_order_relaxed);
+        uint32_t now;
+        do {
+            if(asserted) {
+                now = was | NMI_LINE | ((was & NMI_LINE) ? 0 : NMI_PENDING);
+            } else {
+                now = was & ~uint32_t(NMI_LINE);
+            }
+        } while(!interrupts.compare_exchange_weak(was, now, std::memory_order_release, std::memory_order_relaxed));
+        interrupts.notify_all();
+    }
+
+    void request_reset()
+    {
+        interrupts.fetch_or(RESET_PENDING, std::memory_order_release);
+        interrupts.notify_all();
+    }
+
+    // Pending interrupts the CPU takes at the next instruction boundary
+    uint32_t accepted_interrupts()
+    {
+        return i_flag ? (RESET_PENDING | NMI_PENDING) : (RESET_PENDING | NMI_PENDING | IRQ_LINES);
+    }
+
+    bool interrupt_pending()
+    {
+        return (interrupts.load(std::memory_order_relaxed) & accepted_interrupts()) != 0;
+    }
+
+    // Whether the CPU is halted with the inputs in pending
+    bool halted_with(uint32_t pending) const
+    {
+        Halt now = halt.load(std::memory_order_acquire);
+        uint32_t wakes = (now == WAITING) ? (RESET_PENDING | NMI_PENDING | IRQ_LINES) : RESET_PENDING;
+        return (now != RUNNING) && !(pending & wakes);
+    }
+
+    bool halted() const
+    {
+        return halted_with(interrupts.load(std::memory_order_acquire));
+    }
+
+    // Leave the halted state if an input has woken the CPU; true if
+    // still halted
+    bool still_halted()
+    {
+        if(halted()) {
+            return true;
+        }
+        if(halt != RUNNING) {
+            halt = RUNNING;
+        }
+        return false;
+    }
+
+    void wait_until_woken() const
+    {
+        uint32_t pending = interrupts.load(std::memory_order_acquire);
+        while(halted_with(pending)) {
+            interrupts.wait(pending, std::memory_order_acquire);
+            pending = interrupts.load(std::memory_order_acquire);
+        }
+    }
+
+    // Let cycles pass while halted, up to cycle_end.  Cycles are handed
+    // to clk in steps no longer than the time to its next event, if it
+    // says, so an interrupt it raises then wakes the CPU on time.  With
+    // PER_SLICE reporting clk hears nothing until the slice ends, so no
+    // event can fire and the whole slice passes at once.
+    void pass_halted_cycles(uint64_t cycle_end)
+    {
+        while((total_cycles < cycle_end) && still_halted()) {
+            uint64_t until = cycle_end;
+            if constexpr (skip_idle_loops && (clock_reporting != CPU6502ClockReporting::PER_SLICE)) {
+                report_cycles();
+                uint64_t until_event = clk.cpu_cycles_until_event();
+                if(until_event < 1) {
+                    until_event = 1;
+                }
+                if(until_event < until - total_cycles) {
+                    until = total_cycles + until_event;
+                }
+            }
+            total_cycles = until;
+            if constexpr (clock_reporting != CPU6502ClockReporting::PER_SLICE) {
+                report_cycles();
+            }
+            instruction_done();
+        }
+    }
+
+    static constexpr bool page_bus = std::is_base_of_v<CPU6502PageBus, BUS>;
+    static constexpr bool timed_bus = CPU6502TimedBus<BUS>::value;
+
+    // With a CPU6502PageBus, instruction fetches read fetch_memory, the
+    // memory of one page, until pc leaves that page or the bus is
+    // remapped.  fetch_page holds the page and, above bit 8, the bus's
+    // remaps when the cursor was set, so one compare checks both.  A
+    // device access also drops the cursor, as does the start of a slice.
+    static constexpr uint32_t no_fetch_page = 0x100;
+    const uint8_t* fetch_memory = nullptr;
+    uint32_t fetch_page = no_fetch_page;
+
+    uint32_t fetch_key(uint16_t address)
+    {
+        return (address >> 8) | (bus.remaps << 9);
+    }
+
+    uint8_t read(uint16_t address)
+    {
+        add_cycles(1);
+        if constexpr (page_bus) {
+            const uint8_t* memory = bus.read_memory[address >> 8];
+            if(memory) {
+                return memory[address & 0xFF];
+            }
+            fetch_page = no_fetch_page;
+            return bus.read_device(address);
+        } else if constexpr (timed_bus) {
+            return bus.read(address, total_cycles);
+        } else {
+            return bus.read(address);
+        }
+    }
+
+    void write(uint16_t address, uint8_t value)
+    {
+        add_cycles(1);
+        if constexpr (page_bus) {
+            uint8_t* memory = bus.write_memory[address >> 8];
+            if(memory) {
+                memory[address & 0xFF] = value;
+            } else {
+                fetch_page = no_fetch_page;
+                bus.write_device(address, value);
+            }
+        } else if constexpr (timed_bus) {
+            bus.write(address, value, total_cycles);
+        } else {
+            bus.write(address, value);
+        }
+        if constexpr (CACHE::enabled) {
+            if(code_cache.has_code(address >> 8)) {
+                invalidate_code(address >> 8);
+            }
+        }
+    }
+
+    // An internal cycle, which makes a dummy read of address when
+    // ACCURACY asks for bus accesses
+    void idle_read(uint16_t address)
+    {
+        if constexpr (ACCURACY::dummy_accesses) {
+            [[maybe_unused]] uint8_t ignored = read(address);
+        } else {
+            add_cycles(1);
+        }
+    }
+
+    // The cycle between a read-modify-write's read of m and its write:
+    // the NMOS part writes m back, the 65C02 reads it again
+    void modify_cycle(uint16_t address, uint8_t m)
+    {
+        if constexpr (ACCURACY::dummy_accesses && !VARIANT::cmos) {
+            write(address, m);
+        } else {
+            idle_read(address);
+        }
+    }
+
+    // The cycle spent carrying an index into the high byte of base: the
+    // NMOS part reads base's page at the indexed low byte, the 65C02
+    // rereads the last operand byte
+    void index_cycle(uint16_t base, uint16_t address)
+    {
+        if constexpr (VARIANT::cmos) {
+            idle_read(pc - 1);
+        } else {
+            idle_read((base & 0xFF00) | (address & 0x00FF));
+        }
+    }
+
+    CACHE code_cache;
+    typename CACHE::Block* code_block = nullptr;
+    const typename CACHE::Entry* code_next = nullptr;
+    const typename CACHE::Entry* code_end = nullptr;
+    const uint8_t* code_operands = nullptr; // operands of the current instruction, if cached
+
+    void invalidate_code(uint8_t page)
+    {
+        if constexpr (CACHE::enabled) {
+            code_cache.invalidate_page(page);
+            code_end = code_next; // look the block up again before the next instruction
+        }
+    }
+
+    bool at_cached_code()
+    {
+        return (code_next != code_end) && (code_next->pc == pc);
+    }
+
+    // Make code_next the entry for pc; false if pc isn't cacheable
+    bool enter_block()
+    {
+        code_block = code_cache.template find<VARIANT>(pc, code_block, bus);
+        if(!code_block) {
+            code_next = code_end = nullptr;
+            code_operands = nullptr;
+            return false;
+        }
+        code_next = code_block->entries;
+        code_end = code_block->entries + code_block->count;
+        return true;
+    }
+
+    // Issue the opcode fetch for the entry at code_next
+    const typename CACHE::Entry* fetch_cached()
+    {
+        const typename CACHE::Entry* entry = code_next++;
+        code_operands = entry->bytes + 1;
+        add_cycles(1);
+        pc++;
+        return entry;
+    }
+
+    // High-level emulation hooks, keyed by entry address
+    typedef void (*HookHandler)(void* context, CPU6502& cpu);
+
+    struct Hook
+    {
+        HookHandler handler;
+        void* context;
+        int cycles; // credited for the whole call, including the return
+    };
+    std::unordered_map<uint16_t, Hook> hooks;
+    std::bitset<65536> hooked;
+
+    void hook(uint16_t entry, HookHandler handler, void* context, int cycles)
+    {
+        hooks[entry] = {handler, context, cycles};
+        hooked[entry] = true;
+    }
+
+    // HLE provides run(cpu)
+    template<class HLE>
+    void hook(uint16_t entry, HLE& hle, int cycles)
+    {
+        hook(entry, [](void* h, CPU6502& cpu) { static_cast<HLE*>(h)->run(cpu); }, &hle, cycles);
+    }
+
+    void unhook(uint16_t entry)
+    {
+        hooks.erase(entry);
+        hooked[entry] = false;
+    }
+
+    bool verify_hooks = false;
+    uint64_t hook_mismatches = 0;
+    uint16_t hook_mismatch_entry = 0;
+
+    // Bytes the hook being verified wrote, kept off the bus
+    bool hook_journaling = false;
+    std::map<uint16_t, uint8_t> hook_journal;
+
+    // Whether a routine is being verified, the state its hook left, and
+    // the stack pointer once the routine has returned
+    bool hook_verifying = false;
+    uint8_t hook_expected[5]; // a, x, y, s, p
+    uint16_t hook_expected_pc;
+    uint16_t hook_verify_entry;
+    uint8_t hook_verify_s;
+
+    uint8_t hook_read(uint16_t address)
+    {
+        if(hook_journaling) {
+            auto found = hook_journal.find(address);
+            if(found != hook_journal.end()) {
+                return found->second;
+            }
+        }
+        if constexpr (timed_bus) {
+            return bus.read(address, total_cycles);
+        } else {
+            return bus.read(address);
+        }
+    }
+
+    void hook_write(uint16_t address, uint8_t value)
+    {
+        if(hook_journaling) {
+            hook_journal[address] = value;
+            return;
+        }
+        if constexpr (timed_bus) {
+            bus.write(address, value, total_cycles);
+        } else {
+            bus.write(address, value);
+        }
+        if constexpr (CACHE::enabled) {
+            if(code_cache.has_code(address >> 8)) {
+                invalidate_code(address >> 8);
+            }
+        }
+    }
+
+    void return_from_hook()
+    {
+        uint8_t pcl = hook_read(0x100 + ++s);
+        uint8_t pch = hook_read(0x100 + ++s);
+        pc = pcl + pch * 256 + 1;
+    }
 
-    // XXX For debugging, normally couldn't set CPU PC directly
-    void set_pc(uint16_t addr)
+    // JSR or JMP just went to pc, which is hooked
+    void enter_hook()
     {
-        pc = addr;
-        exception = NONE;
+        if(hook_verifying) {
+            return;
+        }
+        auto found = hooks.find(pc);
+        if(found == hooks.end()) {
+            return;
+        }
+        const Hook& hook = found->second;
+        if(verify_hooks) {
+            start_hook_verification(hook);
+            return;
+        }
+        hook.handler(hook.context, *this);
+        add_cycles(hook.cycles);
+        return_from_hook();
+        fetch_page = no_fetch_page;
     }
 
-    uint8_t read(uint16_t address)
+    // Run hook against the journal, note what it left, and put the
+    // registers back so the real routine runs
+    void start_hook_verification(const Hook& hook)
     {
-        clk.add_cpu_cycles(1);
-        return bus.read(address);
+        uint8_t saved[5] = {a, x, y, s, get_p()};
+        uint16_t entry = pc;
+
+        hook_journal.clear();
+        hook_journaling = true;
+        hook.handler(hook.context, *this);
+        return_from_hook();
+        hook_journaling = false;
+
+        hook_expected[0] = a;
+        hook_expected[1] = x;
+        hook_expected[2] = y;
+        hook_expected[3] = s;
+        hook_expected[4] = get_p();
+        hook_expected_pc = pc;
+        hook_verify_entry = entry;
+        hook_verify_s = s;
+        hook_verifying = true;
+
+        a = saved[0];
+        x = saved[1];
+        y = saved[2];
+        s = saved[3];
+        set_p(saved[4]);
+        pc = entry;
+        fetch_page = no_fetch_page;
     }
 
-    void write(uint16_t address, uint8_t value)
+    // An RTS just brought the stack back to hook_verify_s
+    void finish_hook_verification()
+    {
+        bool same = (a == hook_expected[0]) && (x == hook_expected[1]) && (y == hook_expected[2]) &&
+            (s == hook_expected[3]) && (get_p() == hook_expected[4]) && (pc == hook_expected_pc);
+        for(const auto& [address, value]: hook_journal) {
+            same = same && (hook_read(address) == value);
+        }
+        if(!same) {
+            hook_mismatches++;
+            hook_mismatch_entry = hook_verify_entry;
+        }
+        hook_journal.clear();
+        hook_verifying = false;
+    }
+
+    // A pull or TXS while verifying.  If S rose past hook_verify_s, the
+    // routine left without the RTS that would have finished it.  S is
+    // compared modulo 256, so a routine may run with the stack wrapped
+    // past $00 as long as it stays within 128 bytes of its caller.
+    [[gnu::noinline]] void check_hook_stack()
     {
-        clk.add_cpu_cycles(1);
-        bus.write(address, value);
+        if(int8_t(uint8_t(hook_verify_s - s)) < 0) {
+            hook_mismatches++;
+            hook_mismatch_entry = hook_verify_entry;
+            hook_journal.clear();
+            hook_verifying = false;
+        }
     }
 
     void stack_push(uint8_t d)
@@ -90,67 +1494,119 @@ struct CPU6502
 
     uint8_t stack_pull()
     {
-        return read(0x100 + ++s);
+        uint8_t d = read(0x100 + ++s);
+        if(hook_verifying) [[unlikely]] {
+            check_hook_stack();
+        }
+        return d;
     }
 
     uint8_t read_pc_inc()
     {
+        if constexpr (CACHE::enabled) {
+            if(code_operands) {
+                add_cycles(1);
+                pc++;
+                return *code_operands++;
+            }
+        }
+        if constexpr (page_bus) {
+            if(fetch_key(pc) == fetch_page) {
+                add_cycles(1);
+                return fetch_memory[pc++ & 0xFF];
+            }
+            return fetch_new_page();
+        }
+        return read(pc++);
+    }
+
+    // Point the fetch cursor at pc's page, unless it is a device
+    [[gnu::noinline]] uint8_t fetch_new_page()
+    {
+        fetch_memory = bus.read_memory[pc >> 8];
+        if(fetch_memory) {
+            fetch_page = fetch_key(pc);
+        }
         return read(pc++);
     }
 
+    // "flag" is a single flag; every caller passes a constant, so these
+    // reduce to one store or load after inlining
     void flag_change(uint8_t flag, bool v)
     {
-        if(v) {
-            p |= flag;
-        } else {
-            p = (p & ~flag) | B2 | B;
+        switch(flag) {
+            case N: n_result = v ? 0x80 : 0x00; break;
+            case V: v_flag = v; break;
+            case D: d_flag = v; break;
+            case I: i_flag = v; break;
+            case Z: z_result = v ? 0 : 1; break;
+            case C: c_flag = v; break;
         }
     }
 
     void flag_set(uint8_t flag)
     {
-        p |= flag;
+        flag_change(flag, true);
     }
 
     void flag_clear(uint8_t flag)
     {
-        p = (p & ~flag) | B2 | B;
+        flag_change(flag, false);
     }
 
     uint8_t carry()
     {
-        return (p & C) ? 1 : 0;
+        return c_flag ? 1 : 0;
     }
 
     bool isset(uint8_t flag)
     {
-        return (p | B | B2) & flag;
+        switch(flag) {
+            case N: return n_result & 0x80;
+            case V: return v_flag;
+            case D: return d_flag;
+            case I: return i_flag;
+            case Z: return z_result == 0;
+            case C: return c_flag;
+        }
+        return true; // B and B2
     }
 
-    void set_flags(uint8_t flags, uint8_t v)
+    // Rarely changing state that selects the dispatch table execute()
+    // uses, so handlers need not test it.  A new mode bit needs its
+    // handler labels added to execute()'s mode_handlers and the places
+    // it changes to call CPU6502_MODE_CHANGED().
+    enum : int {
+        DECIMAL_MODE = 0x01, // ADC and SBC are decimal
+    };
+    static constexpr int dispatch_modes = VARIANT::decimal_mode ? 2 : 1;
+
+    int dispatch_mode()
     {
-        if(flags & Z) {
-            flag_change(Z, v == 0x00);
-        }
-        if(flags & N) {
-            flag_change(N, v & 0x80);
-        }
+        return decimal() ? DECIMAL_MODE : 0;
     }
 
-    static bool sbc_overflow_d(uint8_t a, uint8_t b, uint8_t borrow)
+    // ADC and SBC are only binary, since decimal mode has its own
+    // handlers, when dispatch is threaded
+    static constexpr bool decimal_dispatch = CPU6502_THREADED_DISPATCH && VARIANT::decimal_mode;
+
+    bool decimal()
     {
-        int8_t a_ = a;
-        int8_t b_ = b;
-        int16_t c = a_ - (b_ + borrow);
-        return (c < 0) || (c > 99);
+        if constexpr (VARIANT::decimal_mode) {
+            return isset(D);
+        } else {
+            return false;
+        }
     }
 
-    static bool adc_overflow_d(uint8_t a, uint8_t b, uint8_t carry)
+    void set_flags(uint8_t flags, uint8_t v)
     {
-        int8_t a_ = a;
-        int8_t b_ = b;
-        int16_t c = a_ + b_ + carry;
-        return (c < 0) || (c > 99);
+        if(flags & Z) {
+            z_result = v;
+        }
+        if(flags & N) {
+            n_result = v;
+        }
     }
 
     static bool sbc_overflow(uint8_t a, uint8_t b, uint8_t borrow)
@@ -175,145 +1631,382 @@ struct CPU6502
         a(0),
         x(0),
         y(0),
-        s(0xFD),
-        p(I | B | B2 | Z), // XXX flooh m6502 starts up with Z set...?
-        exception(RESET)
+        s(0xFD)
+    {
+        static_assert(!owns_bus, "construct a CPU6502 holding its bus with CPU6502(clk)");
+        set_p(I | B | B2 | Z); // XXX flooh m6502 starts up with Z set...?
+    }
+
+    // For a BUS the CPU holds by value
+    CPU6502(CLK& clk_) :
+        clk(clk_),
+        a(0),
+        x(0),
+        y(0),
+        s(0xFD)
     {
+        static_assert(owns_bus, "construct a CPU6502 with CPU6502(clk, bus)");
+        set_p(I | B | B2 | Z); // XXX flooh m6502 starts up with Z set...?
     }
 
     void reset()
     {
+        halt = RUNNING;
+        hook_verifying = false;
         s = 0xFD;
+        flag_set(I);
         uint8_t low = read(0xFFFC);
         uint8_t high = read(0xFFFD);
         pc = low + high * 256;
-        exception = NONE;
     }
 
-    void irq()
+    // Push pc and P and jump through vector, 7 cycles like BRK
+    void interrupt(uint16_t vector)
     {
-        stack_push((pc - 1) >> 8);
-        stack_push((pc - 1) & 0xFF);
-        stack_push((p | B2) & ~B);
-        uint8_t low = read(0xFFFE);
-        uint8_t high = read(0xFFFF);
+        idle_read(pc);
+        idle_read(pc);
+        stack_push(pc >> 8);
+        stack_push(pc & 0xFF);
+        stack_push((get_p() | B2) & ~B);
+        flag_set(I);
+        if constexpr (VARIANT::cmos) {
+            flag_clear(D);
+        }
+        uint8_t low = read(vector);
+        uint8_t high = read(vector + 1);
         pc = low + high * 256;
-        exception = NONE;
+    }
+
+    void irq()
+    {
+        interrupt(0xFFFE);
     }
 
     void nmi()
     {
-        stack_push((pc - 1) >> 8);
-        stack_push((pc - 1) & 0xFF);
-        stack_push((p | B2) & ~B);
-        uint8_t low = read(0xFFFA);
-        uint8_t high = read(0xFFFB);
-        pc = low + high * 256;
-        exception = NONE;
+        interrupt(0xFFFA);
+    }
+
+    typedef CPU6502DecimalTables<VARIANT::cmos> DecimalTables;
+
+    void apply_decimal(const typename DecimalTables::Entry& e)
+    {
+        a = e.result;
+        n_result = e.p & N;
+        z_result = (e.p & Z) ? 0 : 1;
+        v_flag = e.p & V;
+        c_flag = e.p & C;
+        if constexpr (VARIANT::cmos) {
+            add_cycles(1); // 1 more cycle for decimal mode on 65C02
+        }
     }
 
     void adc_bcd(uint8_t m, uint8_t carry)
     {
-#if 0
-        uint8_t bcd_a = a / 16 * 10 + a % 16;
-        uint8_t bcd_m = m / 16 * 10 + m % 16;
-        bool new_carry = ((uint16_t)bcd_a + (uint16_t)bcd_m + carry) > 127;
-        flag_change(C, new_carry);
-        flag_change(V, adc_overflow_d(bcd_a, bcd_m, carry));
-        bcd_a = bcd_a + bcd_m + carry;
-        set_flags(N | Z, (bcd_a % 100));
-        a = (bcd_a % 100) / 10 * 16 + bcd_a % 10;
-#else
-        uint8_t val = m;
-        uint8_t c = carry;
-        // Stolen from Flooh m6502.h
-        /* decimal mode (credit goes to MAME) */
-        p &= ~(N|V|Z|C);
-        uint8_t al = (a & 0x0F) + (val & 0x0F) + c;
-        if (al > 9) {
-            al += 6;
+        apply_decimal(DecimalTables::get().adc[DecimalTables::index(a, m, carry)]);
+    }
+
+    void sbc_bcd(uint8_t m, uint8_t borrow)
+    {
+        apply_decimal(DecimalTables::get().sbc[DecimalTables::index(a, m, !borrow)]);
+    }
+
+    void branch(bool condition) 
+    {
+        int32_t rel = (read_pc_inc() + 128) % 256 - 128;
+        if(condition) {
+            int cycles = 3;
+            idle_read(pc); // 1 more cycle if branch taken
+            if(((pc + rel) ^ pc) & 0xFF00) {
+                idle_read((pc & 0xFF00) | ((pc + rel) & 0xFF)); // 1 more cycle if address crosses pages
+                cycles++;
+            }
+            pc += rel;
+            if constexpr (skip_idle_loops) {
+                if(rel < 0) {
+                    skip_idle_loop(pc - rel - 2, cycles);
+                }
+            }
+            if constexpr (run_loop_idioms) {
+                if(rel < 0) {
+                    run_loop_idiom(pc - rel - 2, cycles);
+                }
+            }
         }
-        uint8_t ah = (a >> 4) + (val >> 4) + (al > 0x0F);
-        if (0 == (uint8_t)(a + val + c)) {
-            p |= Z;
+    }
+
+    // BBR and BBS take and pay for a branch as the others do, but aren't
+    // looked at for idle loops or loop idioms
+    void bit_branch(bool condition)
+    {
+        int32_t rel = (read_pc_inc() + 128) % 256 - 128;
+        if(condition) {
+            idle_read(pc);
+            if(((pc + rel) ^ pc) & 0xFF00) {
+                idle_read((pc & 0xFF00) | ((pc + rel) & 0xFF));
+            }
+            pc += rel;
         }
-        else if (ah & 0x08) {
-            p |= N;
+    }
+
+    // Cycles for one pass through the loop from pc up to the branch at
+    // branch_pc, or -1 unless it only loads one location into a
+    // register, maybe masks or compares it with an immediate, and tests
+    // the result.  Once such a loop has gone around, every further pass
+    // repeats the last one until memory changes.
+    int idle_loop_body_cycles(uint16_t branch_pc)
+    {
+        uint16_t at = pc;
+        if(at == branch_pc) {
+            return 0;
         }
-        if (~(a^val) & (a^(ah<<4)) & 0x80) {
-            p |= V;
+        uint8_t load = bus.read(at);
+        int cycles;
+        switch(load) {
+            case 0xA5: case 0xA6: case 0xA4: case 0x24: cycles = 3; at += 2; break; // LDA LDX LDY BIT zpg
+            case 0xAD: case 0xAE: case 0xAC: case 0x2C: cycles = 4; at += 3; break; // LDA LDX LDY BIT abs
+            default: return -1;
         }
-        if (ah > 9) {
-            ah += 6;
+        if(at != branch_pc) {
+            uint8_t test = bus.read(at);
+            bool pure = false;
+            switch(load) {
+                case 0xA5: case 0xAD: pure = (test == 0x29) || (test == 0x09) || (test == 0x49) || (test == 0xC9); break; // AND ORA EOR CMP imm
+                case 0xA6: case 0xAE: pure = (test == 0xE0); break; // CPX imm
+                case 0xA4: case 0xAC: pure = (test == 0xC0); break; // CPY imm
+            }
+            if(!pure) {
+                return -1;
+            }
+            cycles += 2;
+            at += 2;
         }
-        if (ah > 15) {
-            p |= C;
+        return (at == branch_pc) ? cycles : -1;
+    }
+
+    // The backward branch or jump at branch_pc taking branch_cycles just
+    // went to pc.  Passes are only skipped once the branch has been
+    // taken at the end of a whole pass, exactly one pass after it was
+    // last taken, since a loop entered at the branch tests flags the
+    // body didn't set.  Nothing is read once loop_limit() is reached, as
+    // under CPU6502Stepper, whose clock has an event every cycle.
+    void skip_idle_loop(uint16_t branch_pc, int branch_cycles)
+    {
+        if((branch_pc == busy_branch) || interrupt_pending() || stop_requested || (loop_limit() <= total_cycles)) {
+            return;
         }
-        a = (ah<<4) | (al & 0x0F);
-#endif
-#if EMULATE_65C02
-        clk.add_cpu_cycles(1); // 1 more cycle for decimal mode on 65C02
-#endif /* EMULATE_65C02 */
+        int body_cycles = idle_loop_body_cycles(branch_pc);
+        if(body_cycles < 0) {
+            busy_branch = branch_pc;
+            return;
+        }
+        int iteration = body_cycles + branch_cycles;
+        bool repeating = (body_cycles == 0) ||
+            ((branch_pc == idle_branch) && (total_cycles - idle_branch_cycle == uint64_t(iteration)));
+        uint64_t limit = loop_limit();
+        if(repeating && (limit > total_cycles)) {
+            uint64_t skipped = (limit - total_cycles) / iteration * iteration;
+            total_cycles += skipped;
+            if constexpr (clock_reporting == CPU6502ClockReporting::PER_ACCESS) {
+                report_cycles();
+            }
+        }
+        idle_branch = branch_pc;
+        idle_branch_cycle = total_cycles;
     }
 
-    void sbc_bcd(uint8_t m, uint8_t borrow)
+    // total_cycles a loop may be run up to without being interpreted:
+    // the end of the slice, or the clock's next event if sooner
+    uint64_t loop_limit()
+    {
+        uint64_t limit = slice_end;
+        if constexpr (skip_idle_loops) {
+            uint64_t until_event = clk.cpu_cycles_until_event();
+            if(until_event < limit - reported_cycles) {
+                limit = reported_cycles + until_event;
+            }
+        }
+        return limit;
+    }
+
+    // The backward branch at branch_pc taking branch_cycles just went to
+    // pc.  If it closes a block copy, fill or shift-and-add multiply,
+    // run the remaining passes natively on RAM.  Each pass runs only if
+    // it ends by loop_limit() and touches nothing but RAM, and writes
+    // neither the loop's code nor the pointers it goes through, so the
+    // interpreter picks up any other pass exactly where it starts.
+    void run_loop_idiom(uint16_t branch_pc, int branch_cycles)
     {
-#if 0
-        uint8_t bcd_a = a / 16 * 10 + a % 16;
-        uint8_t bcd_m = m / 16 * 10 + m % 16;
-        flag_change(C, !(bcd_a < bcd_m + borrow));
-        flag_change(V, sbc_overflow_d(bcd_a, bcd_m, borrow));
-        if(bcd_m + borrow <= bcd_a) { 
-            bcd_a = (bcd_a - (bcd_m + borrow)) % 100;
+        if((branch_pc == plain_loop) || interrupt_pending() || stop_requested || (loop_limit() <= total_cycles)) {
+            return;
+        }
+        uint16_t loop_pc = pc;
+        uint16_t length = branch_pc - loop_pc;
+        uint8_t op = bus.read(loop_pc);
+        if(bus.read(branch_pc) != 0xD0) { // BNE
+            plain_loop = branch_pc;
+        } else if((length == 5) && (op == 0xB1) && (bus.read(loop_pc + 2) == 0x91) && (bus.read(loop_pc + 4) == 0xC8)) {
+            copy_loop(branch_pc, branch_cycles, bus.read(loop_pc + 1), bus.read(loop_pc + 3));
+        } else if((length == 4) && (op == 0x9D) && (bus.read(loop_pc + 3) == 0xCA)) {
+            fill_loop(branch_pc, branch_cycles, bus.read(loop_pc + 1) + bus.read(loop_pc + 2) * 256);
+        } else if((length == 11) && (op == 0x46) &&
+            (bus.read(loop_pc + 2) == 0x90) && (bus.read(loop_pc + 3) == 0x03) && (bus.read(loop_pc + 4) == 0x18) &&
+            (bus.read(loop_pc + 5) == 0x65) && (bus.read(loop_pc + 7) == 0x6A) && (bus.read(loop_pc + 8) == 0x66) &&
+            (bus.read(loop_pc + 10) == 0xCA)) {
+            multiply_loop(branch_pc, branch_cycles, bus.read(loop_pc + 1), bus.read(loop_pc + 6), bus.read(loop_pc + 9));
         } else {
-            bcd_a = bcd_a + 100 - (bcd_m + borrow);
+            plain_loop = branch_pc;
         }
-        set_flags(N | Z, (bcd_a % 100));
-        a = (bcd_a % 100) / 10 * 16 + bcd_a % 10;
-#else
-        uint8_t val = m;
-        uint8_t c = borrow;
-        // Stolen from Flooh m6502.h
-        /* decimal mode (credit goes to MAME) */
-        p &= ~(N|V|Z|C);
-        uint16_t diff = a - val - c;
-        uint8_t al = (a & 0x0F) - (val & 0x0F) - c;
-        if ((int8_t)al < 0) {
-            al -= 6;
+    }
+
+    // RAM at address, or nullptr
+    uint8_t* loop_ram(uint16_t address)
+    {
+        uint8_t* memory = bus.ram_page(address >> 8);
+        return memory ? memory + (address & 0xFF) : nullptr;
+    }
+
+    // RAM at address that the loop from pc to branch_pc may write, or
+    // nullptr.  Cached code on the page is invalidated.
+    uint8_t* loop_ram_written(uint16_t address, uint16_t branch_pc, bool through_zero_page)
+    {
+        uint8_t page = address >> 8;
+        if((page == (pc >> 8)) || (page == ((branch_pc + 1) & 0xFFFF) >> 8) || (through_zero_page && (page == 0))) {
+            return nullptr;
         }
-        uint8_t ah = (a>>4) - (val>>4) - ((int8_t)al < 0);
-        if (0 == (uint8_t)diff) {
-            p |= Z;
+        uint8_t* memory = loop_ram(address);
+        if constexpr (CACHE::enabled) {
+            if(memory && code_cache.has_code(page)) {
+                invalidate_code(page);
+            }
         }
-        else if (diff & 0x80) {
-            p |= N;
+        return memory;
+    }
+
+    // Whether a pass of cycles, or instructions if cycles aren't
+    // counted, fits before limit; if so it is counted.  Instructions
+    // are counted as they retire, so room is kept for the branch that
+    // closed the loop.
+    bool loop_pass(uint64_t limit, int cycles, int instructions)
+    {
+        int cost = ACCURACY::counts_cycles ? cycles : instructions;
+        int pending = ACCURACY::counts_cycles ? 0 : 1;
+        if(total_cycles + cost + pending > limit) {
+            return false;
         }
-        if ((a^val) & (a^diff) & 0x80) {
-            p |= V;
+        total_cycles += cost;
+        return true;
+    }
+
+    void finish_loop(uint16_t branch_pc, bool done)
+    {
+        if(done) {
+            pc = branch_pc + 2;
         }
-        if (!(diff & 0xFF00)) {
-            p |= C;
+        if constexpr (clock_reporting == CPU6502ClockReporting::PER_ACCESS) {
+            report_cycles();
         }
-        if (ah & 0x80) {
-            ah -= 6;
+    }
+
+    static constexpr int op_cycles(uint8_t op)
+    {
+        return cpu6502_opcodes<VARIANT>[op].cycles;
+    }
+
+    // LDA (from),Y / STA (to),Y / INY / BNE
+    void copy_loop(uint16_t branch_pc, int branch_cycles, uint8_t from, uint8_t to)
+    {
+        const uint8_t* pointers[4] = {loop_ram(from), loop_ram((from + 1) & 0xFF), loop_ram(to), loop_ram((to + 1) & 0xFF)};
+        if(!pointers[0] || !pointers[1] || !pointers[2] || !pointers[3]) {
+            return;
         }
-        a = (ah<<4) | (al & 0x0F);
-#endif
-#if EMULATE_65C02
-        clk.add_cpu_cycles(1); // 1 more cycle for decimal mode on 65C02
-#endif /* EMULATE_65C02 */
+        uint16_t source = *pointers[0] + *pointers[1] * 256;
+        uint16_t destination = *pointers[2] + *pointers[3] * 256;
+        uint64_t limit = loop_limit();
+        bool done = false;
+        while(!done) {
+            uint16_t load_address = source + y;
+            uint16_t store_address = destination + y;
+            done = (y == 0xFF);
+            int cycles = op_cycles(0xB1) + op_cycles(0x91) + op_cycles(0xC8) + (done ? op_cycles(0xD0) : branch_cycles);
+            if((load_address ^ source) & 0xFF00) {
+                cycles += cpu6502_opcodes<VARIANT>[0xB1].page_penalty;
+            }
+            const uint8_t* load = loop_ram(load_address);
+            uint8_t* store = loop_ram_written(store_address, branch_pc, true);
+            if(!load || !store || !loop_pass(limit, cycles, 4)) {
+                done = false;
+                break;
+            }
+            *store = a = *load;
+            set_flags(N | Z, ++y);
+        }
+        finish_loop(branch_pc, done);
     }
 
-    void branch(bool condition) 
+    // STA base,X / DEX / BNE
+    void fill_loop(uint16_t branch_pc, int branch_cycles, uint16_t base)
     {
-        int32_t rel = (read_pc_inc() + 128) % 256 - 128;
-        if(condition) {
-            clk.add_cpu_cycles(1); // 1 more cycle if branch taken
-            if((pc + rel) / 256 != pc / 256) {
-                clk.add_cpu_cycles(1); // 1 more cycle if address crosses pages
-            }
-            pc += rel;
+        uint64_t limit = loop_limit();
+        bool done = false;
+        while(!done) {
+            done = (x == 0x01);
+            int cycles = op_cycles(0x9D) + op_cycles(0xCA) + (done ? op_cycles(0xD0) : branch_cycles);
+            uint8_t* store = loop_ram_written(base + x, branch_pc, false);
+            if(!store || !loop_pass(limit, cycles, 3)) {
+                done = false;
+                break;
+            }
+            *store = a;
+            set_flags(N | Z, --x);
+        }
+        finish_loop(branch_pc, done);
+    }
+
+    // LSR multiplier / BCC +3 / CLC / ADC multiplicand / ROR A /
+    // ROR product / DEX / BNE
+    void multiply_loop(uint16_t branch_pc, int branch_cycles, uint8_t multiplier, uint8_t multiplicand, uint8_t product)
+    {
+        if(VARIANT::decimal_mode && d_flag) {
+            return;
+        }
+        uint8_t* shifted = loop_ram_written(multiplier, branch_pc, false);
+        const uint8_t* added = loop_ram(multiplicand);
+        uint8_t* rotated = loop_ram_written(product, branch_pc, false);
+        if(!shifted || !added || !rotated) {
+            return;
         }
+        uint16_t skip_from = pc + 4;
+        int skip_cycles = op_cycles(0x90) + 1 + ((((skip_from + 3) ^ skip_from) & 0xFF00) ? 1 : 0);
+        uint64_t limit = loop_limit();
+        bool done = false;
+        while(!done) {
+            bool add = *shifted & 0x01;
+            done = (x == 0x01);
+            int cycles = op_cycles(0x46) + op_cycles(0x6A) + op_cycles(0x66) + op_cycles(0xCA) + (done ? op_cycles(0xD0) : branch_cycles);
+            cycles += add ? (op_cycles(0x90) + op_cycles(0x18) + op_cycles(0x65)) : skip_cycles;
+            if(!loop_pass(limit, cycles, add ? 8 : 6)) {
+                done = false;
+                break;
+            }
+            *shifted >>= 1;
+            bool carry = false;
+            if(add) {
+                uint8_t m = *added;
+                uint16_t sum = a + m;
+                v_flag = (~(a ^ m) & (a ^ sum) & 0x80) != 0;
+                carry = sum > 0xFF;
+                a = sum & 0xFF;
+            }
+            bool out = a & 0x01;
+            a = (carry ? 0x80 : 0x00) | (a >> 1);
+            carry = out;
+            out = *rotated & 0x01;
+            *rotated = (carry ? 0x80 : 0x00) | (*rotated >> 1);
+            c_flag = out;
+            set_flags(N | Z, --x);
+        }
+        finish_loop(branch_pc, done);
     }
 
     uint16_t absolute()
@@ -329,6 +2022,9 @@ struct CPU6502
         uint8_t low = read_pc_inc();
         uint8_t high = read_pc_inc();
         uint16_t addr = low + high * 256;
+        if constexpr (VARIANT::cmos) {
+            idle_read(pc - 1);
+        }
         uint8_t addrl = read(addr);
         uint8_t addrh = read(addr + 1);
         return addrl + addrh * 256;
@@ -339,6 +2035,7 @@ struct CPU6502
         uint8_t low = read_pc_inc();
         uint8_t high = read_pc_inc();
         uint16_t addr = low + high * 256 + x;
+        idle_read(pc - 1);
         uint8_t addrl = read(addr);
         uint8_t addrh = read(addr + 1);
         return addrl + addrh * 256;
@@ -361,1650 +2058,1733 @@ struct CPU6502
 
     uint16_t zeropage_indexed_X()
     {
-        uint8_t address = (read_pc_inc() + x) & 0xFF;
-        clk.add_cpu_cycles(1);
-        return address;
+        uint8_t base = read_pc_inc();
+        idle_read(base);
+        return (base + x) & 0xFF;
     }
 
     uint16_t zeropage_indexed_Y()
     {
-        uint8_t address = (read_pc_inc() + y) & 0xFF;
-        clk.add_cpu_cycles(1);
-        return address;
+        uint8_t base = read_pc_inc();
+        idle_read(base);
+        return (base + y) & 0xFF;
+    }
+
+    uint16_t indirect_indexed(bool is_write)
+    {
+        uint8_t zpg = read_pc_inc();
+        uint8_t low = read(zpg);
+        uint8_t high = read((zpg + 1) & 0xFF);
+        uint16_t base = low + high * 256;
+        uint16_t address = base + y;
+        if(is_write || ((base & 0xFF00) != (address & 0xFF00))) {
+            index_cycle(base, address);
+        }
+        return address;
+    }
+
+    uint16_t indexed_indirect()
+    {
+        uint8_t base = read_pc_inc();
+        idle_read(base);
+        uint8_t zpg = (base + x) & 0xFF;
+        uint8_t low = read(zpg);
+        uint8_t high = read((zpg + 1) & 0xFF);
+        uint16_t address = low + high * 256;
+        return address;
+    }
+
+    uint16_t absolute_indexed_X(bool is_write)
+    {
+        uint8_t low = read_pc_inc();
+        uint8_t high = read_pc_inc();
+        uint16_t base = low + high * 256;
+        uint16_t address = base + x;
+        if(is_write || ((base & 0xFF00) != (address & 0xFF00))) {
+            index_cycle(base, address);
+        }
+        return address;
+    }
+
+    uint16_t absolute_indexed_Y(bool is_write)
+    {
+        uint8_t low = read_pc_inc();
+        uint8_t high = read_pc_inc();
+        uint16_t base = low + high * 256;
+        uint16_t address = base + y;
+        if(is_write || ((base & 0xFF00) != (address & 0xFF00))) {
+            index_cycle(base, address);
+        }
+        return address;
+    }
+
+    // Handlers for instructions that only differ by addressing mode are
+    // composed from a mode, which calls one of the helpers above, and an
+    // operation.  _W modes always spend the index cycle, as stores do.
+    enum Addressing {
+        IMMEDIATE,
+        ZEROPAGE, ZEROPAGE_X, ZEROPAGE_Y, ZEROPAGE_INDIRECT,
+        ABSOLUTE, ABSOLUTE_X, ABSOLUTE_X_W, ABSOLUTE_Y, ABSOLUTE_Y_W,
+        INDEXED_INDIRECT, INDIRECT_INDEXED, INDIRECT_INDEXED_W,
+    };
+
+    // Shifts and rotates of abs, X skip the index cycle on the 65C02
+    // unless the index crosses a page
+    static constexpr Addressing ABSOLUTE_X_SHIFT = VARIANT::cmos ? ABSOLUTE_X : ABSOLUTE_X_W;
+
+    enum Operation {
+        LDA, LDX, LDY, ORA, AND, EOR, ADC, SBC, CMP, CPX, CPY, BIT,
+        DECIMAL_ADC, DECIMAL_SBC,
+        STA, STX, STY, STZ,
+        ASL, LSR, ROL, ROR, INC, DEC, TSB, TRB,
+    };
+
+    template<Addressing MODE>
+    uint16_t effective_address()
+    {
+        if constexpr (MODE == ZEROPAGE) {
+            return zeropage();
+        } else if constexpr (MODE == ZEROPAGE_X) {
+            return zeropage_indexed_X();
+        } else if constexpr (MODE == ZEROPAGE_Y) {
+            return zeropage_indexed_Y();
+        } else if constexpr (MODE == ZEROPAGE_INDIRECT) {
+            return zeropage_indirect();
+        } else if constexpr (MODE == ABSOLUTE) {
+            return absolute();
+        } else if constexpr ((MODE == ABSOLUTE_X) || (MODE == ABSOLUTE_X_W)) {
+            return absolute_indexed_X(MODE == ABSOLUTE_X_W);
+        } else if constexpr ((MODE == ABSOLUTE_Y) || (MODE == ABSOLUTE_Y_W)) {
+            return absolute_indexed_Y(MODE == ABSOLUTE_Y_W);
+        } else if constexpr (MODE == INDEXED_INDIRECT) {
+            return indexed_indirect();
+        } else {
+            static_assert((MODE == INDIRECT_INDEXED) || (MODE == INDIRECT_INDEXED_W));
+            return indirect_indexed(MODE == INDIRECT_INDEXED_W);
+        }
+    }
+
+    // LDA through BIT: fetch the operand and operate on it
+    template<Addressing MODE, Operation OP>
+    void read_instruction()
+    {
+        uint8_t m;
+        if constexpr (MODE == IMMEDIATE) {
+            m = read_pc_inc();
+        } else {
+            m = read(effective_address<MODE>());
+        }
+
+        if constexpr (OP == LDA) {
+            set_flags(N | Z, a = m);
+        } else if constexpr (OP == LDX) {
+            set_flags(N | Z, x = m);
+        } else if constexpr (OP == LDY) {
+            set_flags(N | Z, y = m);
+        } else if constexpr (OP == ORA) {
+            set_flags(N | Z, a = a | m);
+        } else if constexpr (OP == AND) {
+            set_flags(N | Z, a = a & m);
+        } else if constexpr (OP == EOR) {
+            set_flags(N | Z, a = a ^ m);
+        } else if constexpr ((OP == ADC) || (OP == DECIMAL_ADC)) {
+            uint8_t carry = isset(C) ? 1 : 0;
+            if((OP == DECIMAL_ADC) || (!decimal_dispatch && decimal())) {
+                adc_bcd(m, carry);
+            } else {
+                flag_change(C, ((uint16_t)a + (uint16_t)m + carry) > 0xFF);
+                flag_change(V, adc_overflow(a, m, carry));
+                set_flags(N | Z, a = a + m + carry);
+            }
+        } else if constexpr ((OP == SBC) || (OP == DECIMAL_SBC)) {
+            uint8_t borrow = isset(C) ? 0 : 1;
+            if((OP == DECIMAL_SBC) || (!decimal_dispatch && decimal())) {
+                sbc_bcd(m, borrow);
+            } else {
+                flag_change(C, !(a < (m + borrow)));
+                flag_change(V, sbc_overflow(a, m, borrow));
+                set_flags(N | Z, a = a - (m + borrow));
+            }
+        } else if constexpr ((OP == CMP) || (OP == CPX) || (OP == CPY)) {
+            uint8_t r = (OP == CMP) ? a : (OP == CPX) ? x : y;
+            flag_change(C, m <= r);
+            set_flags(N | Z, r - m);
+        } else {
+            static_assert(OP == BIT);
+            flag_change(Z, (a & m) == 0);
+            if constexpr (MODE != IMMEDIATE) { // BIT imm only sets Z
+                flag_change(N, m & 0x80);
+                flag_change(V, m & 0x40);
+            }
+        }
+    }
+
+    // STA through STZ
+    template<Addressing MODE, Operation OP>
+    void write_instruction()
+    {
+        uint16_t addr = effective_address<MODE>();
+        if constexpr (OP == STA) {
+            write(addr, a);
+        } else if constexpr (OP == STX) {
+            write(addr, x);
+        } else if constexpr (OP == STY) {
+            write(addr, y);
+        } else {
+            static_assert(OP == STZ);
+            write(addr, 0);
+        }
+    }
+
+    // ASL through TRB on memory.  TSB and TRB have no modify cycle.
+    template<Addressing MODE, Operation OP>
+    void modify_instruction()
+    {
+        uint16_t addr = effective_address<MODE>();
+        uint8_t m = read(addr);
+        if constexpr ((OP == INC) || (OP == DEC)) {
+            modify_cycle(addr, m);
+            set_flags(N | Z, m = (OP == INC) ? m + 1 : m - 1);
+        } else if constexpr ((OP == TSB) || (OP == TRB)) {
+            modify_cycle(addr, m);
+            set_flags(Z, m & a);
+            m = (OP == TSB) ? (m | a) : (m & ~a);
+        } else {
+            modify_cycle(addr, m);
+            bool c = isset(C);
+            if constexpr (OP == ASL) {
+                flag_change(C, m & 0x80);
+                set_flags(N | Z, m = m << 1);
+            } else if constexpr (OP == LSR) {
+                flag_change(C, m & 0x01);
+                set_flags(N | Z, m = m >> 1);
+            } else if constexpr (OP == ROL) {
+                flag_change(C, m & 0x80);
+                set_flags(N | Z, m = (c ? 0x01 : 0x00) | (m << 1));
+            } else {
+                static_assert(OP == ROR);
+                flag_change(C, m & 0x01);
+                set_flags(N | Z, m = (c ? 0x80 : 0x00) | (m >> 1));
+            }
+        }
+        write(addr, m);
+    }
+
+    bool slice_done(uint64_t cycle_end)
+    {
+        return stop_requested || (total_cycles >= cycle_end);
     }
 
-    uint16_t indirect_indexed(bool is_write)
+    // Reset, then NMI, then IRQ.  IRQ is a level, so it stays pending
+    // until the device releases its line.
+    void take_interrupt()
     {
-        uint8_t zpg = read_pc_inc();
-        uint8_t low = read(zpg);
-        uint8_t high = read((zpg + 1) & 0xFF);
-        uint16_t base = low + high * 256;
-        uint16_t address = base + y;
-        if(is_write || ((base & 0xFF00) != (address & 0xFF00))) {
-            clk.add_cpu_cycles(1);
+        uint32_t pending = interrupts.load(std::memory_order_acquire) & accepted_interrupts();
+        if(pending & RESET_PENDING) {
+            interrupts.fetch_and(~uint32_t(RESET_PENDING | NMI_PENDING), std::memory_order_relaxed);
+            reset();
+        } else if(pending & NMI_PENDING) {
+            interrupts.fetch_and(~uint32_t(NMI_PENDING), std::memory_order_relaxed);
+            nmi();
+        } else if(pending) {
+            irq();
         }
-        return address;
+        retire_instruction();
     }
 
-    uint16_t indexed_indirect()
+    void cycle()
     {
-        uint8_t zpg = (read_pc_inc() + x) & 0xFF;
-        clk.add_cpu_cycles(1);
-        uint8_t low = read(zpg);
-        uint8_t high = read((zpg + 1) & 0xFF);
-        uint16_t address = low + high * 256;
-        return address;
+        run(1);
     }
 
-    uint16_t absolute_indexed_X(bool is_write)
+    uint64_t run(uint64_t cycle_budget)
     {
-        uint8_t low = read_pc_inc();
-        uint8_t high = read_pc_inc();
-        uint16_t base = low + high * 256;
-        uint16_t address = base + x;
-        if(is_write || ((base & 0xFF00) != (address & 0xFF00))) {
-            clk.add_cpu_cycles(1);
+        uint64_t start = total_cycles;
+        if(cycle_budget > 0) {
+            execute(start + cycle_budget);
         }
-        return address;
+        stop_requested = false;
+        report_cycles();
+        return total_cycles - start;
     }
 
-    uint16_t absolute_indexed_Y(bool is_write)
+    uint64_t run_until(uint64_t cycle)
     {
-        uint8_t low = read_pc_inc();
-        uint8_t high = read_pc_inc();
-        uint16_t base = low + high * 256;
-        uint16_t address = base + y;
-        if(is_write || ((base & 0xFF00) != (address & 0xFF00))) {
-            clk.add_cpu_cycles(1);
-        }
-        return address;
+        return run((cycle > total_cycles) ? (cycle - total_cycles) : 0);
     }
 
-    void cycle()
+    struct ModeHandler
     {
-        if(exception == RESET) {
-            reset();
-        } if(exception == NMI) {
-            nmi();
-        } if(exception == INT) {
-            irq();
+        int mode;
+        uint8_t op;
+        const void* handler;
+    };
+
+    typedef std::array<std::array<const void*, 256>, dispatch_modes> DispatchTables;
+
+    // One table per combination of mode bits: base, with the handlers
+    // for each bit that is set.  Opcodes the variant doesn't implement
+    // stay unhandled.
+    template<size_t COUNT>
+    static DispatchTables dispatch_tables(const void* const (&base)[256], const ModeHandler (&mode_handlers)[COUNT])
+    {
+        DispatchTables tables;
+        for(int mode = 0; mode < dispatch_modes; mode++) {
+            std::copy(base, base + 256, tables[mode].begin());
+            for(const ModeHandler& h: mode_handlers) {
+                if((mode & h.mode) && cpu6502_opcodes<VARIANT>[h.op].implemented) {
+                    tables[mode][h.op] = h.handler;
+                }
+            }
         }
-        // BRK is a special case caused directly by an instruction
-
-        uint8_t inst = read_pc_inc();
+        return tables;
+    }
 
+    // Issue instructions back to back until total_cycles reaches
+    // cycle_end or a stop is requested, taking interrupts between them.
+    // At least one instruction is issued.  With threaded dispatch every
+    // handler decodes and jumps to the next opcode itself, so the host
+    // predictor sees one indirect branch per handler instead of a single
+    // shared one at the top of a switch.  It also keeps a table per
+    // dispatch_mode(), switched only by the instructions that change
+    // the mode, so binary ADC and SBC never test D.
+    void execute(uint64_t cycle_end)
+    {
+        uint8_t inst;
         uint8_t m;
 
-        switch(inst) {
+        slice_end = cycle_end;
+        fetch_page = no_fetch_page;
+
+        if(halt != RUNNING) {
+            pass_halted_cycles(cycle_end);
+            if(halt != RUNNING) {
+                return;
+            }
+        }
+
+// Opcodes the variant doesn't implement are unhandled
+#define CPU6502_REQUIRE(feature) \
+        do { \
+            if constexpr (!(feature)) { \
+                goto op_illegal; \
+            } \
+        } while(0)
+
+#if CPU6502_THREADED_DISPATCH
+
+#define CPU6502_OP(n) op_##n:
+#define CPU6502_DECIMAL_OP(n) op_##n##_decimal:
+#define CPU6502_ENTRY(n) (cpu6502_opcodes<VARIANT>[n].implemented ? &&op_##n : &&op_illegal)
+#define CPU6502_MODE_CHANGED() (handlers = dispatch[dispatch_mode()].data())
+#define CPU6502_DISPATCH() \
+        do { \
+            if(interrupt_pending()) [[unlikely]] { \
+                take_interrupt(); \
+                CPU6502_MODE_CHANGED(); \
+            } \
+            if constexpr (CACHE::enabled) { \
+                if(at_cached_code() || enter_block()) { \
+                    inst = fetch_cached()->bytes[0]; \
+                    goto *handlers[inst]; \
+                } \
+            } \
+            inst = read_pc_inc(); \
+            goto *handlers[inst]; \
+        } while(0)
+#define CPU6502_NEXT_RETIRED() \
+        do { \
+            if(slice_done(cycle_end)) { \
+                return; \
+            } \
+            CPU6502_DISPATCH(); \
+        } while(0)
+#define CPU6502_NEXT() \
+        do { \
+            retire_instruction(); \
+            instruction_done(); \
+            CPU6502_NEXT_RETIRED(); \
+        } while(0)
+
+        static const void* const base_handlers[256] = {
+            /* 0x0- */ CPU6502_ENTRY(0x00), CPU6502_ENTRY(0x01), CPU6502_ENTRY(0x02), CPU6502_ENTRY(0x03), CPU6502_ENTRY(0x04), CPU6502_ENTRY(0x05), CPU6502_ENTRY(0x06), CPU6502_ENTRY(0x07),
+                       CPU6502_ENTRY(0x08), CPU6502_ENTRY(0x09), CPU6502_ENTRY(0x0A), CPU6502_ENTRY(0x0B), CPU6502_ENTRY(0x0C), CPU6502_ENTRY(0x0D), CPU6502_ENTRY(0x0E), CPU6502_ENTRY(0x0F),
+            /* 0x1- */ CPU6502_ENTRY(0x10), CPU6502_ENTRY(0x11), CPU6502_ENTRY(0x12), CPU6502_ENTRY(0x13), CPU6502_ENTRY(0x14), CPU6502_ENTRY(0x15), CPU6502_ENTRY(0x16), CPU6502_ENTRY(0x17),
+                       CPU6502_ENTRY(0x18), CPU6502_ENTRY(0x19), CPU6502_ENTRY(0x1A), CPU6502_ENTRY(0x1B), CPU6502_ENTRY(0x1C), CPU6502_ENTRY(0x1D), CPU6502_ENTRY(0x1E), CPU6502_ENTRY(0x1F),
+            /* 0x2- */ CPU6502_ENTRY(0x20), CPU6502_ENTRY(0x21), CPU6502_ENTRY(0x22), CPU6502_ENTRY(0x23), CPU6502_ENTRY(0x24), CPU6502_ENTRY(0x25), CPU6502_ENTRY(0x26), CPU6502_ENTRY(0x27),
+                       CPU6502_ENTRY(0x28), CPU6502_ENTRY(0x29), CPU6502_ENTRY(0x2A), CPU6502_ENTRY(0x2B), CPU6502_ENTRY(0x2C), CPU6502_ENTRY(0x2D), CPU6502_ENTRY(0x2E), CPU6502_ENTRY(0x2F),
+            /* 0x3- */ CPU6502_ENTRY(0x30), CPU6502_ENTRY(0x31), CPU6502_ENTRY(0x32), CPU6502_ENTRY(0x33), CPU6502_ENTRY(0x34), CPU6502_ENTRY(0x35), CPU6502_ENTRY(0x36), CPU6502_ENTRY(0x37),
+                       CPU6502_ENTRY(0x38), CPU6502_ENTRY(0x39), CPU6502_ENTRY(0x3A), CPU6502_ENTRY(0x3B), CPU6502_ENTRY(0x3C), CPU6502_ENTRY(0x3D), CPU6502_ENTRY(0x3E), CPU6502_ENTRY(0x3F),
+            /* 0x4- */ CPU6502_ENTRY(0x40), CPU6502_ENTRY(0x41), CPU6502_ENTRY(0x42), CPU6502_ENTRY(0x43), CPU6502_ENTRY(0x44), CPU6502_ENTRY(0x45), CPU6502_ENTRY(0x46), CPU6502_ENTRY(0x47),
+                       CPU6502_ENTRY(0x48), CPU6502_ENTRY(0x49), CPU6502_ENTRY(0x4A), CPU6502_ENTRY(0x4B), CPU6502_ENTRY(0x4C), CPU6502_ENTRY(0x4D), CPU6502_ENTRY(0x4E), CPU6502_ENTRY(0x4F),
+            /* 0x5- */ CPU6502_ENTRY(0x50), CPU6502_ENTRY(0x51), CPU6502_ENTRY(0x52), CPU6502_ENTRY(0x53), CPU6502_ENTRY(0x54), CPU6502_ENTRY(0x55), CPU6502_ENTRY(0x56), CPU6502_ENTRY(0x57),
+                       CPU6502_ENTRY(0x58), CPU6502_ENTRY(0x59), CPU6502_ENTRY(0x5A), CPU6502_ENTRY(0x5B), CPU6502_ENTRY(0x5C), CPU6502_ENTRY(0x5D), CPU6502_ENTRY(0x5E), CPU6502_ENTRY(0x5F),
+            /* 0x6- */ CPU6502_ENTRY(0x60), CPU6502_ENTRY(0x61), CPU6502_ENTRY(0x62), CPU6502_ENTRY(0x63), CPU6502_ENTRY(0x64), CPU6502_ENTRY(0x65), CPU6502_ENTRY(0x66), CPU6502_ENTRY(0x67),
+                       CPU6502_ENTRY(0x68), CPU6502_ENTRY(0x69), CPU6502_ENTRY(0x6A), CPU6502_ENTRY(0x6B), CPU6502_ENTRY(0x6C), CPU6502_ENTRY(0x6D), CPU6502_ENTRY(0x6E), CPU6502_ENTRY(0x6F),
+            /* 0x7- */ CPU6502_ENTRY(0x70), CPU6502_ENTRY(0x71), CPU6502_ENTRY(0x72), CPU6502_ENTRY(0x73), CPU6502_ENTRY(0x74), CPU6502_ENTRY(0x75), CPU6502_ENTRY(0x76), CPU6502_ENTRY(0x77),
+                       CPU6502_ENTRY(0x78), CPU6502_ENTRY(0x79), CPU6502_ENTRY(0x7A), CPU6502_ENTRY(0x7B), CPU6502_ENTRY(0x7C), CPU6502_ENTRY(0x7D), CPU6502_ENTRY(0x7E), CPU6502_ENTRY(0x7F),
+            /* 0x8- */ CPU6502_ENTRY(0x80), CPU6502_ENTRY(0x81), CPU6502_ENTRY(0x82), CPU6502_ENTRY(0x83), CPU6502_ENTRY(0x84), CPU6502_ENTRY(0x85), CPU6502_ENTRY(0x86), CPU6502_ENTRY(0x87),
+                       CPU6502_ENTRY(0x88), CPU6502_ENTRY(0x89), CPU6502_ENTRY(0x8A), CPU6502_ENTRY(0x8B), CPU6502_ENTRY(0x8C), CPU6502_ENTRY(0x8D), CPU6502_ENTRY(0x8E), CPU6502_ENTRY(0x8F),
+            /* 0x9- */ CPU6502_ENTRY(0x90), CPU6502_ENTRY(0x91), CPU6502_ENTRY(0x92), CPU6502_ENTRY(0x93), CPU6502_ENTRY(0x94), CPU6502_ENTRY(0x95), CPU6502_ENTRY(0x96), CPU6502_ENTRY(0x97),
+                       CPU6502_ENTRY(0x98), CPU6502_ENTRY(0x99), CPU6502_ENTRY(0x9A), CPU6502_ENTRY(0x9B), CPU6502_ENTRY(0x9C), CPU6502_ENTRY(0x9D), CPU6502_ENTRY(0x9E), CPU6502_ENTRY(0x9F),
+            /* 0xA- */ CPU6502_ENTRY(0xA0), CPU6502_ENTRY(0xA1), CPU6502_ENTRY(0xA2), CPU6502_ENTRY(0xA3), CPU6502_ENTRY(0xA4), CPU6502_ENTRY(0xA5), CPU6502_ENTRY(0xA6), CPU6502_ENTRY(0xA7),
+                       CPU6502_ENTRY(0xA8), CPU6502_ENTRY(0xA9), CPU6502_ENTRY(0xAA), CPU6502_ENTRY(0xAB), CPU6502_ENTRY(0xAC), CPU6502_ENTRY(0xAD), CPU6502_ENTRY(0xAE), CPU6502_ENTRY(0xAF),
+            /* 0xB- */ CPU6502_ENTRY(0xB0), CPU6502_ENTRY(0xB1), CPU6502_ENTRY(0xB2), CPU6502_ENTRY(0xB3), CPU6502_ENTRY(0xB4), CPU6502_ENTRY(0xB5), CPU6502_ENTRY(0xB6), CPU6502_ENTRY(0xB7),
+                       CPU6502_ENTRY(0xB8), CPU6502_ENTRY(0xB9), CPU6502_ENTRY(0xBA), CPU6502_ENTRY(0xBB), CPU6502_ENTRY(0xBC), CPU6502_ENTRY(0xBD), CPU6502_ENTRY(0xBE), CPU6502_ENTRY(0xBF),
+            /* 0xC- */ CPU6502_ENTRY(0xC0), CPU6502_ENTRY(0xC1), CPU6502_ENTRY(0xC2), CPU6502_ENTRY(0xC3), CPU6502_ENTRY(0xC4), CPU6502_ENTRY(0xC5), CPU6502_ENTRY(0xC6), CPU6502_ENTRY(0xC7),
+                       CPU6502_ENTRY(0xC8), CPU6502_ENTRY(0xC9), CPU6502_ENTRY(0xCA), CPU6502_ENTRY(0xCB), CPU6502_ENTRY(0xCC), CPU6502_ENTRY(0xCD), CPU6502_ENTRY(0xCE), CPU6502_ENTRY(0xCF),
+            /* 0xD- */ CPU6502_ENTRY(0xD0), CPU6502_ENTRY(0xD1), CPU6502_ENTRY(0xD2), CPU6502_ENTRY(0xD3), CPU6502_ENTRY(0xD4), CPU6502_ENTRY(0xD5), CPU6502_ENTRY(0xD6), CPU6502_ENTRY(0xD7),
+                       CPU6502_ENTRY(0xD8), CPU6502_ENTRY(0xD9), CPU6502_ENTRY(0xDA), CPU6502_ENTRY(0xDB), CPU6502_ENTRY(0xDC), CPU6502_ENTRY(0xDD), CPU6502_ENTRY(0xDE), CPU6502_ENTRY(0xDF),
+            /* 0xE- */ CPU6502_ENTRY(0xE0), CPU6502_ENTRY(0xE1), CPU6502_ENTRY(0xE2), CPU6502_ENTRY(0xE3), CPU6502_ENTRY(0xE4), CPU6502_ENTRY(0xE5), CPU6502_ENTRY(0xE6), CPU6502_ENTRY(0xE7),
+                       CPU6502_ENTRY(0xE8), CPU6502_ENTRY(0xE9), CPU6502_ENTRY(0xEA), CPU6502_ENTRY(0xEB), CPU6502_ENTRY(0xEC), CPU6502_ENTRY(0xED), CPU6502_ENTRY(0xEE), CPU6502_ENTRY(0xEF),
+            /* 0xF- */ CPU6502_ENTRY(0xF0), CPU6502_ENTRY(0xF1), CPU6502_ENTRY(0xF2), CPU6502_ENTRY(0xF3), CPU6502_ENTRY(0xF4), CPU6502_ENTRY(0xF5), CPU6502_ENTRY(0xF6), CPU6502_ENTRY(0xF7),
+                       CPU6502_ENTRY(0xF8), CPU6502_ENTRY(0xF9), CPU6502_ENTRY(0xFA), CPU6502_ENTRY(0xFB), CPU6502_ENTRY(0xFC), CPU6502_ENTRY(0xFD), CPU6502_ENTRY(0xFE), CPU6502_ENTRY(0xFF),
+        };
+
+        // Handlers replacing base_handlers while a mode bit is set
+        static const ModeHandler mode_handlers[] = {
+            {DECIMAL_MODE, 0x61, &&op_0x61_decimal}, {DECIMAL_MODE, 0x65, &&op_0x65_decimal},
+            {DECIMAL_MODE, 0x69, &&op_0x69_decimal}, {DECIMAL_MODE, 0x6D, &&op_0x6D_decimal},
+            {DECIMAL_MODE, 0x71, &&op_0x71_decimal}, {DECIMAL_MODE, 0x72, &&op_0x72_decimal},
+            {DECIMAL_MODE, 0x75, &&op_0x75_decimal}, {DECIMAL_MODE, 0x79, &&op_0x79_decimal},
+            {DECIMAL_MODE, 0x7D, &&op_0x7D_decimal},
+            {DECIMAL_MODE, 0xE1, &&op_0xE1_decimal}, {DECIMAL_MODE, 0xE5, &&op_0xE5_decimal},
+            {DECIMAL_MODE, 0xE9, &&op_0xE9_decimal}, {DECIMAL_MODE, 0xED, &&op_0xED_decimal},
+            {DECIMAL_MODE, 0xF1, &&op_0xF1_decimal}, {DECIMAL_MODE, 0xF2, &&op_0xF2_decimal},
+            {DECIMAL_MODE, 0xF5, &&op_0xF5_decimal}, {DECIMAL_MODE, 0xF9, &&op_0xF9_decimal},
+            {DECIMAL_MODE, 0xFD, &&op_0xFD_decimal},
+        };
+
+        static const auto dispatch = dispatch_tables(base_handlers, mode_handlers);
+        const void* const* handlers;
+        CPU6502_MODE_CHANGED();
+
+        CPU6502_DISPATCH();
+
+        {
+#else /* ! CPU6502_THREADED_DISPATCH */
+
+#define CPU6502_OP(n) case n:
+#define CPU6502_NEXT() break
+#define CPU6502_NEXT_RETIRED() if(slice_done(cycle_end)) { return; } else continue
+#define CPU6502_MODE_CHANGED() do {} while(0)
+
+        for(;;) {
+            if(interrupt_pending()) [[unlikely]] {
+                take_interrupt();
+            }
+
+            if constexpr (CACHE::enabled) {
+                if(at_cached_code() || enter_block()) {
+                    inst = fetch_cached()->bytes[0];
+                } else {
+                    inst = read_pc_inc();
+                }
+            } else {
+                inst = read_pc_inc();
+            }
+
+            switch(inst) {
+#endif /* CPU6502_THREADED_DISPATCH */
 // -- timing updated from CPU manual
 
-            case 0x0A: { // ASL A
+            CPU6502_OP(0x0A) { // ASL A
                 flag_change(C, a & 0x80);
                 set_flags(N | Z, a = a << 1);
-                clk.add_cpu_cycles(1);
-                break;
+                idle_read(pc);
+                CPU6502_NEXT();
             }
 
-            case 0xEA: { // NOP
-                clk.add_cpu_cycles(1);
-                break;
+            CPU6502_OP(0xEA) { // NOP
+                idle_read(pc);
+                CPU6502_NEXT();
             }
 
-            case 0x8A: { // TXA impl
+            CPU6502_OP(0x8A) { // TXA impl
                 set_flags(N | Z, a = x);
-                clk.add_cpu_cycles(1);
-                break;
+                idle_read(pc);
+                CPU6502_NEXT();
             }
 
-            case 0xAA: { // TAX impl
+            CPU6502_OP(0xAA) { // TAX impl
                 set_flags(N | Z, x = a);
-                clk.add_cpu_cycles(1);
-                break;
+                idle_read(pc);
+                CPU6502_NEXT();
             }
 
-            case 0xBA: { // TSX impl
+            CPU6502_OP(0xBA) { // TSX impl
                 set_flags(N | Z, x = s);
-                clk.add_cpu_cycles(1);
-                break;
+                idle_read(pc);
+                CPU6502_NEXT();
             }
 
-            case 0x9A: { // TXS impl
+            CPU6502_OP(0x9A) { // TXS impl
                 s = x;
-                clk.add_cpu_cycles(1);
-                break;
+                if(hook_verifying) [[unlikely]] {
+                    check_hook_stack();
+                }
+                idle_read(pc);
+                CPU6502_NEXT();
             }
 
-            case 0xA8: { // TAY impl
+            CPU6502_OP(0xA8) { // TAY impl
                 set_flags(N | Z, y = a);
-                clk.add_cpu_cycles(1);
-                break;
+                idle_read(pc);
+                CPU6502_NEXT();
             }
 
-            case 0x98: { // TYA impl
+            CPU6502_OP(0x98) { // TYA impl
                 set_flags(N | Z, a = y);
-                clk.add_cpu_cycles(1);
-                break;
+                idle_read(pc);
+                CPU6502_NEXT();
             }
 
-            case 0x18: { // CLC impl
+            CPU6502_OP(0x18) { // CLC impl
                 flag_clear(C);
-                clk.add_cpu_cycles(1);
-                break;
+                idle_read(pc);
+                CPU6502_NEXT();
             }
 
-            case 0x38: { // SEC impl
+            CPU6502_OP(0x38) { // SEC impl
                 flag_set(C);
-                clk.add_cpu_cycles(1);
-                break;
+                idle_read(pc);
+                CPU6502_NEXT();
             }
 
-            case 0xF8: { // SED impl
+            CPU6502_OP(0xF8) { // SED impl
                 flag_set(D);
-                clk.add_cpu_cycles(1);
-                break;
+                CPU6502_MODE_CHANGED();
+                idle_read(pc);
+                CPU6502_NEXT();
             }
 
-            case 0xD8: { // CLD impl
+            CPU6502_OP(0xD8) { // CLD impl
                 flag_clear(D);
-                clk.add_cpu_cycles(1);
-                break;
+                CPU6502_MODE_CHANGED();
+                idle_read(pc);
+                CPU6502_NEXT();
             }
 
-            case 0x58: { // CLI impl
+            CPU6502_OP(0x58) { // CLI impl
                 flag_clear(I);
-                clk.add_cpu_cycles(1);
-                break;
+                idle_read(pc);
+                CPU6502_NEXT();
             }
 
-            case 0x78: { // SEI impl
+            CPU6502_OP(0x78) { // SEI impl
                 flag_set(I);
-                clk.add_cpu_cycles(1);
-                break;
+                idle_read(pc);
+                CPU6502_NEXT();
             }
 
-            case 0xB8: { // CLV impl
+            CPU6502_OP(0xB8) { // CLV impl
                 flag_clear(V);
-                clk.add_cpu_cycles(1);
-                break;
+                idle_read(pc);
+                CPU6502_NEXT();
             }
 
-            case 0xCA: { // DEX impl
+            CPU6502_OP(0xCA) { // DEX impl
                 set_flags(N | Z, x = x - 1);
-                clk.add_cpu_cycles(1);
-                break;
+                idle_read(pc);
+                CPU6502_NEXT();
             }
 
-            case 0x88: { // DEY impl
+            CPU6502_OP(0x88) { // DEY impl
                 set_flags(N | Z, y = y - 1);
-                clk.add_cpu_cycles(1);
-                break;
+                idle_read(pc);
+                CPU6502_NEXT();
             }
 
-            case 0xE8: { // INX impl
+            CPU6502_OP(0xE8) { // INX impl
                 set_flags(N | Z, x = x + 1);
-                clk.add_cpu_cycles(1);
-                break;
+                idle_read(pc);
+                CPU6502_NEXT();
             }
 
-            case 0xC8: { // INY impl
+            CPU6502_OP(0xC8) { // INY impl
                 set_flags(N | Z, y = y + 1);
-                clk.add_cpu_cycles(1);
-                break;
+                idle_read(pc);
+                CPU6502_NEXT();
             }
 
-            case 0x71: { // ADC (ind), Y
-                uint16_t addr = indirect_indexed(false);
-                m = read(addr);
-                uint8_t carry = isset(C) ? 1 : 0;
-                if(isset(D)) {
-                    adc_bcd(m, carry);
-                } else {
-                    flag_change(C, ((uint16_t)a + (uint16_t)m + carry) > 0xFF);
-                    flag_change(V, adc_overflow(a, m, carry));
-                    set_flags(N | Z, a = a + m + carry);
-                }
-                break;
+            CPU6502_OP(0x71) { // ADC (ind), Y
+                read_instruction<INDIRECT_INDEXED, ADC>();
+                CPU6502_NEXT();
             }
 
-            case 0x61: { // ADC (ind, X)
-                uint16_t addr = indexed_indirect();
-                m = read(addr);
-                uint8_t carry = isset(C) ? 1 : 0;
-                if(isset(D)) {
-                    adc_bcd(m, carry);
-                } else {
-                    flag_change(C, ((uint16_t)a + (uint16_t)m + carry) > 0xFF);
-                    flag_change(V, adc_overflow(a, m, carry));
-                    set_flags(N | Z, a = a + m + carry);
-                }
-                break;
+            CPU6502_OP(0x61) { // ADC (ind, X)
+                read_instruction<INDEXED_INDIRECT, ADC>();
+                CPU6502_NEXT();
             }
 
-            case 0x6D: { // ADC abs
-                uint16_t addr = absolute();
-                m = read(addr);
-                uint8_t carry = isset(C) ? 1 : 0;
-                if(isset(D)) {
-                    adc_bcd(m, carry);
-                } else {
-                    flag_change(C, ((uint16_t)a + (uint16_t)m + carry) > 0xFF);
-                    flag_change(V, adc_overflow(a, m, carry));
-                    set_flags(N | Z, a = a + m + carry);
-                }
-                break;
+            CPU6502_OP(0x6D) { // ADC abs
+                read_instruction<ABSOLUTE, ADC>();
+                CPU6502_NEXT();
             }
 
-            case 0x65: { // ADC zpg
-                uint8_t zpg = zeropage();
-                m = read(zpg);
-                uint8_t carry = isset(C) ? 1 : 0;
-                if(isset(D)) {
-                    adc_bcd(m, carry);
-                } else {
-                    flag_change(C, ((uint16_t)a + (uint16_t)m + carry) > 0xFF);
-                    flag_change(V, adc_overflow(a, m, carry));
-                    set_flags(N | Z, a = a + m + carry);
-                }
-                break;
+            CPU6502_OP(0x65) { // ADC zpg
+                read_instruction<ZEROPAGE, ADC>();
+                CPU6502_NEXT();
             }
 
-            case 0x7D: { // ADC abs, X
-                uint16_t addr = absolute_indexed_X(false);
-                m = read(addr);
-                uint8_t carry = isset(C) ? 1 : 0;
-                if(isset(D)) {
-                    adc_bcd(m, carry);
-                } else {
-                    flag_change(C, ((uint16_t)a + (uint16_t)m + carry) > 0xFF);
-                    flag_change(V, adc_overflow(a, m, carry));
-                    set_flags(N | Z, a = a + m + carry);
-                }
-                break;
+            CPU6502_OP(0x7D) { // ADC abs, X
+                read_instruction<ABSOLUTE_X, ADC>();
+                CPU6502_NEXT();
             }
 
-            case 0x79: { // ADC abs, Y
-                uint16_t addr = absolute_indexed_Y(false);
-                m = read(addr);
-                uint8_t carry = isset(C) ? 1 : 0;
-                if(isset(D)) {
-                    adc_bcd(m, carry);
-                } else {
-                    flag_change(C, ((uint16_t)a + (uint16_t)m + carry) > 0xFF);
-                    flag_change(V, adc_overflow(a, m, carry));
-                    set_flags(N | Z, a = a + m + carry);
-                }
-                break;
+            CPU6502_OP(0x79) { // ADC abs, Y
+                read_instruction<ABSOLUTE_Y, ADC>();
+                CPU6502_NEXT();
             }
 
-            case 0x69: { // ADC imm
-                m = read_pc_inc();
-                uint8_t carry = isset(C) ? 1 : 0;
-                if(isset(D)) {
-                    adc_bcd(m, carry);
-                } else {
-                    flag_change(C, ((uint16_t)a + (uint16_t)m + carry) > 0xFF);
-                    flag_change(V, adc_overflow(a, m, carry));
-                    set_flags(N | Z, a = a + m + carry);
-                }
-                break;
+            CPU6502_OP(0x69) { // ADC imm
+                read_instruction<IMMEDIATE, ADC>();
+                CPU6502_NEXT();
             }
 
 
-            case 0x00: { // BRK
+            CPU6502_OP(0x00) { // BRK
+                idle_read(pc); // the byte after BRK
                 stack_push((pc + 1) >> 8);
                 stack_push((pc + 1) & 0xFF);
-                stack_push(p | B2 | B); // | B says the Synertek 6502 reference
-                p |= I;
-#if EMULATE_65C02
-                p &= ~D;
-#endif /* EMULATE_65C02 */
+                stack_push(get_p() | B2 | B); // | B says the Synertek 6502 reference
+                flag_set(I);
+                if constexpr (VARIANT::cmos) {
+                    flag_clear(D);
+                    CPU6502_MODE_CHANGED();
+                }
                 uint8_t low = read(0xFFFE);
                 uint8_t high = read(0xFFFF);
-                clk.add_cpu_cycles(1);
                 pc = low + high * 256;
-                exception = NONE;
-                break;
+                CPU6502_NEXT();
             }
 
-            case 0x20: { // JSR abs
+            CPU6502_OP(0x20) { // JSR abs
                 uint16_t to_push = pc + 1;
                 uint16_t addr = absolute();
+                idle_read(0x100 + s); // the part reads the high byte after the pushes
                 stack_push(to_push >> 8);
                 stack_push(to_push & 0xFF);
-                clk.add_cpu_cycles(1);
                 pc = addr;
-                break;
+                if(hooked[pc]) [[unlikely]] {
+                    enter_hook();
+                    CPU6502_MODE_CHANGED();
+                }
+                CPU6502_NEXT();
             }
 
-            case 0xC6: { // DEC zpg
-                uint8_t zpg = zeropage();
-                set_flags(N | Z, m = read(zpg) - 1);
-                clk.add_cpu_cycles(1);
-                write(zpg, m);
-                break;
+            CPU6502_OP(0xC6) { // DEC zpg
+                modify_instruction<ZEROPAGE, DEC>();
+                CPU6502_NEXT();
             }
 
-            case 0xD6: { // DEC zpg, X
-                uint8_t zpg = zeropage_indexed_X();
-                set_flags(N | Z, m = read(zpg) - 1);
-                clk.add_cpu_cycles(1);
-                write(zpg, m);
-                break;
+            CPU6502_OP(0xD6) { // DEC zpg, X
+                modify_instruction<ZEROPAGE_X, DEC>();
+                CPU6502_NEXT();
             }
 
-            case 0xCE: { // DEC abs
-                uint16_t addr = absolute();
-                set_flags(N | Z, m = read(addr) - 1);
-                clk.add_cpu_cycles(1);
-                write(addr, m);
-                break;
+            CPU6502_OP(0xCE) { // DEC abs
+                modify_instruction<ABSOLUTE, DEC>();
+                CPU6502_NEXT();
             }
 
-            case 0xDE: { // DEC abs, X
-                uint16_t addr = absolute_indexed_X(true);
-                set_flags(N | Z, m = read(addr) - 1);
-                clk.add_cpu_cycles(1);
-                write(addr, m);
-                break;
+            CPU6502_OP(0xDE) { // DEC abs, X
+                modify_instruction<ABSOLUTE_X_W, DEC>();
+                CPU6502_NEXT();
             }
 
-            case 0xE6: { // INC zpg
-                uint8_t zpg = zeropage();
-                set_flags(N | Z, m = read(zpg) + 1);
-                clk.add_cpu_cycles(1);
-                write(zpg, m);
-                break;
+            CPU6502_OP(0xE6) { // INC zpg
+                modify_instruction<ZEROPAGE, INC>();
+                CPU6502_NEXT();
             }
 
-            case 0xF6: { // INC zpg, X
-                uint8_t zpg = zeropage_indexed_X();
-                set_flags(N | Z, m = read(zpg) + 1);
-                clk.add_cpu_cycles(1);
-                write(zpg, m);
-                break;
+            CPU6502_OP(0xF6) { // INC zpg, X
+                modify_instruction<ZEROPAGE_X, INC>();
+                CPU6502_NEXT();
             }
 
-            case 0xEE: { // INC abs
-                uint16_t addr = absolute();
-                set_flags(N | Z, m = read(addr) + 1);
-                clk.add_cpu_cycles(1);
-                write(addr, m);
-                break;
+            CPU6502_OP(0xEE) { // INC abs
+                modify_instruction<ABSOLUTE, INC>();
+                CPU6502_NEXT();
             }
 
-            case 0xFE: { // INC abs, X
-                uint16_t addr = absolute_indexed_X(true);
-                set_flags(N | Z, m = read(addr) + 1);
-                clk.add_cpu_cycles(1);
-                write(addr, m);
-                break;
+            CPU6502_OP(0xFE) { // INC abs, X
+                modify_instruction<ABSOLUTE_X_W, INC>();
+                CPU6502_NEXT();
             }
 
-            case 0x10: { // BPL rel
+            CPU6502_OP(0x10) { // BPL rel
                 branch(!isset(N));
-                break;
+                CPU6502_NEXT();
             }
 
-            case 0x50: { // BVC rel
+            CPU6502_OP(0x50) { // BVC rel
                 branch(!isset(V));
-                break;
+                CPU6502_NEXT();
             }
 
-            case 0x70: { // BVS rel
+            CPU6502_OP(0x70) { // BVS rel
                 branch(isset(V));
-                break;
+                CPU6502_NEXT();
             }
 
-            case 0x30: { // BMI rel
+            CPU6502_OP(0x30) { // BMI rel
                 branch(isset(N));
-                break;
+                CPU6502_NEXT();
             }
 
-            case 0x90: { // BCC rel
+            CPU6502_OP(0x90) { // BCC rel
                 branch(!isset(C));
-                break;
+                CPU6502_NEXT();
             }
 
-            case 0xB0: { // BCS rel
+            CPU6502_OP(0xB0) { // BCS rel
                 branch(isset(C));
-                break;
+                CPU6502_NEXT();
             }
 
-            case 0xD0: { // BNE rel
+            CPU6502_OP(0xD0) { // BNE rel
                 branch(!isset(Z));
-                break;
+                CPU6502_NEXT();
             }
 
-            case 0xF0: { // BEQ rel
+            CPU6502_OP(0xF0) { // BEQ rel
                 branch(isset(Z));
-                break;
+                CPU6502_NEXT();
             }
 
-#if EMULATE_65C02
-            case 0x80: { // BRA rel, 65C02
+            CPU6502_OP(0x80) { // BRA rel, 65C02
+                CPU6502_REQUIRE(VARIANT::cmos);
                 branch(true);
-                break;
+                CPU6502_NEXT();
             }
-#endif
 
-            case 0xA1: { // LDA (ind, X)
-                uint16_t addr = indexed_indirect();
-                set_flags(N | Z, a = read(addr));
-                break;
+            CPU6502_OP(0xA1) { // LDA (ind, X)
+                read_instruction<INDEXED_INDIRECT, LDA>();
+                CPU6502_NEXT();
             }
 
-            case 0xB5: { // LDA zpg, X
-                uint8_t addr = zeropage_indexed_X();
-                set_flags(N | Z, a = read(addr));
-                break;
+            CPU6502_OP(0xB5) { // LDA zpg, X
+                read_instruction<ZEROPAGE_X, LDA>();
+                CPU6502_NEXT();
             }
 
-            case 0xB1: { // LDA (ind), Y
-                uint16_t addr = indirect_indexed(false);
-                set_flags(N | Z, a = read(addr));
-                break;
+            CPU6502_OP(0xB1) { // LDA (ind), Y
+                read_instruction<INDIRECT_INDEXED, LDA>();
+                CPU6502_NEXT();
             }
 
-            case 0x4A: { // LSR A
+            CPU6502_OP(0x4A) { // LSR A
                 flag_change(C, a & 0x01);
-                clk.add_cpu_cycles(1);
+                idle_read(pc);
                 set_flags(N | Z, a = a >> 1);
-                break;
+                CPU6502_NEXT();
             }
 
-            case 0x2A: { // ROL A
+            CPU6502_OP(0x2A) { // ROL A
                 bool c = isset(C);
                 flag_change(C, a & 0x80);
-                clk.add_cpu_cycles(1);
+                idle_read(pc);
                 set_flags(N | Z, a = (c ? 0x01 : 0x00) | (a << 1));
-                break;
+                CPU6502_NEXT();
             }
 
-            case 0x6A: { // ROR A
+            CPU6502_OP(0x6A) { // ROR A
                 bool c = isset(C);
                 flag_change(C, a & 0x01);
-                clk.add_cpu_cycles(1);
+                idle_read(pc);
                 set_flags(N | Z, a = (c ? 0x80 : 0x00) | (a >> 1));
-                break;
+                CPU6502_NEXT();
             }
 
 // -- in progress
 
-            case 0xA5: { // LDA zpg
-                uint8_t zpg = zeropage();
-                set_flags(N | Z, a = read(zpg));
-                break;
+            CPU6502_OP(0xA5) { // LDA zpg
+                read_instruction<ZEROPAGE, LDA>();
+                CPU6502_NEXT();
             }
 
-            case 0xB9: { // LDA abs, Y
-                uint16_t addr = absolute_indexed_Y(false);
-                set_flags(N | Z, a = read(addr));
-                break;
+            CPU6502_OP(0xB9) { // LDA abs, Y
+                read_instruction<ABSOLUTE_Y, LDA>();
+                CPU6502_NEXT();
             }
 
-            case 0xBD: { // LDA abs, X
-                uint16_t addr = absolute_indexed_X(false);
-                set_flags(N | Z, a = read(addr));
-                break;
+            CPU6502_OP(0xBD) { // LDA abs, X
+                read_instruction<ABSOLUTE_X, LDA>();
+                CPU6502_NEXT();
             }
 
-            case 0xA9: { // LDA imm
-                uint8_t imm = read_pc_inc();
-                set_flags(N | Z, a = imm);
-                break;
+            CPU6502_OP(0xA9) { // LDA imm
+                read_instruction<IMMEDIATE, LDA>();
+                CPU6502_NEXT();
             }
 
-            case 0xAD: { // LDA abs
-                uint16_t addr = absolute();
-                set_flags(N | Z, a = read(addr));
-                break;
+            CPU6502_OP(0xAD) { // LDA abs
+                read_instruction<ABSOLUTE, LDA>();
+                CPU6502_NEXT();
             }
 
-#if EMULATE_65C02
 
-            case 0xB2: { // LDA (zpg), 65C02
-                uint16_t addr = zeropage_indirect();
-                set_flags(N | Z, a = read(addr));
-                break;
+            CPU6502_OP(0xB2) { // LDA (zpg), 65C02
+                CPU6502_REQUIRE(VARIANT::cmos);
+                read_instruction<ZEROPAGE_INDIRECT, LDA>();
+                CPU6502_NEXT();
             }
 
-#endif
 
 // -- timing not updated from CPU manual
 
-            case 0xDD: { // CMP abs, X
-                uint16_t addr = absolute_indexed_X(false);
-                m = read(addr);
-                flag_change(C, m <= a);
-                set_flags(N | Z, m = a - m);
-                break;
+            CPU6502_OP(0xDD) { // CMP abs, X
+                read_instruction<ABSOLUTE_X, CMP>();
+                CPU6502_NEXT();
             }
 
-            case 0xC1: { // CMP (ind, X)
-                uint16_t addr = indexed_indirect();
-                m = read(addr);
-                flag_change(C, m <= a);
-                set_flags(N | Z, m = a - m);
-                break;
+            CPU6502_OP(0xC1) { // CMP (ind, X)
+                read_instruction<INDEXED_INDIRECT, CMP>();
+                CPU6502_NEXT();
             }
 
-            case 0xD9: { // CMP abs, Y
-                uint16_t addr = absolute_indexed_Y(false);
-                m = read(addr);
-                flag_change(C, m <= a);
-                set_flags(N | Z, m = a - m);
-                break;
+            CPU6502_OP(0xD9) { // CMP abs, Y
+                read_instruction<ABSOLUTE_Y, CMP>();
+                CPU6502_NEXT();
             }
 
-            case 0xBC: { // LDY abs, X
-                uint16_t addr = absolute_indexed_X(false);
-                set_flags(N | Z, y = read(addr));
-                break;
+            CPU6502_OP(0xBC) { // LDY abs, X
+                read_instruction<ABSOLUTE_X, LDY>();
+                CPU6502_NEXT();
             }
 
-            case 0xF5: { // SBC zpg, X
-                uint8_t zpg = zeropage_indexed_X();
-                m = read(zpg);
-                uint8_t borrow = isset(C) ? 0 : 1;
-                if(isset(D)) {
-                    sbc_bcd(m, borrow);
-                } else {
-                    flag_change(C, !(a < (m + borrow)));
-                    flag_change(V, sbc_overflow(a, m, borrow));
-                    set_flags(N | Z, a = a - (m + borrow));
-                }
-                break;
+            CPU6502_OP(0xF5) { // SBC zpg, X
+                read_instruction<ZEROPAGE_X, SBC>();
+                CPU6502_NEXT();
             }
 
-            case 0xE5: { // SBC zpg
-                uint8_t zpg = zeropage();
-                m = read(zpg);
-                uint8_t borrow = isset(C) ? 0 : 1;
-                if(isset(D)) {
-                    sbc_bcd(m, borrow);
-                } else {
-                    flag_change(C, !(a < (m + borrow)));
-                    flag_change(V, sbc_overflow(a, m, borrow));
-                    set_flags(N | Z, a = a - (m + borrow));
-                }
-                break;
+            CPU6502_OP(0xE5) { // SBC zpg
+                read_instruction<ZEROPAGE, SBC>();
+                CPU6502_NEXT();
             }
 
-#if EMULATE_65C02
-            case 0xF2: { // SBC (zpg), 65C02
-                uint16_t addr = zeropage_indirect();
-                m = read(addr);
-                uint8_t borrow = isset(C) ? 0 : 1;
-                if(isset(D)) {
-                    sbc_bcd(m, borrow);
-                } else {
-                    flag_change(C, !(a < (m + borrow)));
-                    flag_change(V, sbc_overflow(a, m, borrow));
-                    set_flags(N | Z, a = a - (m + borrow));
-                }
-                break;
+            CPU6502_OP(0xF2) { // SBC (zpg), 65C02
+                CPU6502_REQUIRE(VARIANT::cmos);
+                read_instruction<ZEROPAGE_INDIRECT, SBC>();
+                CPU6502_NEXT();
             }
-#endif /* EMULATE_65C02 */
 
-            case 0xE1: { // SBC (ind, X), 65C02
-                uint16_t addr = indexed_indirect();
-                m = read(addr);
-                uint8_t borrow = isset(C) ? 0 : 1;
-                if(isset(D)) {
-                    sbc_bcd(m, borrow);
-                } else {
-                    flag_change(C, !(a < (m + borrow)));
-                    flag_change(V, sbc_overflow(a, m, borrow));
-                    set_flags(N | Z, a = a - (m + borrow));
-                }
-                break;
+            CPU6502_OP(0xE1) { // SBC (ind, X), 65C02
+                read_instruction<INDEXED_INDIRECT, SBC>();
+                CPU6502_NEXT();
             }
 
-            case 0xF1: { // SBC (ind), Y
-                uint16_t addr = indirect_indexed(false);
-                m = read(addr);
-                uint8_t borrow = isset(C) ? 0 : 1;
-                if(isset(D)) {
-                    sbc_bcd(m, borrow);
-                } else {
-                    flag_change(C, !(a < (m + borrow)));
-                    flag_change(V, sbc_overflow(a, m, borrow));
-                    set_flags(N | Z, a = a - (m + borrow));
-                }
-                break;
+            CPU6502_OP(0xF1) { // SBC (ind), Y
+                read_instruction<INDIRECT_INDEXED, SBC>();
+                CPU6502_NEXT();
             }
 
-            case 0xF9: { // SBC abs, Y
-                uint16_t addr = absolute_indexed_Y(false);
-                uint8_t m = read(addr);
-                uint8_t borrow = isset(C) ? 0 : 1;
-                if(isset(D)) {
-                    sbc_bcd(m, borrow);
-                } else {
-                    flag_change(C, !(a < (m + borrow)));
-                    flag_change(V, sbc_overflow(a, m, borrow));
-                    set_flags(N | Z, a = a - (m + borrow));
-                }
-                break;
+            CPU6502_OP(0xF9) { // SBC abs, Y
+                read_instruction<ABSOLUTE_Y, SBC>();
+                CPU6502_NEXT();
             }
 
-            case 0xFD: { // SBC abs, X
-                uint16_t addr = absolute_indexed_X(false);
-                uint8_t m = read(addr);
-                uint8_t borrow = isset(C) ? 0 : 1;
-                if(isset(D)) {
-                    sbc_bcd(m, borrow);
-                } else {
-                    flag_change(C, !(a < (m + borrow)));
-                    flag_change(V, sbc_overflow(a, m, borrow));
-                    set_flags(N | Z, a = a - (m + borrow));
-                }
-                break;
+            CPU6502_OP(0xFD) { // SBC abs, X
+                read_instruction<ABSOLUTE_X, SBC>();
+                CPU6502_NEXT();
             }
 
-            case 0xED: { // SBC abs
-                uint16_t addr = absolute();
-                uint8_t m = read(addr);
-                uint8_t borrow = isset(C) ? 0 : 1;
-                if(isset(D)) {
-                    sbc_bcd(m, borrow);
-                } else {
-                    flag_change(C, !(a < (m + borrow)));
-                    flag_change(V, sbc_overflow(a, m, borrow));
-                    set_flags(N | Z, a = a - (m + borrow));
-                }
-                break;
+            CPU6502_OP(0xED) { // SBC abs
+                read_instruction<ABSOLUTE, SBC>();
+                CPU6502_NEXT();
             }
 
-            case 0xE9: { // SBC imm
-                uint8_t m = read_pc_inc();
-                uint8_t borrow = isset(C) ? 0 : 1;
-                if(isset(D)) {
-                    sbc_bcd(m, borrow);
-                } else {
-                    flag_change(C, !(a < (m + borrow)));
-                    flag_change(V, sbc_overflow(a, m, borrow));
-                    set_flags(N | Z, a = a - (m + borrow));
-                }
-                break;
+            CPU6502_OP(0xE9) { // SBC imm
+                read_instruction<IMMEDIATE, SBC>();
+                CPU6502_NEXT();
             }
 
-            case 0x0E: { // ASL abs
-                uint16_t addr = absolute();
-                m = read(addr);
-                clk.add_cpu_cycles(1);
-                flag_change(C, m & 0x80);
-                set_flags(N | Z, m = m << 1);
-                write(addr, m);
-                break;
+            CPU6502_OP(0x0E) { // ASL abs
+                modify_instruction<ABSOLUTE, ASL>();
+                CPU6502_NEXT();
             }
 
-            case 0x1E: { // ASL abs, X
-#if EMULATE_65C02
-                uint16_t addr = absolute_indexed_X(false);
-#else /* !EMULATE_65C02 */
-                uint16_t addr = absolute_indexed_X(true);
-#endif /* EMULATE_65C02 */
-                m = read(addr);
-                clk.add_cpu_cycles(1);
-                flag_change(C, m & 0x80);
-                set_flags(N | Z, m = m << 1);
-                write(addr, m);
-                break;
+            CPU6502_OP(0x1E) { // ASL abs, X
+                modify_instruction<ABSOLUTE_X_SHIFT, ASL>();
+                CPU6502_NEXT();
             }
 
-            case 0x06: { // ASL zpg
-                uint8_t zpg = zeropage();
-                m = read(zpg);
-                clk.add_cpu_cycles(1);
-                flag_change(C, m & 0x80);
-                set_flags(N | Z, m = m << 1);
-                write(zpg, m);
-                break;
+            CPU6502_OP(0x06) { // ASL zpg
+                modify_instruction<ZEROPAGE, ASL>();
+                CPU6502_NEXT();
             }
 
-            case 0x16: { // ASL zpg, X
-                uint8_t zpg = zeropage_indexed_X();
-                m = read(zpg);
-                clk.add_cpu_cycles(1);
-                flag_change(C, m & 0x80);
-                set_flags(N | Z, m = m << 1);
-                write(zpg, m);
-                break;
+            CPU6502_OP(0x16) { // ASL zpg, X
+                modify_instruction<ZEROPAGE_X, ASL>();
+                CPU6502_NEXT();
             }
 
-            case 0x5E: { // LSR abs, X
-#if EMULATE_65C02
-                uint16_t addr = absolute_indexed_X(false);
-#else /* !EMULATE_65C02 */
-                uint16_t addr = absolute_indexed_X(true);
-#endif /* EMULATE_65C02 */
-                m = read(addr);
-                clk.add_cpu_cycles(1);
-                flag_change(C, m & 0x01);
-                set_flags(N | Z, m = m >> 1);
-                write(addr, m);
-                break;
+            CPU6502_OP(0x5E) { // LSR abs, X
+                modify_instruction<ABSOLUTE_X_SHIFT, LSR>();
+                CPU6502_NEXT();
             }
 
-            case 0x46: { // LSR zpg
-                uint8_t zpg = zeropage();
-                m = read(zpg);
-                clk.add_cpu_cycles(1);
-                flag_change(C, m & 0x01);
-                set_flags(N | Z, m = m >> 1);
-                write(zpg, m);
-                break;
+            CPU6502_OP(0x46) { // LSR zpg
+                modify_instruction<ZEROPAGE, LSR>();
+                CPU6502_NEXT();
             }
 
-            case 0x56: { // LSR zpg, X
-                uint8_t zpg = zeropage_indexed_X();
-                m = read(zpg);
-                clk.add_cpu_cycles(1);
-                flag_change(C, m & 0x01);
-                set_flags(N | Z, m = m >> 1);
-                write(zpg, m);
-                break;
+            CPU6502_OP(0x56) { // LSR zpg, X
+                modify_instruction<ZEROPAGE_X, LSR>();
+                CPU6502_NEXT();
             }
 
-            case 0x4E: { // LSR abs
-                uint16_t addr = absolute();
-                m = read(addr);
-                clk.add_cpu_cycles(1);
-                flag_change(C, m & 0x01);
-                set_flags(N | Z, m = m >> 1);
-                write(addr, m);
-                break;
+            CPU6502_OP(0x4E) { // LSR abs
+                modify_instruction<ABSOLUTE, LSR>();
+                CPU6502_NEXT();
             }
 
-            case 0x68: { // PLA
-                clk.add_cpu_cycles(1);
-                clk.add_cpu_cycles(1); // Pipelined pre-increment
+            CPU6502_OP(0x68) { // PLA
+                idle_read(pc);
+                idle_read(0x100 + s); // Pipelined pre-increment
                 set_flags(N | Z, a = stack_pull());
-                break;
+                CPU6502_NEXT();
             }
 
-            case 0x48: { // PHA
-                clk.add_cpu_cycles(1);
+            CPU6502_OP(0x48) { // PHA
+                idle_read(pc);
                 stack_push(a);
-                break;
+                CPU6502_NEXT();
             }
 
-            case 0x01: { // ORA (ind, X)
-                uint16_t addr = indexed_indirect();
-                m = read(addr);
-                set_flags(N | Z, a = a | m);
-                break;
+            CPU6502_OP(0x01) { // ORA (ind, X)
+                read_instruction<INDEXED_INDIRECT, ORA>();
+                CPU6502_NEXT();
             }
 
-            case 0x15: { // ORA zpg, X
-                uint8_t zpg = zeropage_indexed_X();
-                m = read(zpg);
-                set_flags(N | Z, a = a | m);
-                break;
+            CPU6502_OP(0x15) { // ORA zpg, X
+                read_instruction<ZEROPAGE_X, ORA>();
+                CPU6502_NEXT();
             }
 
-            case 0x0D: { // ORA abs
-                uint16_t addr = absolute();
-                m = read(addr);
-                set_flags(N | Z, a = a | m);
-                break;
+            CPU6502_OP(0x0D) { // ORA abs
+                read_instruction<ABSOLUTE, ORA>();
+                CPU6502_NEXT();
             }
 
-            case 0x19: { // ORA abs, Y
-                uint16_t addr = absolute_indexed_Y(false);
-                m = read(addr);
-                set_flags(N | Z, a = a | m);
-                break;
+            CPU6502_OP(0x19) { // ORA abs, Y
+                read_instruction<ABSOLUTE_Y, ORA>();
+                CPU6502_NEXT();
             }
 
-            case 0x1D: { // ORA abs, X
-                uint16_t addr = absolute_indexed_X(false);
-                m = read(addr);
-                set_flags(N | Z, a = a | m);
-                break;
+            CPU6502_OP(0x1D) { // ORA abs, X
+                read_instruction<ABSOLUTE_X, ORA>();
+                CPU6502_NEXT();
             }
 
-            case 0x11: { // ORA (ind), Y
-                uint16_t addr = indirect_indexed(false);
-                m = read(addr);
-                set_flags(N | Z, a = a | m);
-                break;
+            CPU6502_OP(0x11) { // ORA (ind), Y
+                read_instruction<INDIRECT_INDEXED, ORA>();
+                CPU6502_NEXT();
             }
 
-            case 0x05: { // ORA zpg
-                uint8_t zpg = zeropage();
-                m = read(zpg);
-                set_flags(N | Z, a = a | m);
-                break;
+            CPU6502_OP(0x05) { // ORA zpg
+                read_instruction<ZEROPAGE, ORA>();
+                CPU6502_NEXT();
             }
 
-            case 0x09: { // ORA imm
-                uint8_t imm = read_pc_inc();
-                set_flags(N | Z, a = a | imm);
-                break;
+            CPU6502_OP(0x09) { // ORA imm
+                read_instruction<IMMEDIATE, ORA>();
+                CPU6502_NEXT();
             }
 
-#if EMULATE_65C02
-            case 0x32: { // AND (zpg), 65C02
-                uint16_t addr = zeropage_indirect();
-                m = read(addr);
-                set_flags(N | Z, a = a & m);
-                break;
+            CPU6502_OP(0x32) { // AND (zpg), 65C02
+                CPU6502_REQUIRE(VARIANT::cmos);
+                read_instruction<ZEROPAGE_INDIRECT, AND>();
+                CPU6502_NEXT();
             }
-#endif /* EMULATE_65C02 */
 
-            case 0x35: { // AND zpg, X
-                uint8_t zpg = zeropage_indexed_X();
-                set_flags(N | Z, a = a & read(zpg));
-                break;
+            CPU6502_OP(0x35) { // AND zpg, X
+                read_instruction<ZEROPAGE_X, AND>();
+                CPU6502_NEXT();
             }
 
-            case 0x21: { // AND (ind, X)
-                uint16_t addr = indexed_indirect();
-                set_flags(N | Z, a = a & read(addr));
-                break;
+            CPU6502_OP(0x21) { // AND (ind, X)
+                read_instruction<INDEXED_INDIRECT, AND>();
+                CPU6502_NEXT();
             }
 
-            case 0x31: { // AND (ind), Y
-                uint16_t addr = indirect_indexed(false);
-                set_flags(N | Z, a = a & read(addr));
-                break;
+            CPU6502_OP(0x31) { // AND (ind), Y
+                read_instruction<INDIRECT_INDEXED, AND>();
+                CPU6502_NEXT();
             }
 
-            case 0x3D: { // AND abs, X
-                uint16_t addr = absolute_indexed_X(false);
-                set_flags(N | Z, a = a & read(addr));
-                break;
+            CPU6502_OP(0x3D) { // AND abs, X
+                read_instruction<ABSOLUTE_X, AND>();
+                CPU6502_NEXT();
             }
 
-            case 0x39: { // AND abs, Y
-                uint16_t addr = absolute_indexed_Y(false);
-                set_flags(N | Z, a = a & read(addr));
-                break;
+            CPU6502_OP(0x39) { // AND abs, Y
+                read_instruction<ABSOLUTE_Y, AND>();
+                CPU6502_NEXT();
             }
 
-            case 0x2D: { // AND abs
-                uint16_t addr = absolute();
-                set_flags(N | Z, a = a & read(addr));
-                break;
+            CPU6502_OP(0x2D) { // AND abs
+                read_instruction<ABSOLUTE, AND>();
+                CPU6502_NEXT();
             }
 
-            case 0x25: { // AND zpg
-                uint8_t zpg = zeropage();
-                set_flags(N | Z, a = a & read(zpg));
-                break;
+            CPU6502_OP(0x25) { // AND zpg
+                read_instruction<ZEROPAGE, AND>();
+                CPU6502_NEXT();
             }
 
-            case 0x29: { // AND imm
-                uint8_t imm = read_pc_inc();
-                set_flags(N | Z, a = a & imm);
-                break;
+            CPU6502_OP(0x29) { // AND imm
+                read_instruction<IMMEDIATE, AND>();
+                CPU6502_NEXT();
             }
 
-            case 0x7E: { // ROR abs, X
-#if EMULATE_65C02
-                uint16_t addr = absolute_indexed_X(false);
-#else /* !EMULATE_65C02 */
-                uint16_t addr = absolute_indexed_X(true);
-#endif /* EMULATE_65C02 */
-                m = read(addr);
-                clk.add_cpu_cycles(1);
-                bool c = isset(C);
-                flag_change(C, m & 0x01);
-                set_flags(N | Z, m = (c ? 0x80 : 0x00) | (m >> 1));
-                write(addr, m);
-                break;
+            CPU6502_OP(0x7E) { // ROR abs, X
+                modify_instruction<ABSOLUTE_X_SHIFT, ROR>();
+                CPU6502_NEXT();
             }
 
-            case 0x36: { // ROL zpg, X
-                uint8_t zpg = zeropage_indexed_X();
-                m = read(zpg);
-                clk.add_cpu_cycles(1);
-                bool c = isset(C);
-                flag_change(C, m & 0x80);
-                set_flags(N | Z, m = (c ? 0x01 : 0x00) | (m << 1));
-                write(zpg, m);
-                break;
+            CPU6502_OP(0x36) { // ROL zpg, X
+                modify_instruction<ZEROPAGE_X, ROL>();
+                CPU6502_NEXT();
             }
 
 
-            case 0x3E: { // ROL abs, X
-#if EMULATE_65C02
-                uint16_t addr = absolute_indexed_X(false);
-#else /* !EMULATE_65C02 */
-                uint16_t addr = absolute_indexed_X(true);
-#endif /* EMULATE_65C02 */
-                m = read(addr);
-                clk.add_cpu_cycles(1);
-                bool c = isset(C);
-                flag_change(C, m & 0x80);
-                set_flags(N | Z, m = (c ? 0x01 : 0x00) | (m << 1));
-                write(addr, m);
-                break;
+            CPU6502_OP(0x3E) { // ROL abs, X
+                modify_instruction<ABSOLUTE_X_SHIFT, ROL>();
+                CPU6502_NEXT();
             }
 
-            case 0x6E: { // ROR abs
-                uint16_t addr = absolute();
-                m = read(addr);
-                clk.add_cpu_cycles(1);
-                bool c = isset(C);
-                flag_change(C, m & 0x01);
-                set_flags(N | Z, m = (c ? 0x80 : 0x00) | (m >> 1));
-                write(addr, m);
-                break;
+            CPU6502_OP(0x6E) { // ROR abs
+                modify_instruction<ABSOLUTE, ROR>();
+                CPU6502_NEXT();
             }
 
-            case 0x66: { // ROR zpg
-                uint8_t zpg = zeropage();
-                m = read(zpg);
-                clk.add_cpu_cycles(1);
-                bool c = isset(C);
-                flag_change(C, m & 0x01);
-                set_flags(N | Z, m = (c ? 0x80 : 0x00) | (m >> 1));
-                write(zpg, m);
-                break;
+            CPU6502_OP(0x66) { // ROR zpg
+                modify_instruction<ZEROPAGE, ROR>();
+                CPU6502_NEXT();
             }
 
-            case 0x76: { // ROR zpg, X
-                uint8_t zpg = zeropage_indexed_X();
-                m = read(zpg);
-                clk.add_cpu_cycles(1);
-                bool c = isset(C);
-                flag_change(C, m & 0x01);
-                set_flags(N | Z, m = (c ? 0x80 : 0x00) | (m >> 1));
-                write(zpg, m);
-                break;
+            CPU6502_OP(0x76) { // ROR zpg, X
+                modify_instruction<ZEROPAGE_X, ROR>();
+                CPU6502_NEXT();
             }
 
-            case 0x2E: { // ROL abs
-                uint16_t addr = absolute();
-                m = read(addr);
-                clk.add_cpu_cycles(1);
-                bool c = isset(C);
-                flag_change(C, m & 0x80);
-                set_flags(N | Z, m = (c ? 0x01 : 0x00) | (m << 1));
-                write(addr, m);
-                break;
+            CPU6502_OP(0x2E) { // ROL abs
+                modify_instruction<ABSOLUTE, ROL>();
+                CPU6502_NEXT();
             }
 
 
-            case 0x26: { // ROL zpg
-                uint8_t zpg = zeropage();
-                bool c = isset(C);
-                m = read(zpg);
-                clk.add_cpu_cycles(1);
-                flag_change(C, m & 0x80);
-                set_flags(N | Z, m = (c ? 0x01 : 0x00) | (m << 1));
-                write(zpg, m);
-                break;
+            CPU6502_OP(0x26) { // ROL zpg
+                modify_instruction<ZEROPAGE, ROL>();
+                CPU6502_NEXT();
             }
 
-            case 0x4C: { // JMP abs
+            CPU6502_OP(0x4C) { // JMP abs
+                uint16_t from = pc - 1;
                 uint16_t addr = absolute();
                 pc = addr;
-                break;
+                if constexpr (skip_idle_loops) {
+                    if(addr == from) {
+                        skip_idle_loop(from, 3);
+                    }
+                }
+                if(hooked[pc]) [[unlikely]] {
+                    enter_hook();
+                    CPU6502_MODE_CHANGED();
+                }
+                CPU6502_NEXT();
             }
 
-            case 0x6C: { // JMP indirect
+            CPU6502_OP(0x6C) { // JMP indirect
                 uint16_t addr = indirect();
                 pc = addr;
-                break;
+                if(hooked[pc]) [[unlikely]] {
+                    enter_hook();
+                    CPU6502_MODE_CHANGED();
+                }
+                CPU6502_NEXT();
             }
 
-            case 0x9D: { // STA abs, X
-                uint16_t addr = absolute_indexed_X(true);
-                write(addr, a);
-                break;
+            CPU6502_OP(0x9D) { // STA abs, X
+                write_instruction<ABSOLUTE_X_W, STA>();
+                CPU6502_NEXT();
             }
 
-            case 0x99: { // STA abs, Y
-                uint16_t addr = absolute_indexed_Y(true);
-                write(addr, a);
-                break;
+            CPU6502_OP(0x99) { // STA abs, Y
+                write_instruction<ABSOLUTE_Y_W, STA>();
+                CPU6502_NEXT();
             }
 
-            case 0x91: { // STA (ind), Y
-                uint16_t addr = indirect_indexed(true);
-                write(addr, a);
-                break;
+            CPU6502_OP(0x91) { // STA (ind), Y
+                write_instruction<INDIRECT_INDEXED_W, STA>();
+                CPU6502_NEXT();
             }
 
-            case 0x81: { // STA (ind, X)
-                uint16_t addr = indexed_indirect();
-                write(addr, a);
-                break;
+            CPU6502_OP(0x81) { // STA (ind, X)
+                write_instruction<INDEXED_INDIRECT, STA>();
+                CPU6502_NEXT();
             }
 
-            case 0x8D: { // STA abs
-                uint16_t addr = absolute();
-                write(addr, a);
-                break;
+            CPU6502_OP(0x8D) { // STA abs
+                write_instruction<ABSOLUTE, STA>();
+                CPU6502_NEXT();
             }
 
-            case 0x08: { // PHP
-                clk.add_cpu_cycles(1);
-                stack_push(p | B2 | B);
-                break;
+            CPU6502_OP(0x08) { // PHP
+                idle_read(pc);
+                stack_push(get_p() | B2 | B);
+                CPU6502_NEXT();
             }
 
-            case 0x28: { // PLP
-                clk.add_cpu_cycles(1);
-                clk.add_cpu_cycles(1); // Pipelined pre-increment
-                p = stack_pull() | B2 | B;
-                break;
+            CPU6502_OP(0x28) { // PLP
+                idle_read(pc);
+                idle_read(0x100 + s); // Pipelined pre-increment
+                set_p(stack_pull() | B2 | B);
+                CPU6502_MODE_CHANGED();
+                CPU6502_NEXT();
             }
 
-            case 0x24: { // BIT zpg
-                uint8_t zpg = zeropage();
-                m = read(zpg);
-                flag_change(Z, (a & m) == 0);
-                flag_change(N, m & 0x80);
-                flag_change(V, m & 0x40);
-                break;
+            CPU6502_OP(0x24) { // BIT zpg
+                read_instruction<ZEROPAGE, BIT>();
+                CPU6502_NEXT();
             }
 
-            case 0x34: { // BIT zpg, X
-                uint8_t zpg = zeropage_indexed_X();
-                m = read(zpg);
-                flag_change(Z, (a & m) == 0);
-                flag_change(N, m & 0x80);
-                flag_change(V, m & 0x40);
-                break;
+            CPU6502_OP(0x34) { // BIT zpg, X, 65C02 instruction; NOP zpg, X on NMOS
+                if constexpr (VARIANT::cmos) {
+                    read_instruction<ZEROPAGE_X, BIT>();
+                } else {
+                    m = read(effective_address<ZEROPAGE_X>());
+                }
+                CPU6502_NEXT();
             }
 
-            case 0x3C: { // BIT abs, X
-                uint16_t addr = absolute_indexed_X(false);
-                m = read(addr);
-                flag_change(Z, (a & m) == 0);
-                flag_change(N, m & 0x80);
-                flag_change(V, m & 0x40);
-                break;
+            CPU6502_OP(0x3C) { // BIT abs, X, 65C02 instruction; NOP abs, X on NMOS
+                if constexpr (VARIANT::cmos) {
+                    read_instruction<ABSOLUTE_X, BIT>();
+                } else {
+                    m = read(effective_address<ABSOLUTE_X>());
+                }
+                CPU6502_NEXT();
             }
 
-            case 0x2C: { // BIT abs
-                uint16_t addr = absolute();
-                m = read(addr);
-                flag_change(Z, (a & m) == 0);
-                flag_change(N, m & 0x80);
-                flag_change(V, m & 0x40);
-                break;
+            CPU6502_OP(0x2C) { // BIT abs
+                read_instruction<ABSOLUTE, BIT>();
+                CPU6502_NEXT();
             }
 
-            case 0xB4: { // LDY zpg, X
-                uint8_t zpg = zeropage_indexed_X();
-                set_flags(N | Z, y = read(zpg));
-                break;
+            CPU6502_OP(0xB4) { // LDY zpg, X
+                read_instruction<ZEROPAGE_X, LDY>();
+                CPU6502_NEXT();
             }
 
-            case 0xAE: { // LDX abs
-                uint16_t addr = absolute();
-                set_flags(N | Z, x = read(addr));
-                break;
+            CPU6502_OP(0xAE) { // LDX abs
+                read_instruction<ABSOLUTE, LDX>();
+                CPU6502_NEXT();
             }
 
-            case 0xBE: { // LDX abs, Y
-                uint16_t addr = absolute_indexed_Y(false);
-                set_flags(N | Z, x = read(addr));
-                break;
+            CPU6502_OP(0xBE) { // LDX abs, Y
+                read_instruction<ABSOLUTE_Y, LDX>();
+                CPU6502_NEXT();
             }
 
-            case 0xA6: { // LDX zpg
-                uint8_t zpg = zeropage();
-                set_flags(N | Z, x = read(zpg));
-                break;
+            CPU6502_OP(0xA6) { // LDX zpg
+                read_instruction<ZEROPAGE, LDX>();
+                CPU6502_NEXT();
             }
 
-            case 0xB6: { // LDX zpg, Y
-                uint8_t zpg = zeropage_indexed_Y();
-                set_flags(N | Z, x = read(zpg));
-                break;
+            CPU6502_OP(0xB6) { // LDX zpg, Y
+                read_instruction<ZEROPAGE_Y, LDX>();
+                CPU6502_NEXT();
             }
 
-            case 0xA4: { // LDY zpg
-                uint8_t zpg = zeropage();
-                set_flags(N | Z, y = read(zpg));
-                break;
+            CPU6502_OP(0xA4) { // LDY zpg
+                read_instruction<ZEROPAGE, LDY>();
+                CPU6502_NEXT();
             }
 
-            case 0xAC: { // LDY abs
-                uint16_t addr = absolute();
-                set_flags(N | Z, y = read(addr));
-                break;
+            CPU6502_OP(0xAC) { // LDY abs
+                read_instruction<ABSOLUTE, LDY>();
+                CPU6502_NEXT();
             }
 
-            case 0xA2: { // LDX imm
-                uint8_t imm = read_pc_inc();
-                set_flags(N | Z, x = imm);
-                break;
+            CPU6502_OP(0xA2) { // LDX imm
+                read_instruction<IMMEDIATE, LDX>();
+                CPU6502_NEXT();
             }
 
-            case 0xA0: { // LDY imm
-                uint8_t imm = read_pc_inc();
-                set_flags(N | Z, y = imm);
-                break;
+            CPU6502_OP(0xA0) { // LDY imm
+                read_instruction<IMMEDIATE, LDY>();
+                CPU6502_NEXT();
             }
 
-            case 0xCC: { // CPY abs
-                uint16_t addr = absolute();
-                m = read(addr);
-                flag_change(C, m <= y);
-                set_flags(N | Z, m = y - m);
-                break;
+            CPU6502_OP(0xCC) { // CPY abs
+                read_instruction<ABSOLUTE, CPY>();
+                CPU6502_NEXT();
             }
 
-            case 0xEC: { // CPX abs
-                uint16_t addr = absolute();
-                m = read(addr);
-                flag_change(C, m <= x);
-                set_flags(N | Z, m = x - m);
-                break;
+            CPU6502_OP(0xEC) { // CPX abs
+                read_instruction<ABSOLUTE, CPX>();
+                CPU6502_NEXT();
             }
 
-            case 0xC0: { // CPY imm
-                uint8_t imm = read_pc_inc();
-                flag_change(C, imm <= y);
-                set_flags(N | Z, imm = y - imm);
-                break;
+            CPU6502_OP(0xC0) { // CPY imm
+                read_instruction<IMMEDIATE, CPY>();
+                CPU6502_NEXT();
             }
 
-            case 0xE0: { // CPX imm
-                uint8_t imm = read_pc_inc();
-                flag_change(C, imm <= x);
-                set_flags(N | Z, imm = x - imm);
-                break;
+            CPU6502_OP(0xE0) { // CPX imm
+                read_instruction<IMMEDIATE, CPX>();
+                CPU6502_NEXT();
             }
 
-#if EMULATE_65C02
-            case 0x52: { // EOR (zpg), 65C02
-                uint16_t addr = zeropage_indirect();
-                m = read(addr);
-                set_flags(N | Z, a = a ^ m);
-                break;
+            CPU6502_OP(0x52) { // EOR (zpg), 65C02
+                CPU6502_REQUIRE(VARIANT::cmos);
+                read_instruction<ZEROPAGE_INDIRECT, EOR>();
+                CPU6502_NEXT();
             }
-#endif /* EMULATE_65C02 */
 
-            case 0x55: { // EOR zpg, X
-                uint8_t zpg = zeropage_indexed_X();
-                m = read(zpg);
-                set_flags(N | Z, a = a ^ m);
-                break;
+            CPU6502_OP(0x55) { // EOR zpg, X
+                read_instruction<ZEROPAGE_X, EOR>();
+                CPU6502_NEXT();
             }
 
-            case 0x41: { // EOR (ind, X)
-                uint16_t addr = indexed_indirect();
-                m = read(addr);
-                set_flags(N | Z, a = a ^ m);
-                break;
+            CPU6502_OP(0x41) { // EOR (ind, X)
+                read_instruction<INDEXED_INDIRECT, EOR>();
+                CPU6502_NEXT();
             }
 
-            case 0x4D: { // EOR abs
-                uint16_t addr = absolute();
-                m = read(addr);
-                set_flags(N | Z, a = a ^ m);
-                break;
+            CPU6502_OP(0x4D) { // EOR abs
+                read_instruction<ABSOLUTE, EOR>();
+                CPU6502_NEXT();
             }
 
-            case 0x5D: { // EOR abs, X
-                uint16_t addr = absolute_indexed_X(false);
-                m = read(addr);
-                set_flags(N | Z, a = a ^ m);
-                break;
+            CPU6502_OP(0x5D) { // EOR abs, X
+                read_instruction<ABSOLUTE_X, EOR>();
+                CPU6502_NEXT();
             }
 
-            case 0x59: { // EOR abs, Y
-                uint16_t addr = absolute_indexed_Y(false);
-                m = read(addr);
-                set_flags(N | Z, a = a ^ m);
-                break;
+            CPU6502_OP(0x59) { // EOR abs, Y
+                read_instruction<ABSOLUTE_Y, EOR>();
+                CPU6502_NEXT();
             }
 
-            case 0x45: { // EOR zpg
-                uint8_t zpg = zeropage();
-                set_flags(N | Z, a = a ^ read(zpg));
-                break;
+            CPU6502_OP(0x45) { // EOR zpg
+                read_instruction<ZEROPAGE, EOR>();
+                CPU6502_NEXT();
             }
 
-            case 0x49: { // EOR imm
-                uint8_t imm = read_pc_inc();
-                set_flags(N | Z, a = a ^ imm);
-                break;
+            CPU6502_OP(0x49) { // EOR imm
+                read_instruction<IMMEDIATE, EOR>();
+                CPU6502_NEXT();
             }
 
-            case 0x51: { // EOR (ind), Y
-                uint16_t addr = indirect_indexed(false);
-                m = read(addr);
-                set_flags(N | Z, a = a ^ m);
-                break;
+            CPU6502_OP(0x51) { // EOR (ind), Y
+                read_instruction<INDIRECT_INDEXED, EOR>();
+                CPU6502_NEXT();
             }
 
-            case 0xD1: { // CMP (ind), Y
-                uint16_t addr = indirect_indexed(false);
-                m = read(addr);
-                flag_change(C, m <= a);
-                set_flags(N | Z, m = a - m);
-                break;
+            CPU6502_OP(0xD1) { // CMP (ind), Y
+                read_instruction<INDIRECT_INDEXED, CMP>();
+                CPU6502_NEXT();
             }
 
-            case 0xC5: { // CMP zpg
-                uint8_t zpg = zeropage();
-                m = read(zpg);
-                flag_change(C, m <= a);
-                set_flags(N | Z, m = a - m);
-                break;
+            CPU6502_OP(0xC5) { // CMP zpg
+                read_instruction<ZEROPAGE, CMP>();
+                CPU6502_NEXT();
             }
 
-            case 0xCD: { // CMP abs
-                uint16_t addr = absolute();
-                m = read(addr);
-                flag_change(C, m <= a);
-                set_flags(N | Z, m = a - m);
-                break;
+            CPU6502_OP(0xCD) { // CMP abs
+                read_instruction<ABSOLUTE, CMP>();
+                CPU6502_NEXT();
             }
 
-            case 0xC9: { // CMP imm
-                uint8_t imm = read_pc_inc();
-                flag_change(C, imm <= a);
-                set_flags(N | Z, imm = a - imm);
-                break;
+            CPU6502_OP(0xC9) { // CMP imm
+                read_instruction<IMMEDIATE, CMP>();
+                CPU6502_NEXT();
             }
 
-            case 0xD5: { // CMP zpg, X
-                uint8_t zpg = zeropage_indexed_X();
-                m = read(zpg);
-                flag_change(C, m <= a);
-                set_flags(N | Z, m = a - m);
-                break;
+            CPU6502_OP(0xD5) { // CMP zpg, X
+                read_instruction<ZEROPAGE_X, CMP>();
+                CPU6502_NEXT();
             }
 
-            case 0xE4: { // CPX zpg
-                uint8_t zpg = zeropage();
-                m = read(zpg);
-                flag_change(C, m <= x);
-                set_flags(N | Z, m = x - m);
-                break;
+            CPU6502_OP(0xE4) { // CPX zpg
+                read_instruction<ZEROPAGE, CPX>();
+                CPU6502_NEXT();
             }
 
-            case 0xC4: { // CPY zpg
-                uint8_t zpg = zeropage();
-                m = read(zpg);
-                flag_change(C, m <= y);
-                set_flags(N | Z, m = y - m);
-                break;
+            CPU6502_OP(0xC4) { // CPY zpg
+                read_instruction<ZEROPAGE, CPY>();
+                CPU6502_NEXT();
             }
 
-            case 0x85: { // STA zpg
-                uint8_t zpg = zeropage();
-                write(zpg, a);
-                break;
+            CPU6502_OP(0x85) { // STA zpg
+                write_instruction<ZEROPAGE, STA>();
+                CPU6502_NEXT();
             }
 
-            case 0x40: { // RTI
-                clk.add_cpu_cycles(1);
-                p = stack_pull() | B2 | B;
-                clk.add_cpu_cycles(1); // Pipelined pre-increment
+            CPU6502_OP(0x40) { // RTI
+                idle_read(pc);
+                set_p(stack_pull() | B2 | B);
+                CPU6502_MODE_CHANGED();
+                idle_read(0x100 + s); // Pipelined pre-increment
                 uint8_t pcl = stack_pull();
                 uint8_t pch = stack_pull();
                 pc = pcl + pch * 256;
-                break;
+                CPU6502_NEXT();
             }
 
-            case 0x60: { // RTS
-                clk.add_cpu_cycles(1);
-                clk.add_cpu_cycles(1); // Pipelined pre-increment
+            CPU6502_OP(0x60) { // RTS
+                idle_read(pc);
+                idle_read(0x100 + s); // Pipelined pre-increment
                 uint8_t pcl = stack_pull();
                 uint8_t pch = stack_pull();
-                clk.add_cpu_cycles(1);
-                pc = pcl + pch * 256 + 1;
-                break;
+                pc = pcl + pch * 256;
+                idle_read(pc);
+                pc++;
+                if(hook_verifying && (s == hook_verify_s)) [[unlikely]] {
+                    finish_hook_verification();
+                }
+                CPU6502_NEXT();
             }
 
-           case 0x94: { // STY zpg, X
+           CPU6502_OP(0x94) { // STY zpg, X
                 uint8_t zpg = zeropage_indexed_X();
                 write(zpg, y);
-                break;
+                CPU6502_NEXT();
             }
 
-            case 0x95: { // STA zpg, X
-                uint8_t zpg = zeropage_indexed_X();
-                write(zpg, a);
-                break;
+            CPU6502_OP(0x95) { // STA zpg, X
+                write_instruction<ZEROPAGE_X, STA>();
+                CPU6502_NEXT();
             }
 
-            case 0x8E: { // STX abs
-                uint16_t addr = absolute();
-                write(addr, x);
-                break;
+            CPU6502_OP(0x8E) { // STX abs
+                write_instruction<ABSOLUTE, STX>();
+                CPU6502_NEXT();
             }
 
-            case 0x86: { // STX zpg
-                uint8_t zpg = zeropage();
-                write(zpg, x);
-                break;
+            CPU6502_OP(0x86) { // STX zpg
+                write_instruction<ZEROPAGE, STX>();
+                CPU6502_NEXT();
             }
 
-            case 0x96: { // STX zpg, Y
-                uint8_t zpg = zeropage_indexed_Y();
-                write(zpg, x);
-                break;
+            CPU6502_OP(0x96) { // STX zpg, Y
+                write_instruction<ZEROPAGE_Y, STX>();
+                CPU6502_NEXT();
             }
 
-            case 0x84: { // STY zpg
-                uint8_t zpg = zeropage();
-                write(zpg, y);
-                break;
+            CPU6502_OP(0x84) { // STY zpg
+                write_instruction<ZEROPAGE, STY>();
+                CPU6502_NEXT();
             }
 
-            case 0x8C: { // STY abs
-                uint16_t addr = absolute();
-                write(addr, y);
-                break;
+            CPU6502_OP(0x8C) { // STY abs
+                write_instruction<ABSOLUTE, STY>();
+                CPU6502_NEXT();
             }
 
-            case 0x75: { // ADC zpg, X
-                uint8_t addr = zeropage_indexed_X();
-                m = read(addr);
-                uint8_t carry = isset(C) ? 1 : 0;
-                if(isset(D)) {
-                    adc_bcd(m, carry);
-                } else {
-                    flag_change(C, ((uint16_t)a + (uint16_t)m + carry) > 0xFF);
-                    flag_change(V, adc_overflow(a, m, carry));
-                    set_flags(N | Z, a = a + m + carry);
-                }
-                break;
+            CPU6502_OP(0x75) { // ADC zpg, X
+                read_instruction<ZEROPAGE_X, ADC>();
+                CPU6502_NEXT();
             }
 
 
-#if EMULATE_65C02
             // 65C02 instructions
 
-            case 0x5A: { // PHY, 65C02
+            CPU6502_OP(0x5A) { // PHY, 65C02
+                CPU6502_REQUIRE(VARIANT::cmos);
+                idle_read(pc);
                 stack_push(y);
-                break;
+                CPU6502_NEXT();
             }
 
-            case 0x7A: { // PLY, 65C02
-                clk.add_cpu_cycles(1); // Pipelined pre-increment
+            CPU6502_OP(0x7A) { // PLY, 65C02
+                CPU6502_REQUIRE(VARIANT::cmos);
+                idle_read(pc);
+                idle_read(0x100 + s); // Pipelined pre-increment
                 set_flags(N | Z, y = stack_pull());
-                break;
+                CPU6502_NEXT();
             }
 
-            case 0xFA: { // PLX, 65C02
-                clk.add_cpu_cycles(1); // Pipelined pre-increment
+            CPU6502_OP(0xFA) { // PLX, 65C02
+                CPU6502_REQUIRE(VARIANT::cmos);
+                idle_read(pc);
+                idle_read(0x100 + s); // Pipelined pre-increment
                 set_flags(N | Z, x = stack_pull());
-                break;
+                CPU6502_NEXT();
             }
 
-            case 0x64: { // STZ zpg, 65C02
-                uint8_t zpg = zeropage();
-                write(zpg, 0);
-                break;
+            CPU6502_OP(0x64) { // STZ zpg, 65C02
+                CPU6502_REQUIRE(VARIANT::cmos);
+                write_instruction<ZEROPAGE, STZ>();
+                CPU6502_NEXT();
             }
 
-            case 0x74: { // STZ zpg, X, 65C02
-                uint8_t zpg = zeropage_indexed_X();
-                write(zpg, 0);
-                break;
+            CPU6502_OP(0x74) { // STZ zpg, X, 65C02
+                CPU6502_REQUIRE(VARIANT::cmos);
+                write_instruction<ZEROPAGE_X, STZ>();
+                CPU6502_NEXT();
             }
 
-            case 0x9C: { // STZ abs, 65C02
-                uint16_t addr = absolute();
-                write(addr, 0x0);
-                break;
+            CPU6502_OP(0x9C) { // STZ abs, 65C02
+                CPU6502_REQUIRE(VARIANT::cmos);
+                write_instruction<ABSOLUTE, STZ>();
+                CPU6502_NEXT();
             }
 
-            case 0xDA: { // PHX, 65C02
+            CPU6502_OP(0xDA) { // PHX, 65C02
+                CPU6502_REQUIRE(VARIANT::cmos);
+                idle_read(pc);
                 stack_push(x);
-                break;
+                CPU6502_NEXT();
             }
 
-            case 0x92: { // STA (zpg), 65C02
-                uint16_t addr = zeropage_indirect();
-                write(addr, a);
-                break;
+            CPU6502_OP(0x92) { // STA (zpg), 65C02
+                CPU6502_REQUIRE(VARIANT::cmos);
+                write_instruction<ZEROPAGE_INDIRECT, STA>();
+                CPU6502_NEXT();
             }
 
-            case 0x72: { // ADC (zpg), 65C02
-                uint16_t addr = zeropage_indirect();
-                m = read(addr);
-                uint8_t carry = isset(C) ? 1 : 0;
-                if(isset(D)) {
-                    adc_bcd(m, carry);
-                } else {
-                    flag_change(C, ((uint16_t)a + (uint16_t)m + carry) > 0xFF);
-                    flag_change(V, adc_overflow(a, m, carry));
-                    set_flags(N | Z, a = a + m + carry);
-                }
-                break;
+            CPU6502_OP(0x72) { // ADC (zpg), 65C02
+                CPU6502_REQUIRE(VARIANT::cmos);
+                read_instruction<ZEROPAGE_INDIRECT, ADC>();
+                CPU6502_NEXT();
             }
 
-            case 0x3A: { // DEC, 65C02
-               set_flags(N | Z, a = a - 1);
-                break;
+            CPU6502_OP(0x3A) { // DEC, 65C02
+                CPU6502_REQUIRE(VARIANT::cmos);
+                set_flags(N | Z, a = a - 1);
+                idle_read(pc);
+                CPU6502_NEXT();
             }
 
-            case 0x1A: { // INC, 65C02
+            CPU6502_OP(0x1A) { // INC, 65C02
+                CPU6502_REQUIRE(VARIANT::cmos);
                 set_flags(N | Z, a = a + 1);
-                break;
+                idle_read(pc);
+                CPU6502_NEXT();
             }
 
-            case 0x12: { // ORA (zpg), 65C02
-                uint16_t addr = zeropage_indirect();
-                m = read(addr);
-                set_flags(N | Z, a = a | m);
-                break;
+            CPU6502_OP(0x12) { // ORA (zpg), 65C02
+                CPU6502_REQUIRE(VARIANT::cmos);
+                read_instruction<ZEROPAGE_INDIRECT, ORA>();
+                CPU6502_NEXT();
             }
 
-            case 0xD2: { // CMP (zpg), 65C02 instruction
-                uint16_t addr = zeropage_indirect();
-                m = read(addr);
-                flag_change(C, m <= a);
-                set_flags(N | Z, m = a - m);
-                break;
+            CPU6502_OP(0xD2) { // CMP (zpg), 65C02 instruction
+                CPU6502_REQUIRE(VARIANT::cmos);
+                read_instruction<ZEROPAGE_INDIRECT, CMP>();
+                CPU6502_NEXT();
             }
 
-            case 0x1C: { // TRB abs, 65C02 instruction
-                uint16_t addr = absolute();
-                m = read(addr);
-                set_flags(Z, m & a);
-                write(addr, m & ~a);
-                break;
+            CPU6502_OP(0x1C) { // TRB abs, 65C02 instruction
+                CPU6502_REQUIRE(VARIANT::cmos);
+                modify_instruction<ABSOLUTE, TRB>();
+                CPU6502_NEXT();
             }
 
-            case 0x14: { // TRB zpg, 65C02 instruction
-                uint8_t zpgaddr = zeropage();
-                m = read(zpgaddr);
-                set_flags(Z, m & a);
-                write(zpgaddr, m & ~a);
-                break;
+            CPU6502_OP(0x14) { // TRB zpg, 65C02 instruction
+                CPU6502_REQUIRE(VARIANT::cmos);
+                modify_instruction<ZEROPAGE, TRB>();
+                CPU6502_NEXT();
             }
 
-            case 0x0C: { // TSB abs, 65C02 instruction
-                uint16_t addr = absolute();
-                m = read(addr);
-                set_flags(Z, m & a);
-                write(addr, m | a);
-                break;
+            CPU6502_OP(0x0C) { // TSB abs, 65C02 instruction
+                CPU6502_REQUIRE(VARIANT::cmos);
+                modify_instruction<ABSOLUTE, TSB>();
+                CPU6502_NEXT();
             }
 
-            case 0x04: { // TSB zpg, 65C02 instruction
-                uint8_t zpgaddr = zeropage();
-                m = read(zpgaddr);
-                set_flags(Z, m & a);
-                write(zpgaddr, m | a);
-                break;
+            CPU6502_OP(0x04) { // TSB zpg, 65C02 instruction; NOP zpg on NMOS
+                if constexpr (VARIANT::cmos) {
+                    modify_instruction<ZEROPAGE, TSB>();
+                } else {
+                    uint8_t zpgaddr = read_pc_inc();
+                    m = read(zpgaddr);
+                }
+                CPU6502_NEXT();
             }
 
-            case 0x02: case 0x22: case 0x42: case 0x62: case 0x82: case 0xC2: case 0xE2: { // two-byte NOP, 2 cycles
+            CPU6502_OP(0x02) CPU6502_OP(0x22) CPU6502_OP(0x42) CPU6502_OP(0x62) CPU6502_OP(0x82) CPU6502_OP(0xC2) CPU6502_OP(0xE2) { // two-byte NOP, 2 cycles
+                CPU6502_REQUIRE(VARIANT::cmos);
                 [[maybe_unused]] uint8_t ignored = read_pc_inc();
-                break;
+                CPU6502_NEXT();
             }
 
-            case 0x03: case 0x13: case 0x23: case 0x33: case 0x43: case 0x53: case 0x63: case 0x73:
-            case 0x83: case 0x93: case 0xA3: case 0xB3: case 0xC3: case 0xD3: case 0xE3: case 0xF3: { // one-byte NOP, 1 cycle
-                break;
+            CPU6502_OP(0x03) CPU6502_OP(0x13) CPU6502_OP(0x23) CPU6502_OP(0x33) CPU6502_OP(0x43) CPU6502_OP(0x53) CPU6502_OP(0x63) CPU6502_OP(0x73)
+            CPU6502_OP(0x83) CPU6502_OP(0x93) CPU6502_OP(0xA3) CPU6502_OP(0xB3) CPU6502_OP(0xC3) CPU6502_OP(0xD3) CPU6502_OP(0xE3) CPU6502_OP(0xF3) { // one-byte NOP, 1 cycle
+                CPU6502_REQUIRE(VARIANT::cmos);
+                CPU6502_NEXT();
             }
 
-            case 0x0B: case 0x1B: case 0x2B: case 0x3B: case 0x4B: case 0x5B: case 0x6B: case 0x7B:
-            case 0x8B: case 0x9B: case 0xAB: case 0xBB: case 0xCB: case 0xDB: case 0xEB: case 0xFB: { // one-byte NOP, 1 cycle
-                break;
+            CPU6502_OP(0x0B) CPU6502_OP(0x1B) CPU6502_OP(0x2B) CPU6502_OP(0x3B) CPU6502_OP(0x4B) CPU6502_OP(0x5B) CPU6502_OP(0x6B) CPU6502_OP(0x7B)
+            CPU6502_OP(0x8B) CPU6502_OP(0x9B) CPU6502_OP(0xAB) CPU6502_OP(0xBB) CPU6502_OP(0xEB) CPU6502_OP(0xFB) { // one-byte NOP, 1 cycle
+                CPU6502_REQUIRE(VARIANT::cmos);
+                CPU6502_NEXT();
             }
 
-            case 0x44: { // two-byte NOP, 3 cycles
-                [[maybe_unused]] uint8_t ignored = read_pc_inc();
-                break;
+            CPU6502_OP(0xCB) { // WAI, WDC 65C02; one-byte NOP on other 65C02s
+                CPU6502_REQUIRE(VARIANT::cmos);
+                if constexpr (VARIANT::wait_stop) {
+                    add_cycles(2);
+                    halt = WAITING;
+                    retire_instruction();
+                    instruction_done();
+                    pass_halted_cycles(cycle_end);
+                    CPU6502_NEXT_RETIRED();
+                }
+                CPU6502_NEXT();
+            }
+
+            CPU6502_OP(0xDB) { // STP, WDC 65C02; one-byte NOP on other 65C02s
+                CPU6502_REQUIRE(VARIANT::cmos);
+                if constexpr (VARIANT::wait_stop) {
+                    add_cycles(2);
+                    halt = STOPPED;
+                    retire_instruction();
+                    instruction_done();
+                    pass_halted_cycles(cycle_end);
+                    CPU6502_NEXT_RETIRED();
+                }
+                CPU6502_NEXT();
             }
 
-            case 0x54: case 0xD4: case 0xF4: { // two-byte NOP, 4 cycles
-                [[maybe_unused]] uint8_t ignored = read_pc_inc();
-                break;
+            CPU6502_OP(0x44) { // two-byte NOP, 3 cycles
+                CPU6502_REQUIRE(VARIANT::cmos);
+                idle_read(zeropage());
+                CPU6502_NEXT();
             }
 
-            case 0x5C: { // three-byte NOP, 8 cycles
-                [[maybe_unused]] uint8_t ignored1 = read_pc_inc();
-                [[maybe_unused]] uint8_t ignored2 = read_pc_inc();
-                break;
+            CPU6502_OP(0x54) CPU6502_OP(0xD4) CPU6502_OP(0xF4) { // two-byte NOP, 4 cycles
+                CPU6502_REQUIRE(VARIANT::cmos);
+                idle_read(zeropage_indexed_X());
+                CPU6502_NEXT();
             }
 
-            case 0xDC: case 0xFC: { // three-byte NOP, 4 cycles
-                [[maybe_unused]] uint8_t ignored1 = read_pc_inc();
-                [[maybe_unused]] uint8_t ignored2 = read_pc_inc();
-                break;
+            CPU6502_OP(0x5C) { // three-byte NOP, 8 cycles
+                CPU6502_REQUIRE(VARIANT::cmos);
+                uint16_t addr = absolute();
+                for(int i = 0; i < 5; i++) {
+                    idle_read(addr); // the part's addresses for these aren't modelled
+                }
+                CPU6502_NEXT();
+            }
+
+            CPU6502_OP(0xDC) CPU6502_OP(0xFC) { // three-byte NOP, 4 cycles
+                CPU6502_REQUIRE(VARIANT::cmos);
+                idle_read(absolute());
+                CPU6502_NEXT();
             }
 
-            case 0x7C: { // JMP (abs, X), 65C02 instruction
+            CPU6502_OP(0x7C) { // JMP (abs, X), 65C02 instruction
+                CPU6502_REQUIRE(VARIANT::cmos);
                 uint16_t addr = absolute_indexed_indirect();
                 pc = addr;
-                break;
+                if(hooked[pc]) [[unlikely]] {
+                    enter_hook();
+                    CPU6502_MODE_CHANGED();
+                }
+                CPU6502_NEXT();
             }
 
-            case 0x89: { // BIT imm
-                m = read_pc_inc();
-                flag_change(Z, (a & m) == 0);
-                break;
+            CPU6502_OP(0x89) { // BIT imm
+                CPU6502_REQUIRE(VARIANT::cmos);
+                read_instruction<IMMEDIATE, BIT>();
+                CPU6502_NEXT();
             }
 
-            case 0x9E: { // STZ abs, X
-                uint16_t addr = absolute_indexed_X(false);
-                write(addr, 0);
-                break;
+            CPU6502_OP(0x9E) { // STZ abs, X
+                CPU6502_REQUIRE(VARIANT::cmos);
+                write_instruction<ABSOLUTE_X_W, STZ>();
+                CPU6502_NEXT();
             }
 
-#if EMULATE_WDC_65C02
 
-            case 0x0F: case 0x1F: case 0x2F: case 0x3F:
-            case 0x4F: case 0x5F: case 0x6F: case 0x7F: { // BBRn zpg, rel, 65C02
+            CPU6502_OP(0x0F) CPU6502_OP(0x1F) CPU6502_OP(0x2F) CPU6502_OP(0x3F)
+            CPU6502_OP(0x4F) CPU6502_OP(0x5F) CPU6502_OP(0x6F) CPU6502_OP(0x7F) { // BBRn zpg, rel, 65C02
+                CPU6502_REQUIRE(VARIANT::bit_instructions);
                 int whichbit = (inst >> 4) & 0x7;
                 uint8_t zpg = zeropage();
                 uint8_t m = read(zpg);
-                int32_t rel = ((read_pc_inc() + 128)) & 0xFF - 128;
-                if(!(m & (1 << whichbit))) {
-                    // if((pc + rel) / 256 != pc / 256)
-                        // clk.add_cpu_cycles(1); // XXX ???
-                    pc += rel;
-                }
-                break;
+                idle_read(zpg);
+                bit_branch(!(m & (1 << whichbit)));
+                CPU6502_NEXT();
             }
             
-            case 0x8F: case 0x9F: case 0xAF: case 0xBF:
-            case 0xCF: case 0xDF: case 0xEF: case 0xFF: { // BBSn zpg, rel, WDC 65C02
+            CPU6502_OP(0x8F) CPU6502_OP(0x9F) CPU6502_OP(0xAF) CPU6502_OP(0xBF)
+            CPU6502_OP(0xCF) CPU6502_OP(0xDF) CPU6502_OP(0xEF) CPU6502_OP(0xFF) { // BBSn zpg, rel, WDC 65C02
+                CPU6502_REQUIRE(VARIANT::bit_instructions);
                 int whichbit = (inst >> 4) & 0x7;
                 uint8_t zpg = zeropage();
                 uint8_t m = read(zpg);
-                int32_t rel = ((read_pc_inc() + 128)) & 0xFF - 128;
-                if(m & (1 << whichbit)) {
-                    // if((pc + rel) / 256 != pc / 256)
-                        // clk.add_cpu_cycles(1); // XXX ???
-                    pc += rel;
-                }
-                break;
+                idle_read(zpg);
+                bit_branch(m & (1 << whichbit));
+                CPU6502_NEXT();
             }
             
-            case 0x07: case 0x17: case 0x27: case 0x37:
-            case 0x47: case 0x57: case 0x67: case 0x77: { // RMB0 zpg, WDC 65C02 instruction
+            CPU6502_OP(0x07) CPU6502_OP(0x17) CPU6502_OP(0x27) CPU6502_OP(0x37)
+            CPU6502_OP(0x47) CPU6502_OP(0x57) CPU6502_OP(0x67) CPU6502_OP(0x77) { // RMB0 zpg, WDC 65C02 instruction
+                CPU6502_REQUIRE(VARIANT::bit_instructions);
                 int whichbit = (inst >> 4) & 0x7;
                 uint16_t addr = zeropage();
                 m = read(addr);
+                modify_cycle(addr, m);
                 m &= ~(1 << whichbit);
-                clk.add_cpu_cycles(1);
                 write(addr, m);
-                break;
+                CPU6502_NEXT();
             }
 
-            case 0x87: case 0x97: case 0xA7: case 0xB7:
-            case 0xC7: case 0xD7: case 0xE7: case 0xF7: { // RMB0 zpg, WDC 65C02 instruction
+            CPU6502_OP(0x87) CPU6502_OP(0x97) CPU6502_OP(0xA7) CPU6502_OP(0xB7)
+            CPU6502_OP(0xC7) CPU6502_OP(0xD7) CPU6502_OP(0xE7) CPU6502_OP(0xF7) { // RMB0 zpg, WDC 65C02 instruction
+                CPU6502_REQUIRE(VARIANT::bit_instructions);
                 int whichbit = (inst >> 4) & 0x7;
                 uint16_t addr = zeropage();
                 m = read(addr);
+                modify_cycle(addr, m);
                 m |= (1 << whichbit);
-                clk.add_cpu_cycles(1);
                 write(addr, m);
-                break;
+                CPU6502_NEXT();
             }
 
-#endif /* EMULATE_WDC_65C02 */
 
-#else /* ! EMULATE_65C02 */
 
-            case 0x04: { // NOP zpg
-                uint8_t zpgaddr = read_pc_inc();
-                m = read(zpgaddr);
-                break;
+
+#if CPU6502_THREADED_DISPATCH
+
+            // ADC and SBC in decimal mode, dispatched through
+            // dispatch[DECIMAL_MODE] while D is set
+
+            CPU6502_DECIMAL_OP(0x61) { // ADC (ind, X)
+                read_instruction<INDEXED_INDIRECT, DECIMAL_ADC>();
+                CPU6502_NEXT();
+            }
+
+            CPU6502_DECIMAL_OP(0x65) { // ADC zpg
+                read_instruction<ZEROPAGE, DECIMAL_ADC>();
+                CPU6502_NEXT();
+            }
+
+            CPU6502_DECIMAL_OP(0x69) { // ADC imm
+                read_instruction<IMMEDIATE, DECIMAL_ADC>();
+                CPU6502_NEXT();
+            }
+
+            CPU6502_DECIMAL_OP(0x6D) { // ADC abs
+                read_instruction<ABSOLUTE, DECIMAL_ADC>();
+                CPU6502_NEXT();
+            }
+
+            CPU6502_DECIMAL_OP(0x71) { // ADC (ind), Y
+                read_instruction<INDIRECT_INDEXED, DECIMAL_ADC>();
+                CPU6502_NEXT();
+            }
+
+            CPU6502_DECIMAL_OP(0x72) { // ADC (zpg), 65C02
+                read_instruction<ZEROPAGE_INDIRECT, DECIMAL_ADC>();
+                CPU6502_NEXT();
+            }
+
+            CPU6502_DECIMAL_OP(0x75) { // ADC zpg, X
+                read_instruction<ZEROPAGE_X, DECIMAL_ADC>();
+                CPU6502_NEXT();
+            }
+
+            CPU6502_DECIMAL_OP(0x79) { // ADC abs, Y
+                read_instruction<ABSOLUTE_Y, DECIMAL_ADC>();
+                CPU6502_NEXT();
+            }
+
+            CPU6502_DECIMAL_OP(0x7D) { // ADC abs, X
+                read_instruction<ABSOLUTE_X, DECIMAL_ADC>();
+                CPU6502_NEXT();
+            }
+
+            CPU6502_DECIMAL_OP(0xE1) { // SBC (ind, X)
+                read_instruction<INDEXED_INDIRECT, DECIMAL_SBC>();
+                CPU6502_NEXT();
+            }
+
+            CPU6502_DECIMAL_OP(0xE5) { // SBC zpg
+                read_instruction<ZEROPAGE, DECIMAL_SBC>();
+                CPU6502_NEXT();
+            }
+
+            CPU6502_DECIMAL_OP(0xE9) { // SBC imm
+                read_instruction<IMMEDIATE, DECIMAL_SBC>();
+                CPU6502_NEXT();
+            }
+
+            CPU6502_DECIMAL_OP(0xED) { // SBC abs
+                read_instruction<ABSOLUTE, DECIMAL_SBC>();
+                CPU6502_NEXT();
+            }
+
+            CPU6502_DECIMAL_OP(0xF1) { // SBC (ind), Y
+                read_instruction<INDIRECT_INDEXED, DECIMAL_SBC>();
+                CPU6502_NEXT();
+            }
+
+            CPU6502_DECIMAL_OP(0xF2) { // SBC (zpg), 65C02
+                read_instruction<ZEROPAGE_INDIRECT, DECIMAL_SBC>();
+                CPU6502_NEXT();
+            }
+
+            CPU6502_DECIMAL_OP(0xF5) { // SBC zpg, X
+                read_instruction<ZEROPAGE_X, DECIMAL_SBC>();
+                CPU6502_NEXT();
+            }
+
+            CPU6502_DECIMAL_OP(0xF9) { // SBC abs, Y
+                read_instruction<ABSOLUTE_Y, DECIMAL_SBC>();
+                CPU6502_NEXT();
+            }
+
+            CPU6502_DECIMAL_OP(0xFD) { // SBC abs, X
+                read_instruction<ABSOLUTE_X, DECIMAL_SBC>();
+                CPU6502_NEXT();
             }
 
-#endif /* EMULATE_65C02 */
+#endif /* CPU6502_THREADED_DISPATCH */
 
+#if ! CPU6502_THREADED_DISPATCH
+            default:
+#endif /* CPU6502_THREADED_DISPATCH */
+            [[maybe_unused]] op_illegal:
+            {
+                pc--;
+                trap_opcode = inst;
+                halt = TRAPPED;
+                retire_instruction();
+                instruction_done();
+                pass_halted_cycles(cycle_end);
+                return;
+            }
+        }
 
-            default: {
-                printf("unhandled instruction %02X at %04X\n", inst, pc - 1);
-                fflush(stdout);
-                exit(1);
+#if ! CPU6502_THREADED_DISPATCH
+            retire_instruction();
+            instruction_done();
+            if(slice_done(cycle_end)) {
+                return;
             }
         }
+#endif /* CPU6502_THREADED_DISPATCH */
+
+#undef CPU6502_OP
+#undef CPU6502_NEXT
+#undef CPU6502_NEXT_RETIRED
+#undef CPU6502_REQUIRE
+#undef CPU6502_MODE_CHANGED
+#if CPU6502_THREADED_DISPATCH
+#undef CPU6502_DECIMAL_OP
+#undef CPU6502_ENTRY
+#undef CPU6502_DISPATCH
+#endif /* CPU6502_THREADED_DISPATCH */
     }
 };
 
-#if 0
-#if ! EMULATE_65C02
-    /*         0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F */
-    /* 0x0- */ 7, 6, 2, 1, 3, 3, 5, 0, 3, 2, 2, 1, 6, 4, 6, 5,
-    /* 0x1- */ 2, 5, 5, 1, 5, 4, 6, 0, 2, 4, 2, 1, 6, 4, 7, 5,
-    /* 0x2- */ 6, 6, 2, 1, 3, 3, 5, 0, 4, 2, 2, 1, 4, 4, 6, 5,
-    /* 0x3- */ 2, 5, 0, 1, 0, 4, 6, 0, 2, 4, 2, 1, 0, 4, 7, 5,
-    /* 0x4- */ 6, 6, 2, 1, 3, 3, 5, 0, 3, 2, 2, 1, 3, 4, 6, 5,
-    /* 0x5- */ 2, 5, 0, 1, 4, 4, 6, 0, 2, 4, 3, 1, 8, 4, 7, 5,
-    /* 0x6- */ 6, 6, 2, 1, 3, 3, 5, 0, 4, 2, 2, 1, 5, 4, 6, 5,
-    /* 0x7- */ 2, 5, 5, 1, 0, 4, 6, 0, 2, 4, 4, 1, 6, 4, 7, 5,
-    /* 0x8- */ 2, 6, 2, 1, 3, 3, 3, 0, 2, 2, 2, 1, 4, 4, 4, 5,
-    /* 0x9- */ 2, 6, 5, 1, 4, 4, 4, 0, 2, 5, 2, 1, 4, 5, 5, 5,
-    /* 0xA- */ 2, 6, 2, 1, 3, 3, 3, 0, 2, 2, 2, 1, 4, 4, 4, 5,
-    /* 0xB- */ 2, 5, 5, 1, 4, 4, 4, 0, 2, 4, 2, 1, 4, 4, 4, 5,
-    /* 0xC- */ 2, 6, 2, 1, 3, 3, 5, 0, 2, 2, 2, 1, 4, 4, 3, 5,
-    /* 0xD- */ 2, 5, 5, 1, 4, 4, 6, 0, 2, 4, 3, 1, 4, 4, 7, 5,
-    /* 0xE- */ 2, 6, 2, 1, 3, 3, 5, 0, 2, 2, 2, 2, 4, 4, 6, 5,
-    /* 0xF- */ 2, 5, 0, 1, 4, 4, 6, 0, 2, 4, 4, 1, 4, 4, 7, 5,
-#else /* EMULATE_65C02 */
-    /*         0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F  */
-    /* 0x0- */ 7, 6, 2, 1, 5, 3, 5, 0, 3, 2, 2, 1, 6, 4, 6, 5,
-    /* 0x1- */ 2, 5, 5, 1, 5, 4, 6, 0, 2, 4, 2, 1, 6, 4, 6, 5,
-    /* 0x2- */ 6, 6, 2, 1, 3, 3, 5, 0, 4, 2, 2, 1, 4, 4, 6, 5,
-    /* 0x3- */ 2, 5, 0, 1, 4, 4, 6, 0, 2, 4, 2, 1, 0, 4, 6, 5,
-    /* 0x4- */ 6, 6, 2, 1, 3, 3, 5, 0, 3, 2, 2, 1, 3, 4, 6, 5,
-    /* 0x5- */ 2, 5, 0, 1, 4, 4, 6, 0, 2, 4, 3, 1, 8, 4, 6, 5,
-    /* 0x6- */ 6, 6, 2, 1, 3, 3, 5, 0, 4, 2, 2, 1, 5, 4, 6, 5,
-    /* 0x7- */ 2, 5, 5, 1, 4, 4, 6, 0, 2, 4, 4, 1, 6, 4, 6, 5,
-    /* 0x8- */ 2, 6, 2, 1, 3, 3, 3, 0, 2, 2, 2, 1, 4, 4, 4, 5,
-    /* 0x9- */ 2, 6, 5, 1, 4, 4, 4, 0, 2, 5, 2, 1, 4, 5, 6, 5,
-    /* 0xA- */ 2, 6, 2, 1, 3, 3, 3, 0, 2, 2, 2, 1, 4, 4, 4, 5,
-    /* 0xB- */ 2, 5, 5, 1, 4, 4, 4, 0, 2, 4, 2, 1, 4, 4, 4, 5,
-    /* 0xC- */ 2, 6, 2, 1, 3, 3, 5, 0, 2, 2, 2, 1, 4, 4, 3, 5,
-    /* 0xD- */ 2, 5, 5, 1, 4, 4, 6, 0, 2, 4, 3, 1, 4, 4, 7, 5,
-    /* 0xE- */ 2, 6, 2, 1, 3, 3, 5, 0, 2, 2, 2, 2, 4, 4, 6, 5,
-    /* 0xF- */ 2, 5, 0, 1, 4, 4, 6, 0, 2, 4, 4, 1, 4, 4, 7, 5,
-#endif /* EMULATE_65C02 */
-
-#endif
-
 #endif // CPU6502_H
 
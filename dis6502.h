@@ -1,3 +1,10 @@
 #include <string>
+#include <tuple>
+#include "ops6502.h"
 
+// Disassemble the instruction in buffer, which must hold its length in
+// bytes (at most 3), as if at address; returns the length and text.
+// Opcodes are looked up in opcodes, by default those of
+// CPU6502DefaultVariant.
 std::tuple<int, std::string> disassemble_6502(int address, const unsigned char* buffer);
+std::tuple<int, std::string> disassemble_6502(int address, const unsigned char* buffer, const CPU6502Opcode* opcodes);
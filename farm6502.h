@@ -0,0 +1,201 @@
+/*
+    Template parameters:
+        CPU6502Farm<MACHINE>
+        MACHINE is any class with a public member cpu that is a CPU6502,
+            along with whatever clock, bus, and devices it is wired to
+
+    Public methods:
+        add(args...) - construct a MACHINE from args, owned by the farm,
+            and return a reference for setting it up
+        size() - number of machines
+        operator[](i) - the i'th machine added
+        run(limits, slice, threads) - run every machine until it stops,
+            in slices of at most slice cycles, on threads workers (one
+            per core by default); returns one CPU6502FarmResult per
+            machine, in the order they were added
+
+    CPU6502FarmLimits says when a machine stops:
+        cycles - once cpu.total_cycles reaches this
+        stop_pc - when a slice ends with pc here, if not negative; slices
+            end at arbitrary instructions, so this catches a trap that
+            loops at one address, not an address passed through
+        stop_at_loop - when an instruction jumps or branches to itself,
+            checked by stepping one instruction after each slice
+    A machine also stops when its CPU is STOPPED by STP or TRAPPED by an
+    unhandled opcode, since nothing in the farm will reset it.
+
+    Machines are independent and each runs on one thread at a time, so
+    results don't depend on the number of threads or on scheduling.
+    Every worker keeps a queue of machines and takes them newest first,
+    running each slice after slice until it stops.  A worker whose
+    queue is empty takes the oldest machine from another worker's
+    queue.  Machines never go back on a queue, so once a worker finds
+    every queue empty no more work can appear and it exits instead of
+    waiting; idle workers take no time from the ones still running.
+    The queue locks are only taken once per machine.
+*/
+
+#ifndef FARM6502_H
+#define FARM6502_H
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include "cpu6502.h"
+
+struct CPU6502FarmLimits
+{
+    uint64_t cycles = UINT64_MAX;
+    int stop_pc = -1;
+    bool stop_at_loop = false;
+};
+
+struct CPU6502FarmResult
+{
+    enum Reason {
+        CYCLE_LIMIT,
+        STOP_PC,
+        LOOP,
+        STOPPED, // STP
+        TRAPPED, // unhandled opcode, in opcode
+    } reason = CYCLE_LIMIT;
+    uint64_t cycles = 0;
+    uint16_t pc = 0;
+    uint8_t opcode = 0;
+};
+
+template<class MACHINE>
+struct CPU6502Farm
+{
+    std::vector<std::unique_ptr<MACHINE>> machines;
+
+    template<typename... ARGS>
+    MACHINE& add(ARGS&&... args)
+    {
+        machines.push_back(std::make_unique<MACHINE>(std::forward<ARGS>(args)...));
+        return *machines.back();
+    }
+
+    size_t size() const
+    {
+        return machines.size();
+    }
+
+    MACHINE& operator[](size_t i)
+    {
+        return *machines[i];
+    }
+
+    std::vector<CPU6502FarmResult> run(const CPU6502FarmLimits& limits, uint64_t slice = 100000, unsigned threads = 0)
+    {
+        if(threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        threads = unsigned(std::min<size_t>(threads, std::max<size_t>(machines.size(), 1)));
+
+        std::vector<CPU6502FarmResult> results(machines.size());
+        std::unique_ptr<Worker[]> workers(new Worker[threads]);
+        for(size_t i = 0; i < machines.size(); i++) {
+            workers[i % threads].queue.push_back(i);
+        }
+
+        auto work = [&](unsigned self) {
+            size_t i;
+            while(workers[self].pop_newest(i) || steal(workers.get(), threads, self, i)) {
+                while(!run_slice(*machines[i], limits, slice, results[i])) {
+                }
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for(unsigned t = 1; t < threads; t++) {
+            pool.emplace_back(work, t);
+        }
+        work(0);
+        for(auto& thread: pool) {
+            thread.join();
+        }
+
+        return results;
+    }
+
+    // Own cache line each, so queue operations on one worker don't slow
+    // the others
+    struct alignas(64) Worker
+    {
+        std::mutex lock;
+        std::deque<size_t> queue;
+
+        bool pop_newest(size_t& i)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if(queue.empty()) {
+                return false;
+            }
+            i = queue.back();
+            queue.pop_back();
+            return true;
+        }
+
+        bool pop_oldest(size_t& i)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if(queue.empty()) {
+                return false;
+            }
+            i = queue.front();
+            queue.pop_front();
+            return true;
+        }
+    };
+
+    static bool steal(Worker* workers, unsigned threads, unsigned self, size_t& i)
+    {
+        for(unsigned t = 1; t < threads; t++) {
+            if(workers[(self + t) % threads].pop_oldest(i)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Run one slice of machine and fill in result; true if it stopped
+    static bool run_slice(MACHINE& machine, const CPU6502FarmLimits& limits, uint64_t slice, CPU6502FarmResult& result)
+    {
+        auto& cpu = machine.cpu;
+        typedef std::remove_reference_t<decltype(cpu)> CPU;
+
+        if(cpu.total_cycles < limits.cycles) {
+            cpu.run(std::min(slice, limits.cycles - cpu.total_cycles));
+        }
+
+        bool stopped = true;
+        if(cpu.halt == CPU::TRAPPED) {
+            result.reason = CPU6502FarmResult::TRAPPED;
+            result.opcode = cpu.trap_opcode;
+        } else if(cpu.halt == CPU::STOPPED) {
+            result.reason = CPU6502FarmResult::STOPPED;
+        } else if(cpu.pc == limits.stop_pc) {
+            result.reason = CPU6502FarmResult::STOP_PC;
+        } else if(cpu.total_cycles >= limits.cycles) {
+            result.reason = CPU6502FarmResult::CYCLE_LIMIT;
+        } else if(limits.stop_at_loop && (cpu.halt == CPU::RUNNING)) {
+            uint16_t pc = cpu.pc;
+            cpu.cycle();
+            stopped = (cpu.pc == pc) && (cpu.halt == CPU::RUNNING);
+            result.reason = CPU6502FarmResult::LOOP;
+        } else {
+            stopped = false;
+        }
+
+        result.cycles = cpu.total_cycles;
+        result.pc = cpu.pc;
+        return stopped;
+    }
+};
+
+#endif /* FARM6502_H */
@@ -0,0 +1,1275 @@
+/*
+    Template parameters:
+        JIT6502<CLK, BUS, VARIANT>
+        CLK, BUS and VARIANT are as for CPU6502
+
+    Public methods:
+        JIT6502(CLK& clk, BUS& bus); - construct using clk and bus
+        cycle(), run(budget), run_until(c) - as in CPU6502
+        map_ram(page, memory) - let translated code read and write the
+            256 bytes at memory directly for page instead of calling bus;
+            memory must be what bus reads and writes for that page
+        set_translatable(page, flag) - allow (default) or forbid
+            translating code on page; forbid it for hardware I/O pages
+        invalidate_code(page) - drop translations after changing memory
+            without going through the CPU
+
+    Member cpu is the CPU6502 interpreter that holds the register state
+    and runs everything not translated: interrupts, opcodes outside the
+    translated set, decimal-mode ADC and SBC, code on untranslatable
+    pages, and slice tails too short for a whole block.  Where there's no
+    translation it runs to the next instruction that may change pc or
+    leave the page rather than one instruction at a time.
+
+    Translated blocks are x86-64 code with A, X, Y and S in host registers.
+    Every instruction costs the same number of cycles as in the
+    interpreter, including page crossing and branch penalties, and a
+    block only starts if it ends before the slice does, so run() stops
+    at the same instruction boundaries as CPU6502::run().  Cycles up to
+    each call out to bus are reported to clk before it, and passed to a
+    BUS that takes them, at the same cycle as in CPU6502, and the rest
+    when translated code exits.  Blocks jump directly to each other once both have run.
+
+    A write to a page holding translated code drops that page's
+    translations; a page rewritten more than max_rewrites times is left
+    to the interpreter from then on.
+
+    On hosts other than x86-64 Unix JIT6502 only interprets.
+*/
+
+#ifndef JIT6502_H
+#define JIT6502_H
+
+#include <stddef.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include <memory>
+#include "cpu6502.h"
+
+#ifndef JIT6502_AVAILABLE
+#if defined(__x86_64__) && defined(__unix__)
+#define JIT6502_AVAILABLE 1
+#else
+#define JIT6502_AVAILABLE 0
+#endif
+#endif /* JIT6502_AVAILABLE */
+
+#if JIT6502_AVAILABLE
+
+#include <sys/mman.h>
+
+// State shared with translated code, which addresses it through rbx
+struct JIT6502Context
+{
+    uint64_t cycles;
+    uint64_t cycle_end;
+    uintptr_t ram[256];         // page memory less page * 256, or 0 to call bus
+    uint8_t code_page[256];     // nonzero if page has translations
+    void* link;                 // exit stub taken out of translated code, if linkable
+    void* owner;
+    uint8_t a, x, y, s;
+    uint8_t n_result, z_result, c_flag, v_flag, d_flag;
+    uint8_t exit_request;       // leave translated code after this instruction
+    uint8_t scratch;
+    const void* interrupts;     // the interpreter's interrupt input word
+    uint32_t interrupt_mask;    // its accepted_interrupts() on entry
+};
+
+// Just enough of an x86-64 assembler for JIT6502.  Register operands are
+// 32 bits unless noted; memory operands always use a 32-bit displacement.
+struct X64Emitter
+{
+    enum Reg { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+    enum Cond { CC_B = 2, CC_AE = 3, CC_E = 4, CC_NE = 5 };
+    enum Alu { ADD = 0, OR = 1, AND = 4, SUB = 5, XOR = 6, CMP = 7 };
+
+    struct Mem
+    {
+        int base;
+        int index;  // -1 for none
+        int scale;  // log2
+        int32_t disp;
+    };
+
+    uint8_t* p = nullptr;
+
+    void byte(uint8_t b)
+    {
+        *p++ = b;
+    }
+
+    void dword(uint32_t d)
+    {
+        memcpy(p, &d, 4);
+        p += 4;
+    }
+
+    void qword(uint64_t q)
+    {
+        memcpy(p, &q, 8);
+        p += 8;
+    }
+
+    // byte_regs forces a REX prefix so 4-7 name spl, bpl, sil and dil
+    void rex(bool w, int reg, int index, int base, bool byte_regs)
+    {
+        uint8_t r = 0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((index & 8) ? 2 : 0) | ((base & 8) ? 1 : 0);
+        if(r != 0x40 || byte_regs) {
+            byte(r);
+        }
+    }
+
+    void op_mem(bool w, std::initializer_list<uint8_t> opcode, int reg, const Mem& m, bool byte_regs = false)
+    {
+        rex(w, reg, (m.index < 0) ? 0 : m.index, m.base, byte_regs);
+        for(uint8_t b: opcode) {
+            byte(b);
+        }
+        if((m.index < 0) && ((m.base & 7) != RSP)) {
+            byte(0x80 | ((reg & 7) << 3) | (m.base & 7));
+        } else {
+            int index = (m.index < 0) ? RSP : m.index;
+            byte(0x84 | ((reg & 7) << 3));
+            byte((m.scale << 6) | ((index & 7) << 3) | (m.base & 7));
+        }
+        dword(m.disp);
+    }
+
+    void op_reg(bool w, std::initializer_list<uint8_t> opcode, int reg, int rm, bool byte_regs = false)
+    {
+        rex(w, reg, 0, rm, byte_regs);
+        for(uint8_t b: opcode) {
+            byte(b);
+        }
+        byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    void mov(int dst, int src) { op_reg(false, {0x89}, src, dst); }
+    void mov64(int dst, int src) { op_reg(true, {0x89}, src, dst); }
+    void mov_imm(int dst, uint32_t imm) { rex(false, 0, 0, dst, false); byte(0xB8 + (dst & 7)); dword(imm); }
+    void mov_imm64(int dst, uint64_t imm) { rex(true, 0, 0, dst, false); byte(0xB8 + (dst & 7)); qword(imm); }
+    void load8(int dst, const Mem& m) { op_mem(false, {0x0F, 0xB6}, dst, m); }
+    void store8(const Mem& m, int src) { op_mem(false, {0x88}, src, m, true); }
+    void store8_imm(const Mem& m, uint8_t imm) { op_mem(false, {0xC6}, 0, m); byte(imm); }
+    void load32(int dst, const Mem& m) { op_mem(false, {0x8B}, dst, m); }
+    void load64(int dst, const Mem& m) { op_mem(true, {0x8B}, dst, m); }
+    void store64(const Mem& m, int src) { op_mem(true, {0x89}, src, m); }
+    void zext8(int dst, int src) { op_reg(false, {0x0F, 0xB6}, dst, src, true); }
+    void alu(Alu op, int dst, int src) { op_reg(false, {uint8_t(op * 8 + 1)}, src, dst); }
+    void alu_imm(Alu op, int dst, int32_t imm) { op_reg(false, {0x81}, op, dst); dword(imm); }
+    void alu64_imm(Alu op, int dst, int32_t imm) { op_reg(true, {0x81}, op, dst); dword(imm); }
+    void add64_mem(const Mem& m, int src) { op_mem(true, {0x01}, src, m); }
+    void add64_mem_imm(const Mem& m, int32_t imm) { op_mem(true, {0x81}, ADD, m); dword(imm); }
+    void cmp64_mem(int reg, const Mem& m) { op_mem(true, {0x3B}, reg, m); }
+    void cmp8_imm(const Mem& m, uint8_t imm) { op_mem(false, {0x80}, CMP, m); byte(imm); }
+    void test8_imm(const Mem& m, uint8_t imm) { op_mem(false, {0xF6}, 0, m); byte(imm); }
+    void test32_mem(int reg, const Mem& m) { op_mem(false, {0x85}, reg, m); }
+    void test64(int a, int b) { op_reg(true, {0x85}, b, a); }
+    void shl(int r, uint8_t n) { op_reg(false, {0xC1}, 4, r); byte(n); }
+    void shr(int r, uint8_t n) { op_reg(false, {0xC1}, 5, r); byte(n); }
+    void not_(int r) { op_reg(false, {0xF7}, 2, r); }
+    void setcc(Cond cc, int r) { op_reg(false, {0x0F, uint8_t(0x90 + cc)}, 0, r, true); }
+    void call(const void* fn) { mov_imm64(RAX, (uintptr_t)fn); op_reg(false, {0xFF}, 2, RAX); }
+    void jmp_reg(int r) { op_reg(false, {0xFF}, 4, r); }
+    void push(int r) { rex(false, 0, 0, r, false); byte(0x50 + (r & 7)); }
+    void pop(int r) { rex(false, 0, 0, r, false); byte(0x58 + (r & 7)); }
+    void ret() { byte(0xC3); }
+
+    // Jumps return the end of the instruction, for patch()
+    uint8_t* jmp() { byte(0xE9); dword(0); return p; }
+    uint8_t* jcc(Cond cc) { byte(0x0F); byte(0x80 + cc); dword(0); return p; }
+
+    static void patch(uint8_t* after, const uint8_t* target)
+    {
+        int32_t rel = int32_t(target - after);
+        memcpy(after - 4, &rel, 4);
+    }
+
+    void here(uint8_t* after)
+    {
+        patch(after, p);
+    }
+};
+
+#endif /* JIT6502_AVAILABLE */
+
+template<class CLK, class BUS, class VARIANT = CPU6502DefaultVariant>
+struct JIT6502
+{
+    // The interpreter's bus, which drops translations the interpreter
+    // overwrites; the interpreter holds it, which saves a load per access
+    struct InterpreterBus
+    {
+        static constexpr bool cpu_owns_bus = true;
+
+        JIT6502* jit = nullptr;
+
+        uint8_t read(uint16_t addr)
+        {
+            return jit->bus.read(addr);
+        }
+
+        uint8_t read(uint16_t addr, uint64_t cycle)
+        {
+            return jit->bus_read(addr, cycle);
+        }
+
+        void write(uint16_t addr, uint8_t data, uint64_t cycle)
+        {
+            jit->bus_write(addr, data, cycle);
+            jit->note_write(addr);
+        }
+    };
+
+    // Accesses through bus, passing cycle if it takes one
+    uint8_t bus_read(uint16_t addr, uint64_t cycle)
+    {
+        if constexpr (CPU6502TimedBus<BUS>::value) {
+            return bus.read(addr, cycle);
+        } else {
+            return bus.read(addr);
+        }
+    }
+
+    void bus_write(uint16_t addr, uint8_t data, uint64_t cycle)
+    {
+        if constexpr (CPU6502TimedBus<BUS>::value) {
+            bus.write(addr, data, cycle);
+        } else {
+            bus.write(addr, data);
+        }
+    }
+
+    typedef CPU6502<CLK, InterpreterBus, VARIANT> Interpreter;
+
+    BUS &bus;
+    Interpreter cpu;
+
+    void cycle()
+    {
+        run(1);
+    }
+
+    uint64_t run(uint64_t cycle_budget)
+    {
+        uint64_t start = cpu.total_cycles;
+        if(cycle_budget > 0) {
+            execute(start + cycle_budget);
+        }
+        cpu.stop_requested = false;
+        cpu.report_cycles();
+        return cpu.total_cycles - start;
+    }
+
+    uint64_t run_until(uint64_t cycle)
+    {
+        return run((cycle > cpu.total_cycles) ? (cycle - cpu.total_cycles) : 0);
+    }
+
+#if ! JIT6502_AVAILABLE
+
+    JIT6502(CLK& clk, BUS& bus_) :
+        bus(bus_),
+        cpu(clk)
+    {
+        cpu.bus.jit = this;
+    }
+
+    void map_ram(uint8_t, uint8_t*) {}
+    void set_translatable(uint8_t, bool) {}
+    void invalidate_code(uint8_t) {}
+    void note_write(uint16_t) {}
+
+    void execute(uint64_t cycle_end)
+    {
+        cpu.execute(cycle_end);
+    }
+
+#else /* JIT6502_AVAILABLE */
+
+    static constexpr int max_block_length = 32;
+    static constexpr int max_rewrites = 8;
+    static constexpr size_t max_dead_blocks = 4096;
+    static constexpr size_t code_size = 8 << 20;
+    static constexpr size_t max_instruction_code = 1024; // generous bound on one instruction's code
+
+    typedef X64Emitter E;
+    typedef X64Emitter::Mem Mem;
+
+    // Guest state in host registers; rbp holds the effective address
+    // and is preserved across calls to the bus helpers
+    static constexpr int REG_A = E::R12;
+    static constexpr int REG_X = E::R13;
+    static constexpr int REG_Y = E::R14;
+    static constexpr int REG_S = E::R15;
+    static constexpr int REG_EA = E::RBP;
+
+    enum Op {
+        NONE,
+        LDA, LDX, LDY, STA, STX, STY,
+        ORA, AND, EOR, ADC, SBC, CMP, CPX, CPY, BIT,
+        ASL, LSR, ROL, ROR, INC, DEC,
+        TAX, TXA, TAY, TYA, TSX, TXS, INX, INY, DEX, DEY,
+        CLC, SEC, CLV, NOP, PHA, PLA,
+        BPL, BMI, BVC, BVS, BCC, BCS, BNE, BEQ,
+        JMP, JSR, RTS,
+    };
+
+    enum Mode { IMP, ACC, IMM, ZPG, ZPX, ZPY, ABS, ABX, ABY, IZX, IZY, REL };
+
+    struct Decoded
+    {
+        Op op = NONE;
+        Mode mode = IMP;
+        uint8_t inst = 0;
+    };
+
+    struct Block;
+
+    // A patchable exit stub: "mov eax, target" becomes "jmp target_block"
+    struct Link
+    {
+        Block* from;
+        uint8_t* stub;
+        uint16_t target;
+        Block* to = nullptr;
+    };
+
+    struct Block
+    {
+        uint16_t start;
+        bool valid = true;
+        uint8_t* entry = nullptr; // null if nothing at start can be translated
+        uint32_t interpreted_cycles = ~0u; // how far to interpret from start if entry doesn't run
+        std::vector<std::unique_ptr<Link>> exits;
+        std::vector<Link*> incoming;
+    };
+
+    typedef uint32_t (*EnterFunction)(JIT6502Context* context, const uint8_t* entry);
+
+    JIT6502Context context {};
+    X64Emitter emitter;
+    uint8_t* code = nullptr;
+    uint8_t* code_start = nullptr; // first byte after the enter and exit code
+    EnterFunction enter = nullptr;
+    uint8_t* epilogue = nullptr;
+
+    std::vector<std::unique_ptr<Block>> blocks;
+    std::vector<Block*> block_at;
+    std::vector<Block*> page_blocks[256];
+    bool translatable[256];
+    int rewrites[256] {};
+    size_t dead_blocks = 0;
+    uint64_t generation = 0; // incremented by flush()
+
+    JIT6502(CLK& clk, BUS& bus_) :
+        bus(bus_),
+        cpu(clk),
+        block_at(65536)
+    {
+        cpu.bus.jit = this;
+        std::fill(translatable, translatable + 256, true);
+        context.owner = this;
+        void* memory = mmap(nullptr, code_size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(memory != MAP_FAILED) {
+            code = static_cast<uint8_t*>(memory);
+            emit_enter_and_exit();
+        }
+    }
+
+    ~JIT6502()
+    {
+        if(code) {
+            munmap(code, code_size);
+        }
+    }
+
+    JIT6502(const JIT6502&) = delete;
+    JIT6502& operator=(const JIT6502&) = delete;
+
+    void map_ram(uint8_t page, uint8_t* memory)
+    {
+        context.ram[page] = memory ? (uintptr_t(memory) - page * 256) : 0;
+        drop_page(page);
+    }
+
+    void set_translatable(uint8_t page, bool flag)
+    {
+        translatable[page] = flag;
+        drop_page(page);
+    }
+
+    void invalidate_code(uint8_t page)
+    {
+        drop_page(page);
+    }
+
+    void note_write(uint16_t address)
+    {
+        uint8_t page = address >> 8;
+        if(context.code_page[page]) {
+            drop_page(page);
+            if(++rewrites[page] > max_rewrites) {
+                translatable[page] = false;
+            }
+        }
+    }
+
+    void execute(uint64_t cycle_end)
+    {
+        do {
+            if(cpu.halted()) {
+                cpu.pass_halted_cycles(cycle_end);
+            } else if(cpu.interrupt_pending()) {
+                cpu.execute(cpu.total_cycles + 1);
+            } else {
+                Block* block = find_block(cpu.pc);
+                if(!run_translated(block, cycle_end)) {
+                    cpu.execute(std::min<uint64_t>(cycle_end, cpu.total_cycles + block->interpreted_cycles));
+                }
+            }
+        } while(!cpu.slice_done(cycle_end));
+    }
+
+    // Run translated code from block, which starts at cpu.pc; false if
+    // none ran
+    bool run_translated(Block* block, uint64_t cycle_end)
+    {
+        if(!block->entry) {
+            return false;
+        }
+
+        uint64_t start = cpu.total_cycles;
+        context.cycles = start;
+        context.cycle_end = cycle_end;
+        context.a = cpu.a;
+        context.x = cpu.x;
+        context.y = cpu.y;
+        context.s = cpu.s;
+        context.n_result = cpu.n_result;
+        context.z_result = cpu.z_result;
+        context.c_flag = cpu.c_flag;
+        context.v_flag = cpu.v_flag;
+        context.d_flag = cpu.d_flag;
+        context.exit_request = 0;
+        context.interrupts = &cpu.interrupts;
+        context.interrupt_mask = cpu.accepted_interrupts();
+
+        uint16_t pc = enter(&context, block->entry);
+
+        cpu.pc = pc;
+        cpu.a = context.a;
+        cpu.x = context.x;
+        cpu.y = context.y;
+        cpu.s = context.s;
+        cpu.n_result = context.n_result;
+        cpu.z_result = context.z_result;
+        cpu.c_flag = context.c_flag;
+        cpu.v_flag = context.v_flag;
+        cpu.total_cycles = context.cycles;
+        sync_clock();
+
+        if(context.link && !cpu.slice_done(cycle_end)) {
+            link_exit(static_cast<Link*>(context.link), pc);
+        }
+        return cpu.total_cycles != start;
+    }
+
+    void sync_clock()
+    {
+        if constexpr (Interpreter::clock_reporting != CPU6502ClockReporting::PER_SLICE) {
+            cpu.report_cycles();
+        }
+    }
+
+    // Translated code counts an instruction's cycles before running it,
+    // so after is how many of them come after the access
+    static uint32_t read_helper(JIT6502Context* context, uint32_t address, uint32_t after)
+    {
+        JIT6502* jit = static_cast<JIT6502*>(context->owner);
+        jit->cpu.total_cycles = context->cycles - after;
+        jit->sync_clock();
+        uint8_t data = jit->bus_read(address, jit->cpu.total_cycles);
+        jit->check_exit();
+        return data;
+    }
+
+    static void write_helper(JIT6502Context* context, uint32_t address, uint32_t data, uint32_t after)
+    {
+        JIT6502* jit = static_cast<JIT6502*>(context->owner);
+        jit->cpu.total_cycles = context->cycles - after;
+        jit->sync_clock();
+        if(context->ram[address >> 8]) {
+            reinterpret_cast<uint8_t*>(context->ram[address >> 8])[address] = data;
+        } else {
+            jit->bus_write(address, data, jit->cpu.total_cycles);
+        }
+        jit->note_write(address);
+        jit->check_exit();
+    }
+
+    // Something the interpreter has to handle came up during a bus access
+    void check_exit()
+    {
+        if(cpu.interrupt_pending() || cpu.stop_requested) {
+            context.exit_request = 1;
+        }
+    }
+
+    Block* find_block(uint16_t pc)
+    {
+        Block* block = block_at[pc];
+        if(!block) {
+            if(dead_blocks > max_dead_blocks) {
+                flush();
+            }
+            block = translate(pc);
+        }
+        return block;
+    }
+
+    void link_exit(Link* link, uint16_t pc)
+    {
+        uint64_t before = generation;
+        Block* target = find_block(pc);
+        if((generation != before) || !link->from->valid || link->to || !target->entry) {
+            return;
+        }
+        link->stub[0] = 0xE9;
+        E::patch(link->stub + 5, target->entry);
+        link->to = target;
+        target->incoming.push_back(link);
+    }
+
+    void unlink(Link* link)
+    {
+        uint32_t target = link->target;
+        link->stub[0] = 0xB8;
+        memcpy(link->stub + 1, &target, 4);
+        link->to = nullptr;
+    }
+
+    void drop_page(uint8_t page)
+    {
+        for(Block* block: page_blocks[page]) {
+            if(block->valid) {
+                block->valid = false;
+                if(block_at[block->start] == block) {
+                    block_at[block->start] = nullptr;
+                }
+                for(Link* link: block->incoming) {
+                    unlink(link);
+                }
+                block->incoming.clear();
+                dead_blocks++;
+            }
+        }
+        page_blocks[page].clear();
+        context.code_page[page] = 0;
+        context.exit_request = 1; // translated code on page may be running
+    }
+
+    void flush()
+    {
+        blocks.clear();
+        std::fill(block_at.begin(), block_at.end(), nullptr);
+        for(int page = 0; page < 256; page++) {
+            page_blocks[page].clear();
+            context.code_page[page] = 0;
+        }
+        emitter.p = code_start;
+        dead_blocks = 0;
+        generation++;
+    }
+
+    static Decoded decode(uint8_t inst)
+    {
+        static const struct {
+            uint8_t inst;
+            Op op;
+            Mode mode;
+        } translated[] = {
+            {0xA9, LDA, IMM}, {0xA5, LDA, ZPG}, {0xB5, LDA, ZPX}, {0xAD, LDA, ABS},
+            {0xBD, LDA, ABX}, {0xB9, LDA, ABY}, {0xA1, LDA, IZX}, {0xB1, LDA, IZY},
+            {0xA2, LDX, IMM}, {0xA6, LDX, ZPG}, {0xB6, LDX, ZPY}, {0xAE, LDX, ABS}, {0xBE, LDX, ABY},
+            {0xA0, LDY, IMM}, {0xA4, LDY, ZPG}, {0xB4, LDY, ZPX}, {0xAC, LDY, ABS}, {0xBC, LDY, ABX},
+            {0x85, STA, ZPG}, {0x95, STA, ZPX}, {0x8D, STA, ABS}, {0x9D, STA, ABX},
+            {0x99, STA, ABY}, {0x81, STA, IZX}, {0x91, STA, IZY},
+            {0x86, STX, ZPG}, {0x96, STX, ZPY}, {0x8E, STX, ABS},
+            {0x84, STY, ZPG}, {0x94, STY, ZPX}, {0x8C, STY, ABS},
+            {0x09, ORA, IMM}, {0x05, ORA, ZPG}, {0x15, ORA, ZPX}, {0x0D, ORA, ABS},
+            {0x1D, ORA, ABX}, {0x19, ORA, ABY}, {0x01, ORA, IZX}, {0x11, ORA, IZY},
+            {0x29, AND, IMM}, {0x25, AND, ZPG}, {0x35, AND, ZPX}, {0x2D, AND, ABS},
+            {0x3D, AND, ABX}, {0x39, AND, ABY}, {0x21, AND, IZX}, {0x31, AND, IZY},
+            {0x49, EOR, IMM}, {0x45, EOR, ZPG}, {0x55, EOR, ZPX}, {0x4D, EOR, ABS},
+            {0x5D, EOR, ABX}, {0x59, EOR, ABY}, {0x41, EOR, IZX}, {0x51, EOR, IZY},
+            {0x69, ADC, IMM}, {0x65, ADC, ZPG}, {0x75, ADC, ZPX}, {0x6D, ADC, ABS},
+            {0x7D, ADC, ABX}, {0x79, ADC, ABY}, {0x61, ADC, IZX}, {0x71, ADC, IZY},
+            {0xE9, SBC, IMM}, {0xE5, SBC, ZPG}, {0xF5, SBC, ZPX}, {0xED, SBC, ABS},
+            {0xFD, SBC, ABX}, {0xF9, SBC, ABY}, {0xE1, SBC, IZX}, {0xF1, SBC, IZY},
+            {0xC9, CMP, IMM}, {0xC5, CMP, ZPG}, {0xD5, CMP, ZPX}, {0xCD, CMP, ABS},
+            {0xDD, CMP, ABX}, {0xD9, CMP, ABY}, {0xC1, CMP, IZX}, {0xD1, CMP, IZY},
+            {0xE0, CPX, IMM}, {0xE4, CPX, ZPG}, {0xEC, CPX, ABS},
+            {0xC0, CPY, IMM}, {0xC4, CPY, ZPG}, {0xCC, CPY, ABS},
+            {0x24, BIT, ZPG}, {0x2C, BIT, ABS},
+            {0x0A, ASL, ACC}, {0x06, ASL, ZPG}, {0x16, ASL, ZPX}, {0x0E, ASL, ABS}, {0x1E, ASL, ABX},
+            {0x4A, LSR, ACC}, {0x46, LSR, ZPG}, {0x56, LSR, ZPX}, {0x4E, LSR, ABS}, {0x5E, LSR, ABX},
+            {0x2A, ROL, ACC}, {0x26, ROL, ZPG}, {0x36, ROL, ZPX}, {0x2E, ROL, ABS}, {0x3E, ROL, ABX},
+            {0x6A, ROR, ACC}, {0x66, ROR, ZPG}, {0x76, ROR, ZPX}, {0x6E, ROR, ABS}, {0x7E, ROR, ABX},
+            {0xE6, INC, ZPG}, {0xF6, INC, ZPX}, {0xEE, INC, ABS}, {0xFE, INC, ABX},
+            {0xC6, DEC, ZPG}, {0xD6, DEC, ZPX}, {0xCE, DEC, ABS}, {0xDE, DEC, ABX},
+            {0xAA, TAX, IMP}, {0x8A, TXA, IMP}, {0xA8, TAY, IMP}, {0x98, TYA, IMP},
+            {0xBA, TSX, IMP}, {0x9A, TXS, IMP}, {0xE8, INX, IMP}, {0xC8, INY, IMP},
+            {0xCA, DEX, IMP}, {0x88, DEY, IMP}, {0x18, CLC, IMP}, {0x38, SEC, IMP},
+            {0xB8, CLV, IMP}, {0xEA, NOP, IMP}, {0x48, PHA, IMP}, {0x68, PLA, IMP},
+            {0x10, BPL, REL}, {0x30, BMI, REL}, {0x50, BVC, REL}, {0x70, BVS, REL},
+            {0x90, BCC, REL}, {0xB0, BCS, REL}, {0xD0, BNE, REL}, {0xF0, BEQ, REL},
+            {0x4C, JMP, ABS}, {0x20, JSR, ABS}, {0x60, RTS, IMP},
+        };
+        static const auto table = [] {
+            std::vector<Decoded> table(256);
+            for(const auto& t: translated) {
+                table[t.inst] = {t.op, t.mode, t.inst};
+            }
+            return table;
+        }();
+        return table[inst];
+    }
+
+    static Mem field(size_t offset)
+    {
+        return Mem{E::RBX, -1, 0, int32_t(offset)};
+    }
+
+    static Mem ram_of_page(int page)
+    {
+        return field(offsetof(JIT6502Context, ram) + page * sizeof(uintptr_t));
+    }
+
+    uint8_t fetch(uint16_t address)
+    {
+        uintptr_t ram = context.ram[address >> 8];
+        return ram ? reinterpret_cast<uint8_t*>(ram)[address] : bus.read(address);
+    }
+
+    // Fewest cycles from start through the first instruction that may
+    // change pc or that leaves start's page, so the interpreter hands
+    // back to translated code at or before it.  Nothing is translated on
+    // an untranslatable page, so there the count follows branches not
+    // taken and JMPs that stay on the page; a branch taken elsewhere only
+    // makes the interpreter run on a little, and a later write to the
+    // page only moves where it stops.  Code on an untranslatable page that isn't mapped RAM isn't
+    // read, and gets one instruction.
+    uint32_t interpreted_cycles(uint16_t start)
+    {
+        uint8_t page = start >> 8;
+        bool whole_page = !translatable[page];
+        if(whole_page && !context.ram[page]) {
+            return 1;
+        }
+        uint16_t pc = start;
+        uint32_t cycles = 0;
+        for(int count = 0; count < max_block_length; count++) {
+            uint8_t inst = fetch(pc);
+            const CPU6502Opcode& opcode = cpu6502_opcodes<VARIANT>[inst];
+            bool branch = (opcode.mode == CPU6502Opcode::REL) || (opcode.mode == CPU6502Opcode::ZPR);
+            cycles += opcode.cycles;
+            uint16_t next = pc + opcode.length;
+            if(whole_page && (inst == 0x4C)) {
+                next = fetch(pc + 1) | (fetch(pc + 2) << 8);
+            } else if((opcode.writes & CPU6502Opcode::PC) && !(whole_page && branch)) {
+                break;
+            }
+            if((next >> 8) != page) {
+                break;
+            }
+            pc = next;
+        }
+        return std::max<uint32_t>(cycles, 1);
+    }
+
+    // Stack preserved by enter stays 16-byte aligned for helper calls
+    void emit_enter_and_exit()
+    {
+        X64Emitter& e = emitter;
+        e.p = code;
+        enter = reinterpret_cast<EnterFunction>(e.p);
+        e.push(E::RBX);
+        e.push(E::RBP);
+        e.push(E::R12);
+        e.push(E::R13);
+        e.push(E::R14);
+        e.push(E::R15);
+        e.alu64_imm(E::SUB, E::RSP, 8);
+        e.mov64(E::RBX, E::RDI);
+        e.load8(REG_A, field(offsetof(JIT6502Context, a)));
+        e.load8(REG_X, field(offsetof(JIT6502Context, x)));
+        e.load8(REG_Y, field(offsetof(JIT6502Context, y)));
+        e.load8(REG_S, field(offsetof(JIT6502Context, s)));
+        e.jmp_reg(E::RSI);
+
+        // Exits arrive with the next pc in eax and a Link* or 0 in rdx
+        epilogue = e.p;
+        e.store8(field(offsetof(JIT6502Context, a)), REG_A);
+        e.store8(field(offsetof(JIT6502Context, x)), REG_X);
+        e.store8(field(offsetof(JIT6502Context, y)), REG_Y);
+        e.store8(field(offsetof(JIT6502Context, s)), REG_S);
+        e.store64(field(offsetof(JIT6502Context, link)), E::RDX);
+        e.alu64_imm(E::ADD, E::RSP, 8);
+        e.pop(E::R15);
+        e.pop(E::R14);
+        e.pop(E::R13);
+        e.pop(E::R12);
+        e.pop(E::RBP);
+        e.pop(E::RBX);
+        e.ret();
+        code_start = e.p;
+    }
+
+    void emit_exit(uint16_t pc)
+    {
+        emitter.mov_imm(E::RAX, pc);
+        emitter.alu(E::XOR, E::RDX, E::RDX);
+        E::patch(emitter.jmp(), epilogue);
+    }
+
+    void emit_linked_exit(Block* block, uint16_t pc)
+    {
+        block->exits.push_back(std::make_unique<Link>(Link{block, emitter.p, pc}));
+        emitter.mov_imm(E::RAX, pc);
+        emitter.mov_imm64(E::RDX, uintptr_t(block->exits.back().get()));
+        E::patch(emitter.jmp(), epilogue);
+    }
+
+    void emit_set_nz(int reg)
+    {
+        emitter.store8(field(offsetof(JIT6502Context, n_result)), reg);
+        emitter.store8(field(offsetof(JIT6502Context, z_result)), reg);
+    }
+
+    void emit_add_cycles(int reg)
+    {
+        emitter.add64_mem(field(offsetof(JIT6502Context, cycles)), reg);
+    }
+
+    // eax = memory[ebp]; page is the address's page if known, and after
+    // the number of the instruction's cycles that follow the access
+    void emit_read(int page, int after)
+    {
+        X64Emitter& e = emitter;
+        if(page >= 0) {
+            e.load64(E::RDX, ram_of_page(page));
+        } else {
+            e.mov(E::RAX, REG_EA);
+            e.shr(E::RAX, 8);
+            e.load64(E::RDX, Mem{E::RBX, E::RAX, 3, int32_t(offsetof(JIT6502Context, ram))});
+        }
+        e.test64(E::RDX, E::RDX);
+        uint8_t* slow = e.jcc(E::CC_E);
+        e.load8(E::RAX, Mem{E::RDX, REG_EA, 0, 0});
+        uint8_t* done = e.jmp();
+        e.here(slow);
+        e.mov64(E::RDI, E::RBX);
+        e.mov(E::RSI, REG_EA);
+        e.mov_imm(E::RDX, after);
+        e.call(reinterpret_cast<const void*>(&read_helper));
+        e.here(done);
+    }
+
+    // memory[ebp] = al; writes to pages with translations go through
+    // write_helper so they are dropped
+    void emit_write(int page, int after)
+    {
+        X64Emitter& e = emitter;
+        if(page >= 0) {
+            e.cmp8_imm(field(offsetof(JIT6502Context, code_page) + page), 0);
+        } else {
+            e.mov(E::RCX, REG_EA);
+            e.shr(E::RCX, 8);
+            e.cmp8_imm(Mem{E::RBX, E::RCX, 0, int32_t(offsetof(JIT6502Context, code_page))}, 0);
+        }
+        uint8_t* slow = e.jcc(E::CC_NE);
+        if(page >= 0) {
+            e.load64(E::RDX, ram_of_page(page));
+        } else {
+            e.load64(E::RDX, Mem{E::RBX, E::RCX, 3, int32_t(offsetof(JIT6502Context, ram))});
+        }
+        e.test64(E::RDX, E::RDX);
+        uint8_t* slow2 = e.jcc(E::CC_E);
+        e.store8(Mem{E::RDX, REG_EA, 0, 0}, E::RAX);
+        uint8_t* done = e.jmp();
+        e.here(slow);
+        e.here(slow2);
+        e.mov64(E::RDI, E::RBX);
+        e.mov(E::RSI, REG_EA);
+        e.mov(E::RDX, E::RAX);
+        e.mov_imm(E::RCX, after);
+        e.call(reinterpret_cast<const void*>(&write_helper));
+        e.here(done);
+    }
+
+    void emit_push(int after)
+    {
+        emitter.mov(REG_EA, REG_S);
+        emitter.alu_imm(E::ADD, REG_EA, 0x100);
+        emit_write(1, after);
+        emitter.alu_imm(E::SUB, REG_S, 1);
+        emitter.alu_imm(E::AND, REG_S, 0xFF);
+    }
+
+    void emit_pull(int after)
+    {
+        emitter.alu_imm(E::ADD, REG_S, 1);
+        emitter.alu_imm(E::AND, REG_S, 0xFF);
+        emitter.mov(REG_EA, REG_S);
+        emitter.alu_imm(E::ADD, REG_EA, 0x100);
+        emit_read(1, after);
+    }
+
+    // eax = the 16-bit pointer at zero page address ebp, with after
+    // cycles following the read of its high byte
+    void emit_read_pointer(int after)
+    {
+        X64Emitter& e = emitter;
+        emit_read(0, after + 1);
+        e.store8(field(offsetof(JIT6502Context, scratch)), E::RAX);
+        e.alu_imm(E::ADD, REG_EA, 1);
+        e.alu_imm(E::AND, REG_EA, 0xFF);
+        emit_read(0, after);
+        e.shl(E::RAX, 8);
+        e.load8(E::RCX, field(offsetof(JIT6502Context, scratch)));
+        e.alu(E::OR, E::RAX, E::RCX);
+    }
+
+    // ebp = effective address; returns its page if known
+    int emit_address(Mode mode, uint16_t operand, bool dynamic_penalty)
+    {
+        X64Emitter& e = emitter;
+        switch(mode) {
+            case ZPG:
+            case ABS:
+                e.mov_imm(REG_EA, operand);
+                return operand >> 8;
+            case ZPX:
+            case ZPY:
+                e.mov(REG_EA, (mode == ZPX) ? REG_X : REG_Y);
+                e.alu_imm(E::ADD, REG_EA, operand);
+                e.alu_imm(E::AND, REG_EA, 0xFF);
+                return 0;
+            case ABX:
+            case ABY: {
+                int index = (mode == ABX) ? REG_X : REG_Y;
+                if(dynamic_penalty) {
+                    e.mov(E::RAX, index);
+                    e.alu_imm(E::ADD, E::RAX, operand & 0xFF);
+                    e.shr(E::RAX, 8);
+                    emit_add_cycles(E::RAX);
+                }
+                e.mov(REG_EA, index);
+                e.alu_imm(E::ADD, REG_EA, operand);
+                e.alu_imm(E::AND, REG_EA, 0xFFFF);
+                return -1;
+            }
+            case IZX:
+                e.mov(REG_EA, REG_X);
+                e.alu_imm(E::ADD, REG_EA, operand);
+                e.alu_imm(E::AND, REG_EA, 0xFF);
+                emit_read_pointer(1);
+                e.mov(REG_EA, E::RAX);
+                return -1;
+            case IZY:
+                // Without a dynamic penalty the index cycle is counted
+                e.mov_imm(REG_EA, operand);
+                emit_read_pointer(dynamic_penalty ? 1 : 2);
+                if(dynamic_penalty) {
+                    e.mov(E::RCX, E::RAX);
+                    e.alu_imm(E::AND, E::RCX, 0xFF);
+                    e.alu(E::ADD, E::RCX, REG_Y);
+                    e.shr(E::RCX, 8);
+                    emit_add_cycles(E::RCX);
+                }
+                e.mov(REG_EA, E::RAX);
+                e.alu(E::ADD, REG_EA, REG_Y);
+                e.alu_imm(E::AND, REG_EA, 0xFFFF);
+                return -1;
+            default:
+                return -1;
+        }
+    }
+
+    // a = a + eax + carry, binary
+    void emit_adc()
+    {
+        X64Emitter& e = emitter;
+        e.load8(E::RCX, field(offsetof(JIT6502Context, c_flag)));
+        e.mov(E::RDX, REG_A);
+        e.alu(E::ADD, E::RDX, E::RAX);
+        e.alu(E::ADD, E::RDX, E::RCX);
+        e.mov(E::RCX, E::RDX);
+        e.shr(E::RCX, 8);
+        e.store8(field(offsetof(JIT6502Context, c_flag)), E::RCX);
+        e.mov(E::RCX, REG_A);
+        e.alu(E::XOR, E::RCX, E::RAX);
+        e.not_(E::RCX);
+        e.mov(E::RSI, REG_A);
+        e.alu(E::XOR, E::RSI, E::RDX);
+        e.alu(E::AND, E::RCX, E::RSI);
+        e.shr(E::RCX, 7);
+        e.alu_imm(E::AND, E::RCX, 1);
+        e.store8(field(offsetof(JIT6502Context, v_flag)), E::RCX);
+        e.zext8(REG_A, E::RDX);
+        emit_set_nz(REG_A);
+    }
+
+    void emit_compare(int reg)
+    {
+        X64Emitter& e = emitter;
+        e.mov(E::RCX, reg);
+        e.alu(E::SUB, E::RCX, E::RAX);
+        e.setcc(E::CC_AE, E::RDX);
+        e.store8(field(offsetof(JIT6502Context, c_flag)), E::RDX);
+        emit_set_nz(E::RCX);
+    }
+
+    // ALU operation on eax, which was read from memory or immediate
+    void emit_operate(Op op)
+    {
+        X64Emitter& e = emitter;
+        switch(op) {
+            case LDA: e.mov(REG_A, E::RAX); emit_set_nz(REG_A); break;
+            case LDX: e.mov(REG_X, E::RAX); emit_set_nz(REG_X); break;
+            case LDY: e.mov(REG_Y, E::RAX); emit_set_nz(REG_Y); break;
+            case ORA: e.alu(E::OR, REG_A, E::RAX); emit_set_nz(REG_A); break;
+            case AND: e.alu(E::AND, REG_A, E::RAX); emit_set_nz(REG_A); break;
+            case EOR: e.alu(E::XOR, REG_A, E::RAX); emit_set_nz(REG_A); break;
+            case ADC: emit_adc(); break;
+            case SBC: e.alu_imm(E::XOR, E::RAX, 0xFF); emit_adc(); break;
+            case CMP: emit_compare(REG_A); break;
+            case CPX: emit_compare(REG_X); break;
+            case CPY: emit_compare(REG_Y); break;
+            case BIT:
+                e.mov(E::RCX, REG_A);
+                e.alu(E::AND, E::RCX, E::RAX);
+                e.store8(field(offsetof(JIT6502Context, z_result)), E::RCX);
+                e.store8(field(offsetof(JIT6502Context, n_result)), E::RAX);
+                e.shr(E::RAX, 6);
+                e.alu_imm(E::AND, E::RAX, 1);
+                e.store8(field(offsetof(JIT6502Context, v_flag)), E::RAX);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Read-modify-write operation on eax
+    void emit_modify(Op op)
+    {
+        X64Emitter& e = emitter;
+        Mem c_flag = field(offsetof(JIT6502Context, c_flag));
+        switch(op) {
+            case ASL:
+                e.mov(E::RCX, E::RAX);
+                e.shr(E::RCX, 7);
+                e.store8(c_flag, E::RCX);
+                e.shl(E::RAX, 1);
+                e.alu_imm(E::AND, E::RAX, 0xFF);
+                break;
+            case LSR:
+                e.mov(E::RCX, E::RAX);
+                e.alu_imm(E::AND, E::RCX, 1);
+                e.store8(c_flag, E::RCX);
+                e.shr(E::RAX, 1);
+                break;
+            case ROL:
+                e.load8(E::RDX, c_flag);
+                e.mov(E::RCX, E::RAX);
+                e.shr(E::RCX, 7);
+                e.store8(c_flag, E::RCX);
+                e.shl(E::RAX, 1);
+                e.alu(E::OR, E::RAX, E::RDX);
+                e.alu_imm(E::AND, E::RAX, 0xFF);
+                break;
+            case ROR:
+                e.load8(E::RDX, c_flag);
+                e.shl(E::RDX, 7);
+                e.mov(E::RCX, E::RAX);
+                e.alu_imm(E::AND, E::RCX, 1);
+                e.store8(c_flag, E::RCX);
+                e.shr(E::RAX, 1);
+                e.alu(E::OR, E::RAX, E::RDX);
+                break;
+            case INC:
+                e.alu_imm(E::ADD, E::RAX, 1);
+                e.alu_imm(E::AND, E::RAX, 0xFF);
+                break;
+            case DEC:
+                e.alu_imm(E::SUB, E::RAX, 1);
+                e.alu_imm(E::AND, E::RAX, 0xFF);
+                break;
+            default:
+                break;
+        }
+        emit_set_nz(E::RAX);
+    }
+
+    void emit_step(int reg, E::Alu op)
+    {
+        emitter.alu_imm(op, reg, 1);
+        emitter.alu_imm(E::AND, reg, 0xFF);
+        emit_set_nz(reg);
+    }
+
+    void emit_branch(Block* block, Op op, uint16_t pc, uint8_t operand)
+    {
+        X64Emitter& e = emitter;
+        Mem n_result = field(offsetof(JIT6502Context, n_result));
+        Mem z_result = field(offsetof(JIT6502Context, z_result));
+        Mem c_flag = field(offsetof(JIT6502Context, c_flag));
+        Mem v_flag = field(offsetof(JIT6502Context, v_flag));
+        uint8_t* not_taken = nullptr;
+        switch(op) {
+            case BPL: e.test8_imm(n_result, 0x80); not_taken = e.jcc(E::CC_NE); break;
+            case BMI: e.test8_imm(n_result, 0x80); not_taken = e.jcc(E::CC_E); break;
+            case BVC: e.cmp8_imm(v_flag, 0); not_taken = e.jcc(E::CC_NE); break;
+            case BVS: e.cmp8_imm(v_flag, 0); not_taken = e.jcc(E::CC_E); break;
+            case BCC: e.cmp8_imm(c_flag, 0); not_taken = e.jcc(E::CC_NE); break;
+            case BCS: e.cmp8_imm(c_flag, 0); not_taken = e.jcc(E::CC_E); break;
+            case BNE: e.cmp8_imm(z_result, 0); not_taken = e.jcc(E::CC_E); break;
+            case BEQ: e.cmp8_imm(z_result, 0); not_taken = e.jcc(E::CC_NE); break;
+            default: break;
+        }
+        // Same page test as CPU6502::branch()
+        int next = uint16_t(pc + 2);
+        int rel = (operand + 128) % 256 - 128;
+        int penalty = (((next + rel) ^ next) & 0xFF00) ? 2 : 1;
+        e.add64_mem_imm(field(offsetof(JIT6502Context, cycles)), penalty);
+        emit_linked_exit(block, uint16_t(next + rel));
+        e.here(not_taken);
+        emit_linked_exit(block, next);
+    }
+
+    // Translate the instruction at pc; returns the cycles it can take at
+    // most, or 0 if it isn't translated.  *ends is set if it ends the block.
+    int emit_instruction(Block* block, uint16_t pc, Decoded d, uint16_t operand, bool* ends)
+    {
+        X64Emitter& e = emitter;
+        Op op = d.op;
+        Mode mode = d.mode;
+        const CPU6502Opcode& info = cpu6502_opcodes<VARIANT>[d.inst];
+        uint16_t next = pc + info.length;
+        // Indexed modes where crossing a page costs a cycle only when it
+        // happens; otherwise any extra cycle is part of info.cycles
+        bool dynamic_penalty = (mode != REL) && info.page_penalty;
+        int cycles = info.cycles;
+        bool accesses_memory = (mode != IMP) && (mode != ACC) && (mode != IMM) && (mode != REL);
+
+        if(((op == ADC) || (op == SBC)) && VARIANT::decimal_mode) {
+            // Decimal arithmetic stays in the interpreter
+            e.cmp8_imm(field(offsetof(JIT6502Context, d_flag)), 0);
+            uint8_t* binary = e.jcc(E::CC_E);
+            emit_exit(pc);
+            e.here(binary);
+        }
+
+        e.add64_mem_imm(field(offsetof(JIT6502Context, cycles)), cycles);
+
+        *ends = false;
+        switch(op) {
+            case STA: case STX: case STY: {
+                int page = emit_address(mode, operand, false);
+                e.mov(E::RAX, (op == STA) ? REG_A : (op == STX) ? REG_X : REG_Y);
+                emit_write(page, 0);
+                break;
+            }
+            case ASL: case LSR: case ROL: case ROR: case INC: case DEC:
+                if(mode == ACC) {
+                    e.mov(E::RAX, REG_A);
+                    emit_modify(op);
+                    e.mov(REG_A, E::RAX);
+                } else {
+                    int page = emit_address(mode, operand, dynamic_penalty);
+                    emit_read(page, 2);
+                    emit_modify(op);
+                    emit_write(page, 0);
+                }
+                break;
+            case TAX: e.mov(REG_X, REG_A); emit_set_nz(REG_X); break;
+            case TXA: e.mov(REG_A, REG_X); emit_set_nz(REG_A); break;
+            case TAY: e.mov(REG_Y, REG_A); emit_set_nz(REG_Y); break;
+            case TYA: e.mov(REG_A, REG_Y); emit_set_nz(REG_A); break;
+            case TSX: e.mov(REG_X, REG_S); emit_set_nz(REG_X); break;
+            case TXS: e.mov(REG_S, REG_X); break;
+            case INX: emit_step(REG_X, E::ADD); break;
+            case INY: emit_step(REG_Y, E::ADD); break;
+            case DEX: emit_step(REG_X, E::SUB); break;
+            case DEY: emit_step(REG_Y, E::SUB); break;
+            case CLC: e.store8_imm(field(offsetof(JIT6502Context, c_flag)), 0); break;
+            case SEC: e.store8_imm(field(offsetof(JIT6502Context, c_flag)), 1); break;
+            case CLV: e.store8_imm(field(offsetof(JIT6502Context, v_flag)), 0); break;
+            case NOP: break;
+            case PHA:
+                e.mov(E::RAX, REG_A);
+                emit_push(0);
+                accesses_memory = true;
+                break;
+            case PLA:
+                emit_pull(0);
+                e.mov(REG_A, E::RAX);
+                emit_set_nz(REG_A);
+                accesses_memory = true;
+                break;
+            case BPL: case BMI: case BVC: case BVS: case BCC: case BCS: case BNE: case BEQ:
+                emit_branch(block, op, pc, operand);
+                *ends = true;
+                return cycles + info.branch_penalty + info.page_penalty;
+            case JMP:
+                emit_linked_exit(block, operand);
+                *ends = true;
+                return cycles;
+            case JSR:
+                e.mov_imm(E::RAX, uint16_t(pc + 2) >> 8);
+                emit_push(2);
+                e.mov_imm(E::RAX, uint16_t(pc + 2) & 0xFF);
+                emit_push(1);
+                emit_linked_exit(block, operand);
+                *ends = true;
+                return cycles;
+            case RTS:
+                emit_pull(2);
+                e.store8(field(offsetof(JIT6502Context, scratch)), E::RAX);
+                emit_pull(1);
+                e.shl(E::RAX, 8);
+                e.load8(E::RCX, field(offsetof(JIT6502Context, scratch)));
+                e.alu(E::OR, E::RAX, E::RCX);
+                e.alu_imm(E::ADD, E::RAX, 1);
+                e.alu_imm(E::AND, E::RAX, 0xFFFF);
+                e.alu(E::XOR, E::RDX, E::RDX);
+                E::patch(e.jmp(), epilogue);
+                *ends = true;
+                return cycles;
+            default:
+                if(mode == IMM) {
+                    e.mov_imm(E::RAX, operand);
+                } else {
+                    int page = emit_address(mode, operand, dynamic_penalty);
+                    emit_read(page, 0);
+                }
+                emit_operate(op);
+                break;
+        }
+
+        if(accesses_memory) {
+            // A bus access raised an interrupt, requested a stop, or
+            // overwrote translated code
+            e.cmp8_imm(field(offsetof(JIT6502Context, exit_request)), 0);
+            uint8_t* stay = e.jcc(E::CC_E);
+            emit_exit(next);
+            e.here(stay);
+        }
+        return cycles + (dynamic_penalty ? 1 : 0);
+    }
+
+    Block* translate(uint16_t start)
+    {
+        if(code && (size_t(code + code_size - emitter.p) < max_block_length * max_instruction_code)) {
+            flush();
+        }
+
+        blocks.push_back(std::make_unique<Block>());
+        Block* block = blocks.back().get();
+        block->start = start;
+        block_at[start] = block;
+        page_blocks[start >> 8].push_back(block);
+
+        // Nothing at start is translated, which is remembered until
+        // the page changes
+        if(!code) {
+            return block;
+        }
+        if(!translatable[start >> 8]) {
+            block->interpreted_cycles = interpreted_cycles(start);
+            return block;
+        }
+        context.code_page[start >> 8] = 1;
+
+        X64Emitter& e = emitter;
+        uint8_t* entry = e.p;
+
+        // Run only if the whole block fits in the slice, nothing is
+        // pending from the block that linked here, and no interrupt
+        // has been raised, perhaps by another thread
+        e.load64(E::RAX, field(offsetof(JIT6502Context, cycles)));
+        e.alu64_imm(E::ADD, E::RAX, 0);
+        uint8_t* max_cycles_imm = e.p - 4;
+        e.cmp64_mem(E::RAX, field(offsetof(JIT6502Context, cycle_end)));
+        uint8_t* too_long = e.jcc(E::CC_AE);
+        e.cmp8_imm(field(offsetof(JIT6502Context, exit_request)), 0);
+        uint8_t* pending = e.jcc(E::CC_NE);
+        e.load64(E::RAX, field(offsetof(JIT6502Context, interrupts)));
+        e.load32(E::RAX, Mem{E::RAX, -1, 0, 0});
+        e.test32_mem(E::RAX, field(offsetof(JIT6502Context, interrupt_mask)));
+        uint8_t* interrupted = e.jcc(E::CC_NE);
+
+        uint16_t pc = start;
+        uint8_t last_page = start >> 8; // last page the block is registered on
+        int32_t max_cycles = 0;
+        int count = 0;
+        bool ends = false;
+        while(!ends && (count < max_block_length)) {
+            Decoded d = decode(fetch(pc));
+            if(d.op == NONE) {
+                break;
+            }
+            int length = cpu6502_opcodes<VARIANT>[d.inst].length;
+            bool on_translatable_pages = true;
+            for(int i = 0; i < length; i++) {
+                on_translatable_pages = on_translatable_pages && translatable[uint16_t(pc + i) >> 8];
+            }
+            if(!on_translatable_pages) {
+                break;
+            }
+            uint16_t operand = 0;
+            if(length > 1) {
+                operand = fetch(pc + 1);
+            }
+            if(length > 2) {
+                operand |= fetch(pc + 2) << 8;
+            }
+            // Every byte of the instruction, opcode included, may be on
+            // the next page
+            for(int i = 0; i < length; i++) {
+                uint8_t page = uint16_t(pc + i) >> 8;
+                if(page != last_page) {
+                    page_blocks[page].push_back(block);
+                    context.code_page[page] = 1;
+                    last_page = page;
+                }
+            }
+            max_cycles += emit_instruction(block, pc, d, operand, &ends);
+            pc += length;
+            count++;
+        }
+
+        if(count == 0) {
+            e.p = entry;
+            block->exits.clear();
+            block->interpreted_cycles = interpreted_cycles(start);
+            return block;
+        }
+        if(!ends) {
+            emit_linked_exit(block, pc);
+        }
+        e.here(too_long);
+        e.here(pending);
+        e.here(interrupted);
+        emit_exit(start);
+        memcpy(max_cycles_imm, &max_cycles, 4);
+        block->entry = entry;
+        return block;
+    }
+
+#endif /* JIT6502_AVAILABLE */
+};
+
+#endif /* JIT6502_H */
@@ -0,0 +1,451 @@
+/*
+    CPU variants and what each opcode is on each of them
+
+    Template parameters:
+        cpu6502_opcodes<VARIANT>
+        VARIANT is one of NMOS6502, NES2A03, CMOS65C02, Rockwell65C02,
+            WDC65C02; CPU6502DefaultVariant is chosen by EMULATE_65C02
+            and EMULATE_WDC_65C02
+
+    cpu6502_opcodes<VARIANT>[op] is a constexpr CPU6502Opcode giving:
+        implemented - false if CPU6502 traps the opcode on VARIANT; the
+            rest of the entry is then "???", IMP, 1 byte
+        mnemonic - e.g. "LDA", "BBR3"
+        mode - addressing mode
+        length - bytes in the instruction stream including the opcode
+            (1 for BRK, which skips its signature byte when it returns)
+        cycles - cycles CPU6502 takes when no page is crossed and no
+            branch is taken
+        page_penalty - cycles added when an index crosses a page, or a
+            taken branch lands in another page
+        branch_penalty - cycles added when a conditional branch is taken
+        reads, writes - registers used and changed, as A, X, Y, S and PC
+            bits, including index registers used by the mode and PC for
+            instructions that jump or branch
+        flags_read, flags_written - P flags used and changed, as N, V, D,
+            I, Z and C bits
+
+    Cycles are the ones CPU6502 takes, which are the part's, and
+    test6502 --opcodes checks them against both.  On CMOS variants ADC
+    and SBC take a cycle more in decimal mode, which isn't part of the
+    table.
+*/
+
+#ifndef OPS6502_H
+#define OPS6502_H
+
+#include <stdint.h>
+#include <array>
+
+#ifndef EMULATE_65C02
+
+#define EMULATE_65C02 1
+
+#ifndef EMULATE_WDC_65C02
+#define EMULATE_WDC_65C02 1
+#endif /* EMULATE_WDC_65C02 */
+
+#endif /* EMULATE_65C02 */
+
+// CPU variants, passed as the VARIANT template parameter
+//     cmos - 65C02 instructions, addressing modes, and timing
+//     bit_instructions - RMB, SMB, BBR, BBS
+//     decimal_mode - ADC and SBC honor the D flag
+//     wait_stop - WAI and STP
+
+struct NMOS6502
+{
+    static constexpr bool cmos = false;
+    static constexpr bool bit_instructions = false;
+    static constexpr bool decimal_mode = true;
+    static constexpr bool wait_stop = false;
+};
+
+// Ricoh 2A03/2A07 in the NES; the D flag exists but has no effect
+struct NES2A03 : NMOS6502
+{
+    static constexpr bool decimal_mode = false;
+};
+
+struct CMOS65C02
+{
+    static constexpr bool cmos = true;
+    static constexpr bool bit_instructions = false;
+    static constexpr bool decimal_mode = true;
+    static constexpr bool wait_stop = false;
+};
+
+struct Rockwell65C02 : CMOS65C02
+{
+    static constexpr bool bit_instructions = true;
+};
+
+struct WDC65C02 : Rockwell65C02
+{
+    static constexpr bool wait_stop = true;
+};
+
+// Variant used when none is given, chosen by the EMULATE_ macros
+#if ! EMULATE_65C02
+typedef NMOS6502 CPU6502DefaultVariant;
+#elif ! EMULATE_WDC_65C02
+typedef CMOS65C02 CPU6502DefaultVariant;
+#else
+typedef WDC65C02 CPU6502DefaultVariant;
+#endif
+
+struct CPU6502Opcode
+{
+    enum Mode : uint8_t {
+        IMP,    // implied
+        ACC,    // A
+        IMM,    // #$nn
+        ZPG,    // $nn
+        ZPX,    // $nn,X
+        ZPY,    // $nn,Y
+        ZPI,    // ($nn), 65C02
+        ABS,    // $nnnn
+        ABX,    // $nnnn,X
+        ABY,    // $nnnn,Y
+        IND,    // ($nnnn)
+        AXI,    // ($nnnn,X), 65C02
+        IZX,    // ($nn,X)
+        IZY,    // ($nn),Y
+        REL,    // branch target
+        ZPR,    // $nn, branch target; BBR and BBS
+    };
+
+    // Register bits in reads and writes
+    static constexpr uint8_t A = 0x01;
+    static constexpr uint8_t X = 0x02;
+    static constexpr uint8_t Y = 0x04;
+    static constexpr uint8_t S = 0x08;
+    static constexpr uint8_t PC = 0x10;
+
+    // Flag bits in flags_read and flags_written, as in P
+    static constexpr uint8_t N = 0x80;
+    static constexpr uint8_t V = 0x40;
+    static constexpr uint8_t D = 0x08;
+    static constexpr uint8_t I = 0x04;
+    static constexpr uint8_t Z = 0x02;
+    static constexpr uint8_t C = 0x01;
+    static constexpr uint8_t P = N | V | D | I | Z | C;
+
+    bool implemented = false;
+    const char* mnemonic = "???";
+    Mode mode = IMP;
+    uint8_t length = 1;
+    uint8_t cycles = 0;
+    uint8_t page_penalty = 0;
+    uint8_t branch_penalty = 0;
+    uint8_t reads = 0;
+    uint8_t writes = 0;
+    uint8_t flags_read = 0;
+    uint8_t flags_written = 0;
+
+    static constexpr int mode_length(Mode mode)
+    {
+        switch(mode) {
+            case IMP: case ACC: return 1;
+            case ABS: case ABX: case ABY: case IND: case AXI: case ZPR: return 3;
+            default: return 2;
+        }
+    }
+
+    static constexpr uint8_t mode_reads(Mode mode)
+    {
+        switch(mode) {
+            case ACC: return A;
+            case ZPX: case ABX: case AXI: case IZX: return X;
+            case ZPY: case ABY: case IZY: return Y;
+            case REL: case ZPR: return PC;
+            default: return 0;
+        }
+    }
+
+    struct Row
+    {
+        uint8_t op;
+        const char* mnemonic;
+        Mode mode;
+        uint8_t cycles;
+        uint8_t page_penalty;
+        uint8_t reads;
+        uint8_t writes;
+        uint8_t flags_read;
+        uint8_t flags_written;
+    };
+
+    // Documented NMOS opcodes, and the undocumented NOPs CPU6502 runs
+    static constexpr Row nmos_rows[] = {
+        {0x00, "BRK", IMP, 7, 0, PC | S, PC | S, P, I},
+        {0x01, "ORA", IZX, 6, 0, A, A, 0, N | Z},
+        {0x04, "NOP", ZPG, 3, 0, 0, 0, 0, 0},
+        {0x05, "ORA", ZPG, 3, 0, A, A, 0, N | Z},
+        {0x06, "ASL", ZPG, 5, 0, 0, 0, 0, N | Z | C},
+        {0x08, "PHP", IMP, 3, 0, S, S, P, 0},
+        {0x09, "ORA", IMM, 2, 0, A, A, 0, N | Z},
+        {0x0A, "ASL", ACC, 2, 0, A, A, 0, N | Z | C},
+        {0x0D, "ORA", ABS, 4, 0, A, A, 0, N | Z},
+        {0x0E, "ASL", ABS, 6, 0, 0, 0, 0, N | Z | C},
+        {0x10, "BPL", REL, 2, 1, 0, PC, N, 0},
+        {0x11, "ORA", IZY, 5, 1, A, A, 0, N | Z},
+        {0x15, "ORA", ZPX, 4, 0, A, A, 0, N | Z},
+        {0x16, "ASL", ZPX, 6, 0, 0, 0, 0, N | Z | C},
+        {0x18, "CLC", IMP, 2, 0, 0, 0, 0, C},
+        {0x19, "ORA", ABY, 4, 1, A, A, 0, N | Z},
+        {0x1D, "ORA", ABX, 4, 1, A, A, 0, N | Z},
+        {0x1E, "ASL", ABX, 7, 0, 0, 0, 0, N | Z | C},
+        {0x20, "JSR", ABS, 6, 0, PC | S, PC | S, 0, 0},
+        {0x21, "AND", IZX, 6, 0, A, A, 0, N | Z},
+        {0x24, "BIT", ZPG, 3, 0, A, 0, 0, N | V | Z},
+        {0x25, "AND", ZPG, 3, 0, A, A, 0, N | Z},
+        {0x26, "ROL", ZPG, 5, 0, 0, 0, C, N | Z | C},
+        {0x28, "PLP", IMP, 4, 0, S, S, 0, P},
+        {0x29, "AND", IMM, 2, 0, A, A, 0, N | Z},
+        {0x2A, "ROL", ACC, 2, 0, A, A, C, N | Z | C},
+        {0x2C, "BIT", ABS, 4, 0, A, 0, 0, N | V | Z},
+        {0x2D, "AND", ABS, 4, 0, A, A, 0, N | Z},
+        {0x2E, "ROL", ABS, 6, 0, 0, 0, C, N | Z | C},
+        {0x30, "BMI", REL, 2, 1, 0, PC, N, 0},
+        {0x31, "AND", IZY, 5, 1, A, A, 0, N | Z},
+        {0x34, "NOP", ZPX, 4, 0, 0, 0, 0, 0},
+        {0x35, "AND", ZPX, 4, 0, A, A, 0, N | Z},
+        {0x36, "ROL", ZPX, 6, 0, 0, 0, C, N | Z | C},
+        {0x38, "SEC", IMP, 2, 0, 0, 0, 0, C},
+        {0x39, "AND", ABY, 4, 1, A, A, 0, N | Z},
+        {0x3C, "NOP", ABX, 4, 1, 0, 0, 0, 0},
+        {0x3D, "AND", ABX, 4, 1, A, A, 0, N | Z},
+        {0x3E, "ROL", ABX, 7, 0, 0, 0, C, N | Z | C},
+        {0x40, "RTI", IMP, 6, 0, S, PC | S, 0, P},
+        {0x41, "EOR", IZX, 6, 0, A, A, 0, N | Z},
+        {0x45, "EOR", ZPG, 3, 0, A, A, 0, N | Z},
+        {0x46, "LSR", ZPG, 5, 0, 0, 0, 0, N | Z | C},
+        {0x48, "PHA", IMP, 3, 0, A | S, S, 0, 0},
+        {0x49, "EOR", IMM, 2, 0, A, A, 0, N | Z},
+        {0x4A, "LSR", ACC, 2, 0, A, A, 0, N | Z | C},
+        {0x4C, "JMP", ABS, 3, 0, 0, PC, 0, 0},
+        {0x4D, "EOR", ABS, 4, 0, A, A, 0, N | Z},
+        {0x4E, "LSR", ABS, 6, 0, 0, 0, 0, N | Z | C},
+        {0x50, "BVC", REL, 2, 1, 0, PC, V, 0},
+        {0x51, "EOR", IZY, 5, 1, A, A, 0, N | Z},
+        {0x55, "EOR", ZPX, 4, 0, A, A, 0, N | Z},
+        {0x56, "LSR", ZPX, 6, 0, 0, 0, 0, N | Z | C},
+        {0x58, "CLI", IMP, 2, 0, 0, 0, 0, I},
+        {0x59, "EOR", ABY, 4, 1, A, A, 0, N | Z},
+        {0x5D, "EOR", ABX, 4, 1, A, A, 0, N | Z},
+        {0x5E, "LSR", ABX, 7, 0, 0, 0, 0, N | Z | C},
+        {0x60, "RTS", IMP, 6, 0, S, PC | S, 0, 0},
+        {0x61, "ADC", IZX, 6, 0, A, A, D | C, N | V | Z | C},
+        {0x65, "ADC", ZPG, 3, 0, A, A, D | C, N | V | Z | C},
+        {0x66, "ROR", ZPG, 5, 0, 0, 0, C, N | Z | C},
+        {0x68, "PLA", IMP, 4, 0, S, A | S, 0, N | Z},
+        {0x69, "ADC", IMM, 2, 0, A, A, D | C, N | V | Z | C},
+        {0x6A, "ROR", ACC, 2, 0, A, A, C, N | Z | C},
+        {0x6C, "JMP", IND, 5, 0, 0, PC, 0, 0},
+        {0x6D, "ADC", ABS, 4, 0, A, A, D | C, N | V | Z | C},
+        {0x6E, "ROR", ABS, 6, 0, 0, 0, C, N | Z | C},
+        {0x70, "BVS", REL, 2, 1, 0, PC, V, 0},
+        {0x71, "ADC", IZY, 5, 1, A, A, D | C, N | V | Z | C},
+        {0x75, "ADC", ZPX, 4, 0, A, A, D | C, N | V | Z | C},
+        {0x76, "ROR", ZPX, 6, 0, 0, 0, C, N | Z | C},
+        {0x78, "SEI", IMP, 2, 0, 0, 0, 0, I},
+        {0x79, "ADC", ABY, 4, 1, A, A, D | C, N | V | Z | C},
+        {0x7D, "ADC", ABX, 4, 1, A, A, D | C, N | V | Z | C},
+        {0x7E, "ROR", ABX, 7, 0, 0, 0, C, N | Z | C},
+        {0x81, "STA", IZX, 6, 0, A, 0, 0, 0},
+        {0x84, "STY", ZPG, 3, 0, Y, 0, 0, 0},
+        {0x85, "STA", ZPG, 3, 0, A, 0, 0, 0},
+        {0x86, "STX", ZPG, 3, 0, X, 0, 0, 0},
+        {0x88, "DEY", IMP, 2, 0, Y, Y, 0, N | Z},
+        {0x8A, "TXA", IMP, 2, 0, X, A, 0, N | Z},
+        {0x8C, "STY", ABS, 4, 0, Y, 0, 0, 0},
+        {0x8D, "STA", ABS, 4, 0, A, 0, 0, 0},
+        {0x8E, "STX", ABS, 4, 0, X, 0, 0, 0},
+        {0x90, "BCC", REL, 2, 1, 0, PC, C, 0},
+        {0x91, "STA", IZY, 6, 0, A, 0, 0, 0},
+        {0x94, "STY", ZPX, 4, 0, Y, 0, 0, 0},
+        {0x95, "STA", ZPX, 4, 0, A, 0, 0, 0},
+        {0x96, "STX", ZPY, 4, 0, X, 0, 0, 0},
+        {0x98, "TYA", IMP, 2, 0, Y, A, 0, N | Z},
+        {0x99, "STA", ABY, 5, 0, A, 0, 0, 0},
+        {0x9A, "TXS", IMP, 2, 0, X, S, 0, 0},
+        {0x9D, "STA", ABX, 5, 0, A, 0, 0, 0},
+        {0xA0, "LDY", IMM, 2, 0, 0, Y, 0, N | Z},
+        {0xA1, "LDA", IZX, 6, 0, 0, A, 0, N | Z},
+        {0xA2, "LDX", IMM, 2, 0, 0, X, 0, N | Z},
+        {0xA4, "LDY", ZPG, 3, 0, 0, Y, 0, N | Z},
+        {0xA5, "LDA", ZPG, 3, 0, 0, A, 0, N | Z},
+        {0xA6, "LDX", ZPG, 3, 0, 0, X, 0, N | Z},
+        {0xA8, "TAY", IMP, 2, 0, A, Y, 0, N | Z},
+        {0xA9, "LDA", IMM, 2, 0, 0, A, 0, N | Z},
+        {0xAA, "TAX", IMP, 2, 0, A, X, 0, N | Z},
+        {0xAC, "LDY", ABS, 4, 0, 0, Y, 0, N | Z},
+        {0xAD, "LDA", ABS, 4, 0, 0, A, 0, N | Z},
+        {0xAE, "LDX", ABS, 4, 0, 0, X, 0, N | Z},
+        {0xB0, "BCS", REL, 2, 1, 0, PC, C, 0},
+        {0xB1, "LDA", IZY, 5, 1, 0, A, 0, N | Z},
+        {0xB4, "LDY", ZPX, 4, 0, 0, Y, 0, N | Z},
+        {0xB5, "LDA", ZPX, 4, 0, 0, A, 0, N | Z},
+        {0xB6, "LDX", ZPY, 4, 0, 0, X, 0, N | Z},
+        {0xB8, "CLV", IMP, 2, 0, 0, 0, 0, V},
+        {0xB9, "LDA", ABY, 4, 1, 0, A, 0, N | Z},
+        {0xBA, "TSX", IMP, 2, 0, S, X, 0, N | Z},
+        {0xBC, "LDY", ABX, 4, 1, 0, Y, 0, N | Z},
+        {0xBD, "LDA", ABX, 4, 1, 0, A, 0, N | Z},
+        {0xBE, "LDX", ABY, 4, 1, 0, X, 0, N | Z},
+        {0xC0, "CPY", IMM, 2, 0, Y, 0, 0, N | Z | C},
+        {0xC1, "CMP", IZX, 6, 0, A, 0, 0, N | Z | C},
+        {0xC4, "CPY", ZPG, 3, 0, Y, 0, 0, N | Z | C},
+        {0xC5, "CMP", ZPG, 3, 0, A, 0, 0, N | Z | C},
+        {0xC6, "DEC", ZPG, 5, 0, 0, 0, 0, N | Z},
+        {0xC8, "INY", IMP, 2, 0, Y, Y, 0, N | Z},
+        {0xC9, "CMP", IMM, 2, 0, A, 0, 0, N | Z | C},
+        {0xCA, "DEX", IMP, 2, 0, X, X, 0, N | Z},
+        {0xCC, "CPY", ABS, 4, 0, Y, 0, 0, N | Z | C},
+        {0xCD, "CMP", ABS, 4, 0, A, 0, 0, N | Z | C},
+        {0xCE, "DEC", ABS, 6, 0, 0, 0, 0, N | Z},
+        {0xD0, "BNE", REL, 2, 1, 0, PC, Z, 0},
+        {0xD1, "CMP", IZY, 5, 1, A, 0, 0, N | Z | C},
+        {0xD5, "CMP", ZPX, 4, 0, A, 0, 0, N | Z | C},
+        {0xD6, "DEC", ZPX, 6, 0, 0, 0, 0, N | Z},
+        {0xD8, "CLD", IMP, 2, 0, 0, 0, 0, D},
+        {0xD9, "CMP", ABY, 4, 1, A, 0, 0, N | Z | C},
+        {0xDD, "CMP", ABX, 4, 1, A, 0, 0, N | Z | C},
+        {0xDE, "DEC", ABX, 7, 0, 0, 0, 0, N | Z},
+        {0xE0, "CPX", IMM, 2, 0, X, 0, 0, N | Z | C},
+        {0xE1, "SBC", IZX, 6, 0, A, A, D | C, N | V | Z | C},
+        {0xE4, "CPX", ZPG, 3, 0, X, 0, 0, N | Z | C},
+        {0xE5, "SBC", ZPG, 3, 0, A, A, D | C, N | V | Z | C},
+        {0xE6, "INC", ZPG, 5, 0, 0, 0, 0, N | Z},
+        {0xE8, "INX", IMP, 2, 0, X, X, 0, N | Z},
+        {0xE9, "SBC", IMM, 2, 0, A, A, D | C, N | V | Z | C},
+        {0xEA, "NOP", IMP, 2, 0, 0, 0, 0, 0},
+        {0xEC, "CPX", ABS, 4, 0, X, 0, 0, N | Z | C},
+        {0xED, "SBC", ABS, 4, 0, A, A, D | C, N | V | Z | C},
+        {0xEE, "INC", ABS, 6, 0, 0, 0, 0, N | Z},
+        {0xF0, "BEQ", REL, 2, 1, 0, PC, Z, 0},
+        {0xF1, "SBC", IZY, 5, 1, A, A, D | C, N | V | Z | C},
+        {0xF5, "SBC", ZPX, 4, 0, A, A, D | C, N | V | Z | C},
+        {0xF6, "INC", ZPX, 6, 0, 0, 0, 0, N | Z},
+        {0xF8, "SED", IMP, 2, 0, 0, 0, 0, D},
+        {0xF9, "SBC", ABY, 4, 1, A, A, D | C, N | V | Z | C},
+        {0xFD, "SBC", ABX, 4, 1, A, A, D | C, N | V | Z | C},
+        {0xFE, "INC", ABX, 7, 0, 0, 0, 0, N | Z},
+    };
+
+    // 65C02 additions, and NMOS opcodes that differ on it
+    static constexpr Row cmos_rows[] = {
+        {0x00, "BRK", IMP, 7, 0, PC | S, PC | S, P, D | I},
+        {0x04, "TSB", ZPG, 5, 0, A, 0, 0, Z},
+        {0x0C, "TSB", ABS, 6, 0, A, 0, 0, Z},
+        {0x12, "ORA", ZPI, 5, 0, A, A, 0, N | Z},
+        {0x14, "TRB", ZPG, 5, 0, A, 0, 0, Z},
+        {0x1A, "INC", ACC, 2, 0, A, A, 0, N | Z},
+        {0x1C, "TRB", ABS, 6, 0, A, 0, 0, Z},
+        {0x1E, "ASL", ABX, 6, 1, 0, 0, 0, N | Z | C},
+        {0x32, "AND", ZPI, 5, 0, A, A, 0, N | Z},
+        {0x34, "BIT", ZPX, 4, 0, A, 0, 0, N | V | Z},
+        {0x3A, "DEC", ACC, 2, 0, A, A, 0, N | Z},
+        {0x3C, "BIT", ABX, 4, 1, A, 0, 0, N | V | Z},
+        {0x3E, "ROL", ABX, 6, 1, 0, 0, C, N | Z | C},
+        {0x44, "NOP", ZPG, 3, 0, 0, 0, 0, 0},
+        {0x52, "EOR", ZPI, 5, 0, A, A, 0, N | Z},
+        {0x54, "NOP", ZPX, 4, 0, 0, 0, 0, 0},
+        {0x5A, "PHY", IMP, 3, 0, Y | S, S, 0, 0},
+        {0x5C, "NOP", ABS, 8, 0, 0, 0, 0, 0},
+        {0x5E, "LSR", ABX, 6, 1, 0, 0, 0, N | Z | C},
+        {0x64, "STZ", ZPG, 3, 0, 0, 0, 0, 0},
+        {0x6C, "JMP", IND, 6, 0, 0, PC, 0, 0},
+        {0x72, "ADC", ZPI, 5, 0, A, A, D | C, N | V | Z | C},
+        {0x74, "STZ", ZPX, 4, 0, 0, 0, 0, 0},
+        {0x7A, "PLY", IMP, 4, 0, S, Y | S, 0, N | Z},
+        {0x7C, "JMP", AXI, 6, 0, 0, PC, 0, 0},
+        {0x7E, "ROR", ABX, 6, 1, 0, 0, C, N | Z | C},
+        {0x80, "BRA", REL, 3, 1, 0, PC, 0, 0},
+        {0x89, "BIT", IMM, 2, 0, A, 0, 0, Z},
+        {0x92, "STA", ZPI, 5, 0, A, 0, 0, 0},
+        {0x9C, "STZ", ABS, 4, 0, 0, 0, 0, 0},
+        {0x9E, "STZ", ABX, 5, 0, 0, 0, 0, 0},
+        {0xB2, "LDA", ZPI, 5, 0, 0, A, 0, N | Z},
+        {0xD2, "CMP", ZPI, 5, 0, A, 0, 0, N | Z | C},
+        {0xD4, "NOP", ZPX, 4, 0, 0, 0, 0, 0},
+        {0xDA, "PHX", IMP, 3, 0, X | S, S, 0, 0},
+        {0xDC, "NOP", ABS, 4, 0, 0, 0, 0, 0},
+        {0xF2, "SBC", ZPI, 5, 0, A, A, D | C, N | V | Z | C},
+        {0xF4, "NOP", ZPX, 4, 0, 0, 0, 0, 0},
+        {0xFA, "PLX", IMP, 4, 0, S, X | S, 0, N | Z},
+        {0xFC, "NOP", ABS, 4, 0, 0, 0, 0, 0},
+    };
+
+    static constexpr const char* bit_mnemonics[4][8] = {
+        {"RMB0", "RMB1", "RMB2", "RMB3", "RMB4", "RMB5", "RMB6", "RMB7"},
+        {"SMB0", "SMB1", "SMB2", "SMB3", "SMB4", "SMB5", "SMB6", "SMB7"},
+        {"BBR0", "BBR1", "BBR2", "BBR3", "BBR4", "BBR5", "BBR6", "BBR7"},
+        {"BBS0", "BBS1", "BBS2", "BBS3", "BBS4", "BBS5", "BBS6", "BBS7"},
+    };
+
+    static constexpr CPU6502Opcode from_row(const Row& row)
+    {
+        CPU6502Opcode o;
+        o.implemented = true;
+        o.mnemonic = row.mnemonic;
+        o.mode = row.mode;
+        o.length = mode_length(row.mode);
+        o.cycles = row.cycles;
+        o.page_penalty = row.page_penalty;
+        o.branch_penalty = (((row.mode == REL) && row.flags_read) || (row.mode == ZPR)) ? 1 : 0;
+        o.reads = row.reads | mode_reads(row.mode);
+        o.writes = row.writes;
+        o.flags_read = row.flags_read;
+        o.flags_written = row.flags_written;
+        return o;
+    }
+
+    template<class VARIANT>
+    static constexpr std::array<CPU6502Opcode, 256> table()
+    {
+        std::array<CPU6502Opcode, 256> opcodes{};
+        for(const Row& row: nmos_rows) {
+            opcodes[row.op] = from_row(row);
+        }
+        if constexpr (VARIANT::cmos) {
+            // Unused opcodes in columns 2, 3 and B are NOPs
+            for(int op = 0; op < 256; op++) {
+                if(((op & 0x0F) == 0x02) && !opcodes[op].implemented) {
+                    opcodes[op] = from_row({uint8_t(op), "NOP", IMM, 2, 0, 0, 0, 0, 0});
+                } else if((op & 0x07) == 0x03) {
+                    opcodes[op] = from_row({uint8_t(op), "NOP", IMP, 1, 0, 0, 0, 0, 0});
+                }
+            }
+            for(const Row& row: cmos_rows) {
+                opcodes[row.op] = from_row(row);
+            }
+        }
+        if constexpr (VARIANT::bit_instructions) {
+            for(int bit = 0; bit < 8; bit++) {
+                opcodes[0x07 + bit * 16] = from_row({uint8_t(0x07 + bit * 16), bit_mnemonics[0][bit], ZPG, 5, 0, 0, 0, 0, 0});
+                opcodes[0x87 + bit * 16] = from_row({uint8_t(0x87 + bit * 16), bit_mnemonics[1][bit], ZPG, 5, 0, 0, 0, 0, 0});
+                opcodes[0x0F + bit * 16] = from_row({uint8_t(0x0F + bit * 16), bit_mnemonics[2][bit], ZPR, 5, 1, 0, PC, 0, 0});
+                opcodes[0x8F + bit * 16] = from_row({uint8_t(0x8F + bit * 16), bit_mnemonics[3][bit], ZPR, 5, 1, 0, PC, 0, 0});
+            }
+        }
+        if constexpr (VARIANT::wait_stop) {
+            opcodes[0xCB] = from_row({0xCB, "WAI", IMP, 3, 0, 0, 0, 0, 0});
+            opcodes[0xDB] = from_row({0xDB, "STP", IMP, 3, 0, 0, 0, 0, 0});
+        }
+        if constexpr (!VARIANT::decimal_mode) {
+            for(auto& opcode: opcodes) {
+                if((opcode.flags_read & D) && (opcode.flags_read != P)) {
+                    opcode.flags_read &= ~D;
+                }
+            }
+        }
+        return opcodes;
+    }
+};
+
+template<class VARIANT>
+inline constexpr std::array<CPU6502Opcode, 256> cpu6502_opcodes = CPU6502Opcode::table<VARIANT>();
+
+#endif /* OPS6502_H */
@@ -1,14 +1,21 @@
 #include <vector>
+#include <deque>
 #include <array>
 #include <set>
 #include <map>
+#include <thread>
 #include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <cinttypes>
 #include <iostream>
 #include "dis6502.h"
 
 #include "cpu6502.h"
+#include "jit6502.h"
+#include "vec6502.h"
+#include "farm6502.h"
+#include "step6502.h"
 
 struct dummyclock
 {
@@ -41,7 +48,7 @@ enum {
 template<class CPU>
 cpu_state_vector get_cpu_state_vector(CPU& cpu)
 {
-    return {cpu.a, cpu.x, cpu.y, cpu.p, cpu.s, cpu.pc};
+    return {cpu.a, cpu.x, cpu.y, cpu.get_p(), cpu.s, cpu.pc};
 }
 
 struct bus
@@ -162,10 +169,1286 @@ std::string read_bus_and_disassemble(const BUS &bus, int pc)
     return dis;
 }
 
+// Run JIT6502 and the CPU6502 interpreter side by side in slices of
+// varying length and compare registers, cycles, and memory after each.
+// The translator reads and writes RAM directly, so memory contents are
+// compared instead of the write history.  With interpret_odd_pages
+// code on odd pages is left to the interpreter.
+void run_translator(const bus& image, uint16_t start, bool interpret_odd_pages = false)
+{
+    bus machine = image;
+    bus machine2 = image;
+    dummyclock clock, clock2;
+
+    JIT6502<dummyclock, bus> jit(clock, machine);
+    CPU6502<dummyclock, bus> cpu(clock2, machine2);
+
+    for(int page = 0; page < 256; page++) {
+        jit.map_ram(page, machine.memory.data() + page * 256);
+        jit.set_translatable(page, !(interpret_odd_pages && (page & 1)));
+    }
+
+    jit.cpu.set_pc(start);
+    cpu.set_pc(start);
+
+    uint64_t slice = 1;
+    for(;;) {
+        uint16_t oldpc = cpu.pc;
+
+        jit.run(slice);
+        cpu.run(slice);
+        slice = (slice * 7 + 3) % 500 + 1;
+
+        // A trap loops on itself; step once to tell it from a longer loop
+        if(cpu.pc == oldpc) {
+            jit.cycle();
+            cpu.cycle();
+        }
+
+        auto jit_state = get_cpu_state_vector(jit.cpu);
+        auto cpu_state = get_cpu_state_vector(cpu);
+
+        if((jit_state != cpu_state) || (clock.cycles != clock2.cycles) || (machine.memory != machine2.memory)) {
+            printf("translated and interpreted CPUs differ at cycle %" PRIu64 "\n", clock2.cycles);
+            printf("JIT:     ");
+            print_cpu_state(jit_state);
+            printf("CPU:     ");
+            print_cpu_state(cpu_state);
+            printf("cycles %" PRIu64 " vs %" PRIu64 "\n", clock.cycles, clock2.cycles);
+            for(int addr = 0; addr < 65536; addr++) {
+                if(machine.memory[addr] != machine2.memory[addr]) {
+                    printf("memory 0x%04X: 0x%02X vs 0x%02X\n", addr, machine.memory[addr], machine2.memory[addr]);
+                }
+            }
+            exit(1);
+        }
+
+        if(cpu.pc == oldpc) {
+            break;
+        }
+    }
+
+    printf("%08" PRIu64 " cycles, ", clock.cycles);
+    print_cpu_state(get_cpu_state_vector(cpu));
+    printf("%s\n", read_bus_and_disassemble(machine, cpu.pc).c_str());
+}
+
+// A block from $04F8 whose last instruction, INX, is alone on $0500,
+// and which rewrites it to DEX after the first pass, so X ends at $EE
+// only if the block is dropped
+const uint8_t cross_page_start[] = {
+    0xA9, 0xE8, 0xA2, 0xF0, 0xA0, 0x04, 0x4C, 0xF8, 0x04,
+};
+const uint8_t cross_page_loop[] = {
+    0x8D, 0x00, 0x05, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA, 0xE8, 0x78, 0xA9, 0xCA,
+    0x88, 0xD0, 0xF1, 0x4C, 0x07, 0x05,
+};
+
+void check_translator(const bus& image, uint16_t start)
+{
+    run_translator(image, start);
+    run_translator(image, start, true);
+
+    bus cross_page;
+    std::copy(std::begin(cross_page_start), std::end(cross_page_start), cross_page.memory.begin() + 0x400);
+    std::copy(std::begin(cross_page_loop), std::end(cross_page_loop), cross_page.memory.begin() + 0x4F8);
+    run_translator(cross_page, 0x400);
+}
+
+// Run CPU6502Vector lanes in lockstep against one CPU6502 per lane and
+// compare registers and cycles after every step and memory at the end.
+// Lanes start with different registers, and odd lanes in decimal mode,
+// so they split into different kernel groups along the way.
+void run_vector(const bus& image, uint16_t start)
+{
+    constexpr int lanes = 8;
+    CPU6502Vector<lanes> vec;
+    std::vector<bus> machines(lanes, image);
+    dummyclock clocks[lanes];
+    std::deque<CPU6502<dummyclock, bus>> cpus;
+
+    for(int l = 0; l < lanes; l++) {
+        cpus.emplace_back(clocks[l], machines[l]);
+        std::copy(image.memory.begin(), image.memory.end(), vec.memory(l));
+        uint8_t p = CPU_STATE_VECTOR_STATUS_I | ((l & 1) ? CPU_STATE_VECTOR_STATUS_D : 0) | ((l & 2) ? CPU_STATE_VECTOR_STATUS_C : 0);
+        cpus[l].set_pc(start);
+        cpus[l].a = vec.a[l] = l * 37;
+        cpus[l].x = vec.x[l] = l * 11;
+        cpus[l].y = vec.y[l] = l * 5;
+        cpus[l].set_p(p);
+        vec.set_p(l, p);
+        vec.pc[l] = start;
+    }
+
+    for(;;) {
+        bool trapped = true;
+        for(int l = 0; l < lanes; l++) {
+            uint16_t oldpc = cpus[l].pc;
+            cpus[l].cycle();
+            trapped = trapped && (cpus[l].pc == oldpc);
+        }
+        vec.step();
+
+        for(int l = 0; l < lanes; l++) {
+            cpu_state_vector vec_state = {vec.a[l], vec.x[l], vec.y[l], vec.get_p(l), vec.s[l], vec.pc[l]};
+            auto cpu_state = get_cpu_state_vector(cpus[l]);
+            if((vec_state != cpu_state) || (vec.cycles[l] != clocks[l].cycles)) {
+                printf("vector lane %d and CPU differ at cycle %" PRIu64 "\n", l, clocks[l].cycles);
+                printf("lane:    ");
+                print_cpu_state(vec_state);
+                printf("CPU:     ");
+                print_cpu_state(cpu_state);
+                printf("cycles %" PRIu64 " vs %" PRIu64 "\n", vec.cycles[l], clocks[l].cycles);
+                exit(1);
+            }
+        }
+
+        if(trapped) {
+            break;
+        }
+    }
+
+    for(int l = 0; l < lanes; l++) {
+        if(!std::equal(machines[l].memory.begin(), machines[l].memory.end(), vec.memory(l))) {
+            printf("vector lane %d memory differs from CPU\n", l);
+            exit(1);
+        }
+    }
+
+    printf("%08" PRIu64 " cycles, ", clocks[0].cycles);
+    print_cpu_state(get_cpu_state_vector(cpus[0]));
+    printf("%s\n", read_bus_and_disassemble(machines[0], cpus[0].pc).c_str());
+}
+
+void check_vector(const bus& image, uint16_t start)
+{
+    run_vector(image, start);
+
+    // LDA $1234 at $FFFE, its high byte at $0000, then JMP * at $0001
+    bus wrap;
+    wrap.memory[0xFFFE] = 0xAD;
+    wrap.memory[0xFFFF] = 0x34;
+    wrap.memory[0x0000] = 0x12;
+    wrap.memory[0x0001] = 0x4C;
+    wrap.memory[0x0002] = 0x01;
+    wrap.memory[0x0003] = 0x00;
+    wrap.memory[0x1234] = 0x80;
+    run_vector(wrap, 0xFFFE);
+}
+
+struct farm_machine
+{
+    dummyclock clock;
+    bus memory;
+    CPU6502<dummyclock, bus> cpu;
+
+    farm_machine(const bus& image, uint16_t start) :
+        memory(image),
+        cpu(clock, memory)
+    {
+        cpu.set_pc(start);
+    }
+};
+
+// Run copies of the test on a CPU6502Farm, one per thread a few times
+// over, and check they all stop at the same trap after the same cycles
+void check_farm(const bus& image, uint16_t start)
+{
+    CPU6502Farm<farm_machine> farm;
+    unsigned copies = std::max(1u, std::thread::hardware_concurrency()) * 4;
+    for(unsigned i = 0; i < copies; i++) {
+        farm.add(image, start);
+    }
+
+    CPU6502FarmLimits limits;
+    limits.stop_at_loop = true;
+    auto results = farm.run(limits);
+
+    for(size_t i = 0; i < results.size(); i++) {
+        const auto& result = results[i];
+        if(result.reason == CPU6502FarmResult::TRAPPED) {
+            printf("machine %zu: unhandled instruction %02X at %04X\n", i, result.opcode, result.pc);
+            exit(1);
+        }
+        if((result.reason != results[0].reason) || (result.cycles != results[0].cycles) || (result.pc != results[0].pc) || (farm[i].memory.memory != farm[0].memory.memory)) {
+            printf("machine %zu stopped at %04X after %" PRIu64 " cycles, machine 0 at %04X after %" PRIu64 "\n", i, result.pc, result.cycles, results[0].pc, results[0].cycles);
+            exit(1);
+        }
+    }
+
+    printf("%u machines, %08" PRIu64 " cycles, ", copies, results[0].cycles);
+    print_cpu_state(get_cpu_state_vector(farm[0].cpu));
+    printf("%s\n", read_bus_and_disassemble(farm[0].memory, farm[0].cpu.pc).c_str());
+}
+
+// Bus counting its accesses, for check_stepper_ticks and check_accuracy
+struct counting_bus : bus
+{
+    uint64_t accesses = 0;
+
+    uint8_t read(uint16_t addr)
+    {
+        accesses++;
+        return memory[addr];
+    }
+    void write(uint16_t addr, uint8_t data)
+    {
+        accesses++;
+        memory[addr] = data;
+    }
+};
+
+// Tick a bus-exact CPU6502Stepper through the test and check every
+// tick makes exactly one bus access and hands the clock one cycle
+void check_stepper_ticks(const bus& image, uint16_t start)
+{
+    counting_bus machine;
+    machine.memory = image.memory;
+    dummyclock clock;
+    CPU6502Stepper<dummyclock, counting_bus, CPU6502DefaultVariant, CPU6502BusExact> stepper(clock, machine);
+    stepper.cpu.set_pc(start);
+
+    uint64_t ticks = 0;
+    uint16_t oldpc = start;
+    for(;;) {
+        uint64_t accesses = machine.accesses;
+        stepper.tick();
+        ticks++;
+        if((machine.accesses - accesses != 1) || (clock.cycles != ticks)) {
+            printf("tick %" PRIu64 " made %" PRIu64 " accesses, clock at %" PRIu64 "\n", ticks, machine.accesses - accesses, clock.cycles);
+            exit(1);
+        }
+        if(stepper.instruction_done()) {
+            if((stepper.cpu.pc == oldpc) || (stepper.cpu.total_cycles != ticks)) {
+                break;
+            }
+            oldpc = stepper.cpu.pc;
+        }
+    }
+    if(stepper.cpu.total_cycles != ticks) {
+        printf("stepper ran %" PRIu64 " cycles in %" PRIu64 " ticks\n", stepper.cpu.total_cycles, ticks);
+        exit(1);
+    }
+}
+
+// LDX #3 / JSR $0410 / DEX / BNE / BRK, with INC $20 / RTS at $0410 and
+// JMP * at $0420 for BRK to go to, so check_stepper_ticks sees the
+// stack and padding reads JSR and BRK make
+const uint8_t stepper_calls[] = {
+    0xA2, 0x03, 0x20, 0x10, 0x04, 0xCA, 0xD0, 0xFA, 0x00, 0xEA, 0, 0, 0, 0, 0, 0,
+    0xE6, 0x20, 0x60, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0x4C, 0x20, 0x04,
+};
+
+// CLI / INX / JMP $0401, with STX $10 / JMP * at $0410 for the IRQ
+const uint8_t stepper_irq[] = {
+    0x58, 0xE8, 0x4C, 0x01, 0x04, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0x86, 0x10, 0x4C, 0x12, 0x04,
+};
+
+// Scheduler event asserting IRQ 0 of CPU, for check_stepper_events
+template<class CPU>
+struct scheduled_irq
+{
+    CPU& cpu;
+
+    void event(uint64_t)
+    {
+        cpu.set_irq(0, true);
+    }
+};
+
+// Tick CPU6502Stepper on a CPU6502Scheduler, which lets it run ahead of
+// tick() up to the next event, and check its instructions end on the
+// same cycles as CPU6502::cycle()'s and an IRQ raised by an event is
+// taken at the same instruction
+void check_stepper_events()
+{
+    bus machine;
+    std::copy(std::begin(stepper_irq), std::end(stepper_irq), machine.memory.begin() + 0x400);
+    machine.memory[0xFFFE] = 0x10;
+    machine.memory[0xFFFF] = 0x04;
+    bus machine2 = machine;
+    CPU6502Scheduler scheduler, scheduler2;
+
+    CPU6502Stepper<CPU6502Scheduler, bus> stepper(scheduler, machine);
+    CPU6502<CPU6502Scheduler, bus> cpu(scheduler2, machine2);
+    scheduled_irq<decltype(stepper.cpu)> irq{stepper.cpu};
+    scheduled_irq<decltype(cpu)> irq2{cpu};
+    scheduler.schedule(299, irq);
+    scheduler2.schedule(299, irq2);
+
+    stepper.cpu.set_pc(0x400);
+    cpu.set_pc(0x400);
+
+    const uint64_t ticks = 1000;
+    std::vector<uint64_t> ends, ends2;
+    for(uint64_t tick = 1; tick <= ticks; tick++) {
+        stepper.tick();
+        if(stepper.instruction_done()) {
+            ends.push_back(tick);
+        }
+    }
+    for(;;) {
+        cpu.cycle();
+        if(cpu.total_cycles > ticks) {
+            break;
+        }
+        ends2.push_back(cpu.total_cycles);
+    }
+
+    if((ends != ends2) || (machine.memory[0x10] != machine2.memory[0x10]) || (stepper.cpu.x != cpu.x) || (scheduler.now != ticks)) {
+        printf("stepper ahead of events ended %zu instructions and stored X %02X, CPU %zu and %02X, clock at %" PRIu64 "\n",
+            ends.size(), machine.memory[0x10], ends2.size(), machine2.memory[0x10], scheduler.now);
+        exit(1);
+    }
+}
+
+// Step CPU6502Stepper an instruction at a time against CPU6502::cycle()
+// and compare registers and cycles after each and memory at the end
+void check_stepper(const bus& image, uint16_t start)
+{
+    check_stepper_events();
+
+    bus calls;
+    std::copy(std::begin(stepper_calls), std::end(stepper_calls), calls.memory.begin() + 0x400);
+    calls.memory[0xFFFE] = 0x20;
+    calls.memory[0xFFFF] = 0x04;
+    check_stepper_ticks(calls, 0x400);
+    check_stepper_ticks(image, start);
+
+    bus machine = image;
+    bus machine2 = image;
+    dummyclock clock, clock2;
+
+    CPU6502Stepper<dummyclock, bus> stepper(clock, machine);
+    CPU6502<dummyclock, bus> cpu(clock2, machine2);
+
+    stepper.cpu.set_pc(start);
+    cpu.set_pc(start);
+
+    for(;;) {
+        uint16_t oldpc = cpu.pc;
+
+        stepper.step();
+        cpu.cycle();
+
+        auto step_state = get_cpu_state_vector(stepper.cpu);
+        auto cpu_state = get_cpu_state_vector(cpu);
+
+        if((step_state != cpu_state) || (clock.cycles != clock2.cycles)) {
+            printf("stepped and interpreted CPUs differ at cycle %" PRIu64 "\n", clock2.cycles);
+            printf("stepper: ");
+            print_cpu_state(step_state);
+            printf("CPU:     ");
+            print_cpu_state(cpu_state);
+            printf("cycles %" PRIu64 " vs %" PRIu64 "\n", clock.cycles, clock2.cycles);
+            exit(1);
+        }
+
+        if(cpu.pc == oldpc) {
+            break;
+        }
+    }
+
+    if(machine.memory != machine2.memory) {
+        printf("stepped CPU memory differs from CPU\n");
+        exit(1);
+    }
+
+    printf("%08" PRIu64 " cycles, ", clock.cycles);
+    print_cpu_state(get_cpu_state_vector(cpu));
+    printf("%s\n", read_bus_and_disassemble(machine, cpu.pc).c_str());
+}
+
+// Periodic event for check_scheduler, recording how late it fires
+struct scheduled_timer
+{
+    CPU6502Scheduler& scheduler;
+    uint64_t period;
+    uint64_t fired = 0;
+    uint64_t latest = 0;
+
+    scheduled_timer(CPU6502Scheduler& scheduler, uint64_t period) :
+        scheduler(scheduler),
+        period(period)
+    {
+        scheduler.schedule(period, *this);
+    }
+
+    void event(uint64_t when)
+    {
+        fired++;
+        latest = std::max(latest, scheduler.now - when);
+        scheduler.schedule(when + period, *this);
+    }
+};
+
+// LDX #1 / JMP to the BNE of LDA $20 / BNE, with $20 zero, so the
+// branch is first taken on the Z from LDX and then falls through to the
+// JMP * at $0409
+const uint8_t idle_loop_entry[] = {
+    0xA2, 0x01, 0x4C, 0x07, 0x04, 0xA5, 0x20, 0xD0, 0xFC, 0x4C, 0x09, 0x04,
+};
+
+// Run idle_loop_entry on a CPU6502Scheduler clock and a plain clock and
+// check the first taken branch isn't mistaken for an idle loop
+void check_idle_loop_entry()
+{
+    bus machine;
+    std::copy(std::begin(idle_loop_entry), std::end(idle_loop_entry), machine.memory.begin() + 0x400);
+    machine.memory[0x20] = 0;
+    bus machine2 = machine;
+    CPU6502Scheduler scheduler;
+    dummyclock clock2;
+
+    CPU6502<CPU6502Scheduler, bus> cpu(scheduler, machine);
+    CPU6502<dummyclock, bus> cpu2(clock2, machine2);
+    cpu.set_pc(0x400);
+    cpu2.set_pc(0x400);
+    cpu.run(500);
+    cpu2.run(500);
+
+    auto cpu_state = get_cpu_state_vector(cpu);
+    auto cpu2_state = get_cpu_state_vector(cpu2);
+    if((cpu_state != cpu2_state) || (scheduler.now != clock2.cycles)) {
+        printf("idle loop entered at its branch: scheduled and plain CPUs differ\n");
+        printf("sched:   ");
+        print_cpu_state(cpu_state);
+        printf("CPU:     ");
+        print_cpu_state(cpu2_state);
+        printf("cycles %" PRIu64 " vs %" PRIu64 "\n", scheduler.now, clock2.cycles);
+        exit(1);
+    }
+}
+
+// Clock with an event every 1000 cycles, for check_wait_slice
+template<CPU6502ClockReporting REPORTING>
+struct periodic_clock
+{
+    static constexpr CPU6502ClockReporting cpu_clock_reporting = REPORTING;
+    uint64_t cycles = 0;
+    void add_cpu_cycles(int N) {
+        cycles += N;
+    }
+    uint64_t cpu_cycles_until_event() {
+        return 1000 - cycles % 1000;
+    }
+};
+
+// WAI with nothing to wake it on a clock with events, which must let
+// the whole of run()'s budget pass and report it to the clock
+template<CPU6502ClockReporting REPORTING>
+void check_wait_slice()
+{
+    bus machine;
+    machine.memory[0x200] = 0xCB;
+    periodic_clock<REPORTING> clock;
+    CPU6502<periodic_clock<REPORTING>, bus, WDC65C02> cpu(clock, machine);
+    cpu.set_pc(0x200);
+
+    uint64_t ran = cpu.run(5000);
+    if((ran < 5000) || (clock.cycles != cpu.total_cycles) || !cpu.halted()) {
+        printf("WAI ran %" PRIu64 " of 5000 cycles, reported %" PRIu64 "\n", ran, clock.cycles);
+        exit(1);
+    }
+}
+
+// WAI, then block in wait_until_woken() until another thread asserts
+// an IRQ, which must leave the CPU running
+void check_wait_until_woken()
+{
+    bus machine;
+    machine.memory[0x200] = 0xCB;
+    dummyclock clock;
+    CPU6502<dummyclock, bus, WDC65C02> cpu(clock, machine);
+    cpu.set_pc(0x200);
+    cpu.set_p(cpu.I);
+    cpu.run(100);
+
+    std::thread waker([&cpu]() {
+        cpu.set_irq(0, true);
+    });
+    cpu.wait_until_woken();
+    waker.join();
+
+    cpu.run(10);
+    if(cpu.halted() || (cpu.pc == 0x201)) {
+        printf("WAI still halted after an IRQ from another thread\n");
+        exit(1);
+    }
+}
+
+// Scheduler event remapping page 2 of a CPU6502PageBus, for
+// check_page_remap
+struct page_remapper
+{
+    CPU6502PageBus& bus;
+    uint8_t* memory;
+
+    void event(uint64_t)
+    {
+        bus.map_ram(2, 1, memory);
+    }
+};
+
+// Run NOP / JMP $0200 and remap page 2 to INX / JMP $0200 from an event
+// at cycle 100, which the CPU must fetch from then on
+void check_page_remap()
+{
+    uint8_t nop_page[256] = {0xEA, 0x4C, 0x00, 0x02};
+    uint8_t inx_page[256] = {0xE8, 0x4C, 0x00, 0x02};
+    CPU6502PageBus machine;
+    machine.map_ram(2, 1, nop_page);
+    CPU6502Scheduler scheduler;
+    page_remapper remapper{machine, inx_page};
+    scheduler.schedule(100, remapper);
+
+    CPU6502<CPU6502Scheduler, CPU6502PageBus> cpu(scheduler, machine);
+    cpu.set_pc(0x200);
+    cpu.run(200);
+    if(cpu.x != 20) {
+        printf("page remapped at cycle 100 ran INX %d times by cycle %" PRIu64 ", expected 20\n", cpu.x, scheduler.now);
+        exit(1);
+    }
+}
+
+// Run the test on a CPU6502Scheduler clock with two periodic events and
+// check the CPU ends in the same state as one on a plain clock, and
+// that every event fired once per period within an instruction of its
+// deadline
+void check_scheduler(const bus& image, uint16_t start)
+{
+    check_idle_loop_entry();
+    check_wait_slice<CPU6502ClockReporting::PER_INSTRUCTION>();
+    check_wait_slice<CPU6502ClockReporting::PER_SLICE>();
+    check_wait_until_woken();
+    check_page_remap();
+
+    bus machine = image;
+    bus machine2 = image;
+    CPU6502Scheduler scheduler;
+    dummyclock clock2;
+
+    CPU6502<CPU6502Scheduler, bus> cpu(scheduler, machine);
+    CPU6502<dummyclock, bus> cpu2(clock2, machine2);
+    scheduled_timer timers[] = {{scheduler, 1000}, {scheduler, 777}};
+
+    cpu.set_pc(start);
+    cpu2.set_pc(start);
+
+    for(;;) {
+        uint16_t oldpc = cpu.pc;
+        scheduler.run(cpu, 5000);
+        if(cpu.pc == oldpc) {
+            cpu.cycle();
+            if(cpu.pc == oldpc) {
+                break;
+            }
+        }
+    }
+
+    for(;;) {
+        uint16_t oldpc = cpu2.pc;
+        cpu2.cycle();
+        if(cpu2.pc == oldpc) {
+            break;
+        }
+    }
+
+    auto cpu_state = get_cpu_state_vector(cpu);
+    auto cpu2_state = get_cpu_state_vector(cpu2);
+    if((cpu_state != cpu2_state) || (machine.memory != machine2.memory)) {
+        printf("scheduled and plain CPUs differ\n");
+        printf("sched:   ");
+        print_cpu_state(cpu_state);
+        printf("CPU:     ");
+        print_cpu_state(cpu2_state);
+        exit(1);
+    }
+
+    for(const auto& timer: timers) {
+        if((timer.fired != scheduler.now / timer.period) || (timer.latest > 8)) {
+            printf("%" PRIu64 " cycle event fired %" PRIu64 " times in %" PRIu64 " cycles, up to %" PRIu64 " late\n", timer.period, timer.fired, scheduler.now, timer.latest);
+            exit(1);
+        }
+    }
+
+    printf("%08" PRIu64 " cycles, %" PRIu64 " events, ", scheduler.now, timers[0].fired + timers[1].fired);
+    print_cpu_state(cpu_state);
+    printf("%s\n", read_bus_and_disassemble(machine, cpu.pc).c_str());
+}
+
+// Page of memory behind a CPU6502MapDevice, for check_map_bus
+struct map_device_page
+{
+    uint8_t memory[256];
+
+    uint8_t read(uint16_t addr)
+    {
+        return memory[addr & 0xFF];
+    }
+    void write(uint16_t addr, uint8_t data)
+    {
+        memory[addr & 0xFF] = data;
+    }
+};
+
+typedef CPU6502MapBus<
+    CPU6502MapRam<0x0000, 0xCFFF>,
+    CPU6502MapDevice<0xD000, 0xD0FF, map_device_page>,
+    CPU6502MapRam<0xD100, 0xFFFF>> map_bus;
+
+void load_map_bus(map_bus& map, const bus& image)
+{
+    auto& low = map.region<CPU6502MapRam<0x0000, 0xCFFF>>().memory;
+    auto& device = map.region<CPU6502MapDevice<0xD000, 0xD0FF, map_device_page>>().device.memory;
+    auto& high = map.region<CPU6502MapRam<0xD100, 0xFFFF>>().memory;
+    std::copy(image.memory.begin(), image.memory.begin() + 0xD000, low);
+    std::copy(image.memory.begin() + 0xD000, image.memory.begin() + 0xD100, device);
+    std::copy(image.memory.begin() + 0xD100, image.memory.end(), high);
+}
+
+// Run the test on a CPU6502MapBus of RAM with a device page in the
+// middle and check it ends in the same state as on the plain bus
+void check_map_bus(const bus& image, uint16_t start)
+{
+    bus machine = image;
+    dummyclock clock, clock2;
+
+    CPU6502<dummyclock, map_bus> cpu(clock);
+    CPU6502<dummyclock, bus> cpu2(clock2, machine);
+
+    load_map_bus(cpu.bus, image);
+
+    cpu.set_pc(start);
+    cpu2.set_pc(start);
+
+    for(;;) {
+        uint16_t oldpc = cpu2.pc;
+        cpu.cycle();
+        cpu2.cycle();
+        if(cpu2.pc == oldpc) {
+            break;
+        }
+    }
+
+    bool memory_same = true;
+    for(int addr = 0; addr < 65536; addr++) {
+        memory_same = memory_same && (cpu.bus.read(addr) == machine.memory[addr]);
+    }
+    auto cpu_state = get_cpu_state_vector(cpu);
+    auto cpu2_state = get_cpu_state_vector(cpu2);
+    if((cpu_state != cpu2_state) || (clock.cycles != clock2.cycles) || !memory_same) {
+        printf("map bus and plain bus CPUs differ\n");
+        printf("map:     ");
+        print_cpu_state(cpu_state);
+        printf("CPU:     ");
+        print_cpu_state(cpu2_state);
+        printf("cycles %" PRIu64 " vs %" PRIu64 "\n", clock.cycles, clock2.cycles);
+        exit(1);
+    }
+
+    printf("%08" PRIu64 " cycles, ", clock.cycles);
+    print_cpu_state(cpu_state);
+    printf("%s\n", read_bus_and_disassemble(machine, cpu2.pc).c_str());
+}
+
+// Run the test to its trap with ACCURACY and return the instructions run
+template<class ACCURACY>
+uint64_t run_accuracy(CPU6502<dummyclock, counting_bus, CPU6502DefaultVariant, CPU6502NoBlockCache, ACCURACY>& cpu)
+{
+    uint64_t instructions = 0;
+    for(;;) {
+        uint16_t oldpc = cpu.pc;
+        cpu.cycle();
+        instructions++;
+        if(cpu.pc == oldpc) {
+            return instructions;
+        }
+    }
+}
+
+// WAI with a masked IRQ already asserted, so it doesn't wait, then NOP
+// and STP, on a warp CPU, which must count each as one instruction
+void check_wait_stop_warp()
+{
+    bus machine;
+    const uint8_t program[] = {0xCB, 0xEA, 0xDB};
+    std::copy(std::begin(program), std::end(program), machine.memory.begin() + 0x400);
+    dummyclock clock;
+    CPU6502<dummyclock, bus, WDC65C02, CPU6502NoBlockCache, CPU6502Warp> cpu(clock, machine);
+    cpu.set_pc(0x400);
+    cpu.set_p(cpu.I);
+    cpu.set_irq(0, true);
+
+    for(int i = 0; i < 3; i++) {
+        cpu.cycle();
+    }
+    if((cpu.total_cycles != 3) || (cpu.pc != 0x403) || (cpu.halt != cpu.STOPPED)) {
+        printf("warp CPU counted %" PRIu64 " instructions for WAI, NOP and STP, expected 3\n", cpu.total_cycles);
+        exit(1);
+    }
+}
+
+// Run the test with CPU6502Warp and CPU6502BusExact and check each ends
+// in the same state as CPU6502InstructionExact, that warp reports no
+// cycles, and that bus-exact takes the same cycles with a bus access in
+// every one
+void check_accuracy(const bus& image, uint16_t start)
+{
+    check_wait_stop_warp();
+
+    counting_bus machines[3];
+    dummyclock clocks[3];
+    for(auto& machine: machines) {
+        machine.memory = image.memory;
+    }
+
+    CPU6502<dummyclock, counting_bus, CPU6502DefaultVariant, CPU6502NoBlockCache, CPU6502InstructionExact> exact(clocks[0], machines[0]);
+    CPU6502<dummyclock, counting_bus, CPU6502DefaultVariant, CPU6502NoBlockCache, CPU6502Warp> warp(clocks[1], machines[1]);
+    CPU6502<dummyclock, counting_bus, CPU6502DefaultVariant, CPU6502NoBlockCache, CPU6502BusExact> bus_exact(clocks[2], machines[2]);
+    exact.set_pc(start);
+    warp.set_pc(start);
+    bus_exact.set_pc(start);
+
+    uint64_t instructions = run_accuracy(exact);
+    uint64_t warp_instructions = run_accuracy(warp);
+    run_accuracy(bus_exact);
+
+    auto exact_state = get_cpu_state_vector(exact);
+    if((get_cpu_state_vector(warp) != exact_state) || (machines[1].memory != machines[0].memory) ||
+        (warp_instructions != instructions) || (warp.total_cycles != instructions) || (clocks[1].cycles != 0)) {
+        printf("warp CPU differs from instruction-exact\n");
+        printf("warp:    ");
+        print_cpu_state(get_cpu_state_vector(warp));
+        printf("exact:   ");
+        print_cpu_state(exact_state);
+        printf("instructions %" PRIu64 " vs %" PRIu64 ", %" PRIu64 " cycles reported\n", warp_instructions, instructions, clocks[1].cycles);
+        exit(1);
+    }
+    if((get_cpu_state_vector(bus_exact) != exact_state) || (machines[2].memory != machines[0].memory) || (clocks[2].cycles != clocks[0].cycles) ||
+        (machines[2].accesses != clocks[2].cycles)) {
+        printf("bus-exact CPU differs from instruction-exact\n");
+        printf("bus:     ");
+        print_cpu_state(get_cpu_state_vector(bus_exact));
+        printf("exact:   ");
+        print_cpu_state(exact_state);
+        printf("cycles %" PRIu64 " vs %" PRIu64 ", %" PRIu64 " bus accesses\n", clocks[2].cycles, clocks[0].cycles, machines[2].accesses);
+        exit(1);
+    }
+
+    printf("%08" PRIu64 " cycles, %" PRIu64 " instructions, %" PRIu64 " and %" PRIu64 " bus accesses, ", clocks[0].cycles, instructions, machines[0].accesses, machines[2].accesses);
+    print_cpu_state(exact_state);
+    printf("%s\n", read_bus_and_disassemble<bus>(machines[0], exact.pc).c_str());
+}
+
+// Run every opcode once on VARIANT with and without page crossings and
+// with the flags clear and set, and check its cpu6502_opcodes entry: that
+// it traps if and only if it isn't implemented, its length, its cycles,
+// and that it changes only the registers and flags it lists.  Returns
+// the number of mismatches.
+template<class VARIANT>
+int check_opcodes_of(const char* name)
+{
+    typedef CPU6502Opcode O;
+    int errors = 0;
+
+    for(int op = 0; op < 256; op++) {
+        const O& info = cpu6502_opcodes<VARIANT>[op];
+
+        for(int k = 0; k < 4; k++) {
+            bool cross = k & 1;
+            uint8_t p = (k & 2) ? (O::P & ~O::D) : 0;
+
+            bus machine;
+            std::fill(machine.memory.begin(), machine.memory.end(), 0);
+            dummyclock clock;
+            CPU6502<dummyclock, bus, VARIANT> cpu(clock, machine);
+
+            // Indexed and indirect operands land at 0x3011, 0x4001, or
+            // across a page at 0x31EF, 0x417F; branches go to 0x212 or 0x1F2
+            uint8_t operand = cross ? 0xF0 : 0x10;
+            machine.memory[0x200] = op;
+            machine.memory[0x201] = operand;
+            machine.memory[0x202] = 0x30;
+            machine.memory[0x10] = 0x00;
+            machine.memory[0x11] = 0x40;
+            machine.memory[0x12] = 0x40;
+            machine.memory[0xEF] = 0x40;
+            machine.memory[0xF0] = 0x80;
+            machine.memory[0xF1] = 0x40;
+            cpu.set_pc(0x200);
+            cpu.set_p(p);
+            cpu.a = 0x55;
+            cpu.x = cpu.y = cross ? 0xFF : 0x01;
+            cpu.s = 0xF0;
+
+            cpu_state_vector before = get_cpu_state_vector(cpu);
+            cpu.cycle();
+            cpu_state_vector after = get_cpu_state_vector(cpu);
+
+            bool trapped = cpu.halt == cpu.TRAPPED;
+            if(trapped != !info.implemented) {
+                printf("%s %02X %s: %s\n", name, op, info.mnemonic, trapped ? "traps" : "doesn't trap");
+                errors++;
+                break;
+            }
+            if(trapped) {
+                break;
+            }
+
+            int cycles = info.cycles;
+            int length = info.length;
+            bool check_length = !(info.writes & O::PC);
+            if(info.mode == O::REL) {
+                bool taken = !info.flags_read || (((p & info.flags_read) != 0) == ((op & 0x20) != 0));
+                if(taken) {
+                    cycles += info.branch_penalty + (cross ? info.page_penalty : 0);
+                    length += int8_t(operand);
+                }
+                check_length = true;
+            } else if(info.mode == O::ZPR) {
+                bool taken = ((machine.memory[operand] >> ((op >> 4) & 7)) & 1) == ((op >> 7) & 1);
+                if(taken) {
+                    cycles += info.branch_penalty;
+                    length += 0x30;
+                }
+                check_length = true;
+            } else if(info.mode == O::ABX || info.mode == O::ABY || info.mode == O::IZY) {
+                cycles += cross ? info.page_penalty : 0;
+            }
+
+            int ran = int(clock.cycles);
+            int moved = uint16_t(after[CPU_STATE_VECTOR_PC] - 0x200);
+            if((ran != cycles) || (check_length && (moved != uint16_t(length)))) {
+                printf("%s %02X %s: %d cycles and %d bytes, table has %d and %d\n", name, op, info.mnemonic, ran, moved, cycles, length);
+                errors++;
+            }
+
+            uint8_t changed = 0;
+            changed |= (after[CPU_STATE_VECTOR_A] != before[CPU_STATE_VECTOR_A]) ? O::A : 0;
+            changed |= (after[CPU_STATE_VECTOR_X] != before[CPU_STATE_VECTOR_X]) ? O::X : 0;
+            changed |= (after[CPU_STATE_VECTOR_Y] != before[CPU_STATE_VECTOR_Y]) ? O::Y : 0;
+            changed |= (after[CPU_STATE_VECTOR_SP] != before[CPU_STATE_VECTOR_SP]) ? O::S : 0;
+            uint8_t flags_changed = (after[CPU_STATE_VECTOR_STATUS] ^ before[CPU_STATE_VECTOR_STATUS]) & O::P;
+            if((changed & ~info.writes) || (flags_changed & ~info.flags_written)) {
+                printf("%s %02X %s: changed registers %02X flags %02X, table has %02X %02X\n", name, op, info.mnemonic, changed, flags_changed, info.writes, info.flags_written);
+                errors++;
+            }
+        }
+    }
+    return errors;
+}
+
+// Compare the decimal mode ADC and SBC tables with m6502.h for every A,
+// operand, and carry.  The NMOS tables must match it exactly; the CMOS
+// tables must match its result, V and C, with N and Z from the result.
+template<bool CMOS>
+int check_decimal_of(const char* name)
+{
+    typedef CPU6502DecimalTables<CMOS> Tables;
+    const Tables& tables = Tables::get();
+    int errors = 0;
+
+    for(int c = 0; c < 2; c++) {
+        for(int a = 0; a < 256; a++) {
+            for(int m = 0; m < 256; m++) {
+                for(int sbc = 0; sbc < 2; sbc++) {
+                    m6502_t ref {};
+                    ref.bcd_enabled = true;
+                    ref.A = a;
+                    ref.P = M6502_DF | (c ? M6502_CF : 0);
+                    if(sbc) {
+                        _m6502_sbc(&ref, m);
+                    } else {
+                        _m6502_adc(&ref, m);
+                    }
+                    uint8_t expected = ref.P & (M6502_NF | M6502_VF | M6502_ZF | M6502_CF);
+                    if(CMOS) {
+                        expected = (expected & (M6502_VF | M6502_CF)) | (ref.A & M6502_NF) | ((ref.A == 0) ? M6502_ZF : 0);
+                    }
+                    const auto& entry = sbc ? tables.sbc[Tables::index(a, m, c)] : tables.adc[Tables::index(a, m, c)];
+                    if((entry.result != ref.A) || (entry.p != expected)) {
+                        if(errors < 10) {
+                            printf("%s %s A=%02X M=%02X C=%d: %02X P=%02X, expected %02X P=%02X\n", name, sbc ? "SBC" : "ADC", a, m, c, entry.result, entry.p, ref.A, expected);
+                        }
+                        errors++;
+                    }
+                }
+            }
+        }
+    }
+    return errors;
+}
+
+void check_decimal()
+{
+    int errors = check_decimal_of<false>("NMOS") + check_decimal_of<true>("CMOS");
+    if(errors) {
+        printf("%d decimal table mismatches\n", errors);
+        exit(1);
+    }
+    printf("decimal tables match m6502.h\n");
+}
+
+// Shift-and-add multiply of $F0 by $F1, leaving the product in $F2
+// (low) and $F3 and A (high), $F1 and X zero, and N, Z, C and V as DEX
+// then CLC and CLV leave them
+const uint8_t multiply_routine[] = {
+    0xA9, 0x00, 0x85, 0xF2, 0xA2, 0x08, 0x46, 0xF1, 0x90, 0x03, 0x18, 0x65,
+    0xF0, 0x6A, 0x66, 0xF2, 0xCA, 0xD0, 0xF3, 0x85, 0xF3, 0x18, 0xB8, 0x60,
+};
+
+// For each N in 0-255, multiply N by N ^ $FF and store the product at
+// $0400+N and $0500+N, then stop at $021E
+const uint8_t multiply_driver[] = {
+    0xD8, 0xA9, 0x00, 0x85, 0xE0, 0xA5, 0xE0, 0x85, 0xF0, 0x49, 0xFF, 0x85,
+    0xF1, 0x20, 0x00, 0x03, 0xA4, 0xE0, 0x99, 0x00, 0x04, 0xA5, 0xF2, 0x99,
+    0x00, 0x05, 0xE6, 0xE0, 0xD0, 0xE7, 0x4C, 0x1E, 0x02,
+};
+
+template<class CPU>
+struct multiply_hook
+{
+    bool wrong = false; // get the high byte wrong, to test verification
+
+    void run(CPU& cpu)
+    {
+        int product = cpu.hook_read(0xF0) * cpu.hook_read(0xF1);
+        uint8_t high = (product >> 8) ^ (wrong ? 1 : 0);
+        cpu.hook_write(0xF1, 0);
+        cpu.hook_write(0xF2, product & 0xFF);
+        cpu.hook_write(0xF3, high);
+        cpu.a = high;
+        cpu.x = 0;
+        cpu.n_result = 0;
+        cpu.z_result = 0;
+        cpu.c_flag = false;
+        cpu.v_flag = false;
+    }
+};
+
+template<class CPU>
+void run_multiply(CPU& cpu)
+{
+    std::copy(std::begin(multiply_routine), std::end(multiply_routine), cpu.bus.memory.begin() + 0x300);
+    std::copy(std::begin(multiply_driver), std::end(multiply_driver), cpu.bus.memory.begin() + 0x200);
+    cpu.set_pc(0x200);
+    while(cpu.pc != 0x21E) {
+        cpu.cycle();
+    }
+}
+
+// Multiply 7 by 9 after calling a routine at $0340 that pulls its
+// return address and so returns to its caller's caller, then stop at
+// $020E
+const uint8_t escape_driver[] = {
+    0xA9, 0x07, 0x85, 0xF0, 0xA9, 0x09, 0x85, 0xF1, 0x20, 0x20, 0x02, 0x20,
+    0x00, 0x03, 0x4C, 0x0E, 0x02,
+};
+const uint8_t escape_caller[] = {0x20, 0x40, 0x03, 0x00};
+const uint8_t escape_routine[] = {0x68, 0x68, 0x60};
+
+template<class CPU>
+struct escape_hook
+{
+    void run(CPU&) {}
+};
+
+// Verify a hook on a routine that leaves without its own RTS, then a
+// wrong multiply hook, which must still be verified
+template<class CPU, class HLE>
+void check_hook_escape(HLE& multiply)
+{
+    bus machine;
+    dummyclock clock;
+    CPU cpu(clock, machine);
+    escape_hook<CPU> escape;
+    cpu.hook(0x340, escape, 10);
+    cpu.hook(0x300, multiply, 40);
+    cpu.verify_hooks = true;
+
+    std::copy(std::begin(multiply_routine), std::end(multiply_routine), machine.memory.begin() + 0x300);
+    std::copy(std::begin(escape_driver), std::end(escape_driver), machine.memory.begin() + 0x200);
+    std::copy(std::begin(escape_caller), std::end(escape_caller), machine.memory.begin() + 0x220);
+    std::copy(std::begin(escape_routine), std::end(escape_routine), machine.memory.begin() + 0x340);
+    cpu.set_pc(0x200);
+    for(int i = 0; (i < 10000) && (cpu.pc != 0x20E); i++) {
+        cpu.cycle();
+    }
+    if((cpu.pc != 0x20E) || (cpu.hook_mismatches != 2) || (cpu.hook_mismatch_entry != 0x300) ||
+        cpu.hook_verifying || (machine.memory[0xF2] != 63)) {
+        printf("verifying a routine that skips its RTS found %" PRIu64 " mismatches, expected 2, stopping at %04X\n",
+            cpu.hook_mismatches, cpu.pc);
+        exit(1);
+    }
+}
+
+// PHA / PLA / RTS, called with S at $01 so the routine's stack wraps
+// to $FF
+const uint8_t wrapped_stack_driver[] = {0x20, 0x40, 0x03, 0x4C, 0x03, 0x02};
+const uint8_t wrapped_stack_routine[] = {0x48, 0x68, 0x60};
+
+// Verify a hook on a routine whose stack wraps past $00, which must
+// finish at its RTS without a mismatch
+template<class CPU>
+void check_hook_wrapped_stack()
+{
+    bus machine;
+    dummyclock clock;
+    CPU cpu(clock, machine);
+    escape_hook<CPU> hle;
+    cpu.hook(0x340, hle, 10);
+    cpu.verify_hooks = true;
+
+    std::copy(std::begin(wrapped_stack_driver), std::end(wrapped_stack_driver), machine.memory.begin() + 0x200);
+    std::copy(std::begin(wrapped_stack_routine), std::end(wrapped_stack_routine), machine.memory.begin() + 0x340);
+    cpu.set_pc(0x200);
+    cpu.s = 0x01;
+    for(int i = 0; (i < 100) && (cpu.pc != 0x203); i++) {
+        cpu.cycle();
+    }
+    if((cpu.pc != 0x203) || (cpu.s != 0x01) || (cpu.hook_mismatches != 0) || cpu.hook_verifying) {
+        printf("verifying a routine with its stack wrapped found %" PRIu64 " mismatches, stopping at %04X\n",
+            cpu.hook_mismatches, cpu.pc);
+        exit(1);
+    }
+}
+
+// Run the multiply table with the routine interpreted, hooked, and
+// hooked with verification, with a correct and then a wrong hook
+void check_hooks()
+{
+    typedef CPU6502<dummyclock, bus> cpu_type;
+    bus machine, hooked_machine, verified_machine, wrong_machine;
+    dummyclock clock, hooked_clock, verified_clock, wrong_clock;
+    cpu_type cpu(clock, machine);
+    cpu_type hooked(hooked_clock, hooked_machine);
+    cpu_type verified(verified_clock, verified_machine);
+    cpu_type wrong(wrong_clock, wrong_machine);
+    multiply_hook<cpu_type> hle, wrong_hle;
+    wrong_hle.wrong = true;
+
+    hooked.hook(0x300, hle, 40);
+    verified.hook(0x300, hle, 40);
+    verified.verify_hooks = true;
+    wrong.hook(0x300, wrong_hle, 40);
+    wrong.verify_hooks = true;
+
+    run_multiply(cpu);
+    run_multiply(hooked);
+    run_multiply(verified);
+    run_multiply(wrong);
+
+    auto cpu_state = get_cpu_state_vector(cpu);
+    auto hooked_state = get_cpu_state_vector(hooked);
+    bool results_right = true;
+    for(int n = 0; n < 256; n++) {
+        int product = n * (n ^ 0xFF);
+        results_right = results_right && (machine.memory[0x400 + n] == (product >> 8)) && (machine.memory[0x500 + n] == (product & 0xFF));
+    }
+    if(!results_right || (hooked_machine.memory != machine.memory) || (hooked_state != cpu_state) || (hooked_clock.cycles >= clock.cycles)) {
+        printf("hooked multiply differs from interpreted multiply\n");
+        printf("CPU:     ");
+        print_cpu_state(cpu_state);
+        printf("hooked:  ");
+        print_cpu_state(hooked_state);
+        printf("cycles %" PRIu64 " vs %" PRIu64 "\n", clock.cycles, hooked_clock.cycles);
+        exit(1);
+    }
+    if((verified.hook_mismatches != 0) || (verified_clock.cycles != clock.cycles) || (verified_machine.memory != machine.memory)) {
+        printf("verifying a correct hook found %" PRIu64 " mismatches\n", verified.hook_mismatches);
+        exit(1);
+    }
+    if((wrong.hook_mismatches != 256) || (wrong.hook_mismatch_entry != 0x300)) {
+        printf("verifying a wrong hook found %" PRIu64 " mismatches, expected 256\n", wrong.hook_mismatches);
+        exit(1);
+    }
+    check_hook_escape<cpu_type>(wrong_hle);
+    check_hook_wrapped_stack<cpu_type>();
+    printf("multiply: %" PRIu64 " cycles interpreted, %" PRIu64 " hooked; hooks verify\n", clock.cycles, hooked_clock.cycles);
+}
+
+// Fill $1100-$11FE, copy $30C0-$31BF to $2080, to $0290 over the
+// code's page, and to $D080 through the device page, then multiply $B7
+// by $5D with the loop from multiply_routine, and stop at $025B
+const uint8_t loop_idioms[] = {
+    0xD8, 0xA9, 0x5A, 0xA2, 0x00, 0x9D, 0xFF, 0x10, 0xCA, 0xD0, 0xFA, 0xA9,
+    0xC0, 0x85, 0xF0, 0xA9, 0x30, 0x85, 0xF1, 0xA9, 0x80, 0x85, 0xF2, 0xA9,
+    0x20, 0x85, 0xF3, 0xA0, 0x00, 0xB1, 0xF0, 0x91, 0xF2, 0xC8, 0xD0, 0xF9,
+    0xA9, 0x02, 0x85, 0xF3, 0xA0, 0x10, 0xB1, 0xF0, 0x91, 0xF2, 0xC8, 0xD0,
+    0xF9, 0xA9, 0xD0, 0x85, 0xF3, 0xA0, 0x00, 0xB1, 0xF0, 0x91, 0xF2, 0xC8,
+    0xD0, 0xF9, 0xA9, 0xB7, 0x85, 0xF4, 0xA9, 0x5D, 0x85, 0xF5, 0xA9, 0x00,
+    0x85, 0xF6, 0xA2, 0x08, 0x46, 0xF5, 0x90, 0x03, 0x18, 0x65, 0xF4, 0x6A,
+    0x66, 0xF6, 0xCA, 0xD0, 0xF3, 0x85, 0xF7, 0x4C, 0x5B, 0x02,
+};
+
+struct call_counting_clock
+{
+    uint64_t cycles = 0;
+    uint64_t calls = 0;
+    void add_cpu_cycles(int N) {
+        cycles += N;
+        calls++;
+    }
+};
+
+// Run loop_idioms in slices of varying length on a map_bus CPU, which
+// runs the loops natively where it can, and on a plain bus CPU, which
+// interprets them, checking they agree after every slice
+template<class VARIANT>
+int check_loop_idioms_of(const char* name)
+{
+    bus machine;
+    for(int i = 0; i < 0x200; i++) {
+        machine.memory[0x3000 + i] = i * 7;
+    }
+    std::copy(std::begin(loop_idioms), std::end(loop_idioms), machine.memory.begin() + 0x200);
+
+    call_counting_clock clock, clock2;
+    CPU6502<call_counting_clock, map_bus, VARIANT> cpu(clock);
+    CPU6502<call_counting_clock, bus, VARIANT> cpu2(clock2, machine);
+    load_map_bus(cpu.bus, machine);
+    cpu.set_pc(0x200);
+    cpu2.set_pc(0x200);
+
+    for(int i = 0; cpu2.pc != 0x25B; i++) {
+        uint64_t slice = 1 + (i * 37) % 400;
+        cpu.run(slice);
+        cpu2.run(slice);
+        auto cpu_state = get_cpu_state_vector(cpu);
+        auto cpu2_state = get_cpu_state_vector(cpu2);
+        if((cpu_state != cpu2_state) || (clock.cycles != clock2.cycles)) {
+            printf("%s: native and interpreted loops differ after slice %d\n", name, i);
+            printf("native:  ");
+            print_cpu_state(cpu_state);
+            printf("CPU:     ");
+            print_cpu_state(cpu2_state);
+            printf("cycles %" PRIu64 " vs %" PRIu64 "\n", clock.cycles, clock2.cycles);
+            return 1;
+        }
+    }
+
+    bool memory_same = true;
+    for(int addr = 0; addr < 65536; addr++) {
+        memory_same = memory_same && (cpu.bus.read(addr) == machine.memory[addr]);
+    }
+    bool copied = std::equal(machine.memory.begin() + 0x30C0, machine.memory.begin() + 0x31C0, machine.memory.begin() + 0x2080);
+    bool multiplied = (machine.memory[0xF6] == 0x7B) && (machine.memory[0xF7] == 0x42);
+    if(!memory_same || !copied || !multiplied || (clock.calls >= clock2.calls)) {
+        printf("%s: memory %s, copy %s, multiply %s, %" PRIu64 " vs %" PRIu64 " clock calls\n", name,
+            memory_same ? "same" : "differs", copied ? "right" : "wrong", multiplied ? "right" : "wrong", clock.calls, clock2.calls);
+        return 1;
+    }
+    printf("%s: %" PRIu64 " cycles, %" PRIu64 " instructions interpreted, %" PRIu64 " with loops run natively\n", name, clock.cycles, clock2.calls, clock.calls);
+    return 0;
+}
+
+void check_loop_idioms()
+{
+    int errors = check_loop_idioms_of<NMOS6502>("NMOS6502") + check_loop_idioms_of<CMOS65C02>("CMOS65C02");
+    if(errors) {
+        exit(1);
+    }
+}
+
+// Cycles from the W65C02S data sheet for opcodes the 65C02 adds or
+// retimes, before page and branch penalties
+const uint8_t wdc65c02_cycles[][2] = {
+    {0x02, 2}, {0x03, 1}, {0x04, 5}, {0x07, 5}, {0x0C, 6}, {0x0F, 5}, {0x12, 5}, {0x14, 5},
+    {0x1A, 2}, {0x1C, 6}, {0x1E, 6}, {0x34, 4}, {0x3A, 2}, {0x3C, 4}, {0x44, 3}, {0x54, 4},
+    {0x5A, 3}, {0x5C, 8}, {0x64, 3}, {0x6C, 6}, {0x74, 4}, {0x7A, 4}, {0x7C, 6}, {0x80, 3},
+    {0x89, 2}, {0x8F, 5}, {0x92, 5}, {0x9C, 4}, {0x9E, 5}, {0xCB, 3}, {0xD4, 4}, {0xDA, 3},
+    {0xDB, 3}, {0xDC, 4}, {0xF4, 4}, {0xFA, 4}, {0xFC, 4},
+};
+
+void check_opcodes()
+{
+    int errors = check_opcodes_of<NMOS6502>("NMOS6502") +
+        check_opcodes_of<NES2A03>("NES2A03") +
+        check_opcodes_of<CMOS65C02>("CMOS65C02") +
+        check_opcodes_of<Rockwell65C02>("Rockwell65C02") +
+        check_opcodes_of<WDC65C02>("WDC65C02");
+    for(const auto& [op, cycles]: wdc65c02_cycles) {
+        const CPU6502Opcode& info = cpu6502_opcodes<WDC65C02>[op];
+        if(info.cycles != cycles) {
+            printf("WDC65C02 %02X %s: table has %d cycles, the data sheet %d\n", op, info.mnemonic, info.cycles, cycles);
+            errors++;
+        }
+    }
+    if(errors) {
+        printf("%d opcode table mismatches\n", errors);
+        exit(1);
+    }
+    printf("opcode tables match CPU6502 and the 65C02 data sheet\n");
+}
+
 int main(int argc, const char **argv)
 {
+    if((argc > 1) && (strcmp(argv[1], "--opcodes") == 0)) {
+        check_opcodes();
+        exit(EXIT_SUCCESS);
+    }
+
+    if((argc > 1) && (strcmp(argv[1], "--decimal") == 0)) {
+        check_decimal();
+        exit(EXIT_SUCCESS);
+    }
+
+    if((argc > 1) && (strcmp(argv[1], "--hooks") == 0)) {
+        check_hooks();
+        exit(EXIT_SUCCESS);
+    }
+
+    if((argc > 1) && (strcmp(argv[1], "--idioms") == 0)) {
+        check_loop_idioms();
+        exit(EXIT_SUCCESS);
+    }
+
+    bool check_jit = false;
+    bool check_vec = false;
+    bool check_many = false;
+    bool check_step = false;
+    bool check_sched = false;
+    bool check_acc = false;
+    bool check_map = false;
+    if((argc > 2) && (strcmp(argv[1], "--jit") == 0)) {
+        check_jit = true;
+        argc--;
+        argv++;
+    } else if((argc > 2) && (strcmp(argv[1], "--vector") == 0)) {
+        check_vec = true;
+        argc--;
+        argv++;
+    } else if((argc > 2) && (strcmp(argv[1], "--farm") == 0)) {
+        check_many = true;
+        argc--;
+        argv++;
+    } else if((argc > 2) && (strcmp(argv[1], "--step") == 0)) {
+        check_step = true;
+        argc--;
+        argv++;
+    } else if((argc > 2) && (strcmp(argv[1], "--sched") == 0)) {
+        check_sched = true;
+        argc--;
+        argv++;
+    } else if((argc > 2) && (strcmp(argv[1], "--accuracy") == 0)) {
+        check_acc = true;
+        argc--;
+        argv++;
+    } else if((argc > 2) && (strcmp(argv[1], "--map") == 0)) {
+        check_map = true;
+        argc--;
+        argv++;
+    }
+
     if(argc < 2) {
-        fprintf(stderr, "usage: %s testfile.bin\n", argv[0]);
+        fprintf(stderr, "usage: %s [--jit|--vector|--farm|--step|--sched|--accuracy|--map] testfile.bin\n", argv[0]);
+        fprintf(stderr, "       %s --opcodes\n", argv[0]);
+        fprintf(stderr, "       %s --decimal\n", argv[0]);
+        fprintf(stderr, "       %s --hooks\n", argv[0]);
+        fprintf(stderr, "       %s --idioms\n", argv[0]);
     }
 
     bus machine;
@@ -211,6 +1494,41 @@ int main(int argc, const char **argv)
 
     }
 
+    if(check_jit) {
+        check_translator(machine, start);
+        exit(EXIT_SUCCESS);
+    }
+
+    if(check_vec) {
+        check_vector(machine, start);
+        exit(EXIT_SUCCESS);
+    }
+
+    if(check_many) {
+        check_farm(machine, start);
+        exit(EXIT_SUCCESS);
+    }
+
+    if(check_step) {
+        check_stepper(machine, start);
+        exit(EXIT_SUCCESS);
+    }
+
+    if(check_sched) {
+        check_scheduler(machine, start);
+        exit(EXIT_SUCCESS);
+    }
+
+    if(check_acc) {
+        check_accuracy(machine, start);
+        exit(EXIT_SUCCESS);
+    }
+
+    if(check_map) {
+        check_map_bus(machine, start);
+        exit(EXIT_SUCCESS);
+    }
+
     dummyclock clock, clock2;
 
     bus machine2 = machine;
@@ -251,6 +1569,11 @@ int main(int argc, const char **argv)
         oldclock = clock.cycles;
         cpu.cycle();
 
+        if(cpu.halt == cpu.TRAPPED) {
+            printf("unhandled instruction %02X at %04X\n", cpu.trap_opcode, cpu.pc);
+            exit(1);
+        }
+
         if(validate) {
             machine2.write_history.clear();
             oldclock2 = clock2.cycles;
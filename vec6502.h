@@ -0,0 +1,541 @@
+/*
+    Template parameters:
+        CPU6502Vector<LANES, VARIANT>
+        LANES is the number of independent CPUs run in lockstep
+        VARIANT is as for CPU6502
+
+    Public methods:
+        CPU6502Vector(); - construct LANES CPUs, each with its own 64K of
+            memory, cleared
+        memory(lane) - the 64K of memory for lane
+        get_p(lane), set_p(lane, v) - read or write a lane's packed
+            status register
+        step() - issue one instruction on every lane that isn't stopped
+        run(steps) - step() that many times
+
+    Public members a, x, y, s, pc, and cycles are arrays indexed by lane.
+    stopped[lane] is set once the lane executes WAI, STP, or an opcode
+    the variant doesn't implement; nothing here raises interrupts.
+
+    Registers are kept as structure-of-arrays.  Each step groups the
+    lanes by opcode and runs each group through a kernel: a loop over
+    every lane that selects results into the group's lanes with a mask,
+    written so the compiler vectorizes it, with per-lane memory read by
+    gathers.  Kernels are built for AVX-512, AVX2 and baseline x86-64 and
+    the best one for the host is chosen at load time (GCC function
+    multiversioning).  Opcodes without a kernel, and ADC and SBC in
+    decimal mode, run lane by lane on a CPU6502, so every lane behaves
+    exactly like CPU6502 on a plain 64K memory bus.
+*/
+
+#ifndef VEC6502_H
+#define VEC6502_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "cpu6502.h"
+
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define CPU6502_VECTOR_CLONES __attribute__((target_clones("arch=x86-64-v4", "arch=x86-64-v3", "default")))
+#else
+#define CPU6502_VECTOR_CLONES
+#endif
+
+template<int LANES, class VARIANT = CPU6502DefaultVariant>
+struct CPU6502Vector
+{
+    static_assert(LANES > 0, "need at least one lane");
+
+    static constexpr uint8_t N = 0x80;
+    static constexpr uint8_t V = 0x40;
+    static constexpr uint8_t B2 = 0x20;
+    static constexpr uint8_t B = 0x10;
+    static constexpr uint8_t D = 0x08;
+    static constexpr uint8_t I = 0x04;
+    static constexpr uint8_t Z = 0x02;
+    static constexpr uint8_t C = 0x01;
+
+    // Status flags are unpacked as in CPU6502, one byte per lane
+    alignas(64) uint8_t a[LANES] = {};
+    alignas(64) uint8_t x[LANES] = {};
+    alignas(64) uint8_t y[LANES] = {};
+    alignas(64) uint8_t s[LANES] = {};
+    alignas(64) uint8_t n_result[LANES] = {};
+    alignas(64) uint8_t z_result[LANES] = {};
+    alignas(64) uint8_t c_flag[LANES] = {};
+    alignas(64) uint8_t v_flag[LANES] = {};
+    alignas(64) uint8_t d_flag[LANES] = {};
+    alignas(64) uint8_t i_flag[LANES] = {};
+    alignas(64) uint16_t pc[LANES] = {};
+    alignas(64) uint64_t cycles[LANES] = {};
+    alignas(64) uint8_t stopped[LANES] = {};
+
+    // Lane lane's memory starts at lane * 64K, with 3 bytes of padding
+    // at the end for gather()
+    std::vector<uint8_t> memories;
+
+    CPU6502Vector() :
+        memories((size_t(LANES) << 16) + 3),
+        scalar(scalar_clock, scalar_bus)
+    {
+        for(int l = 0; l < LANES; l++) {
+            s[l] = 0xFD;
+            set_p(l, I | Z);
+        }
+    }
+
+    uint8_t* memory(int lane)
+    {
+        return memories.data() + (size_t(lane) << 16);
+    }
+
+    uint8_t get_p(int l) const
+    {
+        return ((n_result[l] & 0x80) ? N : 0) |
+            (v_flag[l] ? V : 0) |
+            B2 | B |
+            (d_flag[l] ? D : 0) |
+            (i_flag[l] ? I : 0) |
+            ((z_result[l] == 0) ? Z : 0) |
+            (c_flag[l] ? C : 0);
+    }
+
+    void set_p(int l, uint8_t v)
+    {
+        n_result[l] = v & N;
+        v_flag[l] = (v & V) != 0;
+        d_flag[l] = (v & D) != 0;
+        i_flag[l] = (v & I) != 0;
+        z_result[l] = (v & Z) ? 0 : 1;
+        c_flag[l] = (v & C) != 0;
+    }
+
+    void step()
+    {
+        const uint8_t* m = memories.data();
+        for(int l = 0; l < LANES; l++) {
+            opcode[l] = m[(uint32_t(l) << 16) | pc[l]];
+        }
+
+        bool seen[256] = {};
+        for(int first = 0; first < LANES; first++) {
+            uint8_t op = opcode[first];
+            if(stopped[first] || seen[op]) {
+                continue;
+            }
+            seen[op] = true;
+            bool decimal_lanes = false;
+            for(int l = 0; l < LANES; l++) {
+                mask[l] = ((opcode[l] == op) && !stopped[l]) ? 0xFF : 0;
+                if constexpr (VARIANT::decimal_mode) {
+                    if(mask[l] && d_flag[l] && is_adc_sbc(op)) {
+                        mask[l] = 0;
+                        step_scalar(l);
+                        decimal_lanes = true;
+                    }
+                }
+            }
+            if(kernel(op).mode == NONE) {
+                for(int l = first; l < LANES; l++) {
+                    if(mask[l]) {
+                        step_scalar(l);
+                    }
+                }
+            } else if(!decimal_lanes || any_masked()) {
+                run_kernel(op);
+            }
+        }
+    }
+
+    void run(uint64_t steps)
+    {
+        for(uint64_t i = 0; i < steps; i++) {
+            step();
+        }
+    }
+
+    // Kernel scratch, one element per lane
+    alignas(64) uint8_t opcode[LANES];
+    alignas(64) uint8_t mask[LANES]; // 0xFF if the lane is in the group
+    alignas(64) uint8_t operand[LANES];
+    alignas(64) uint32_t fetch_at[LANES]; // pc + 1 in memories
+    alignas(64) uint32_t address[LANES]; // effective address in memories
+
+    enum Mode { NONE, IMP, IMM, ZPG, ABS, REL };
+
+    struct Kernel
+    {
+        Mode mode;
+        uint8_t length;
+        uint8_t cycles;
+    };
+
+    // Opcodes run by kernels; documented instructions whose timing and
+    // behavior are the same on every variant
+    static constexpr bool has_kernel(uint8_t op)
+    {
+        switch(op) {
+            case 0xAA: case 0xA8: case 0x8A: case 0x98: case 0xBA: case 0x9A:
+            case 0xE8: case 0xC8: case 0xCA: case 0x88:
+            case 0x18: case 0x38: case 0xD8: case 0xF8: case 0xB8: case 0x58: case 0x78:
+            case 0xEA: case 0x0A: case 0x4A: case 0x2A: case 0x6A:
+            case 0xA9: case 0xA2: case 0xA0: case 0x69: case 0xE9:
+            case 0x29: case 0x09: case 0x49: case 0xC9: case 0xE0: case 0xC0:
+            case 0xA5: case 0xA6: case 0xA4: case 0x85: case 0x86: case 0x84:
+            case 0x65: case 0xE5: case 0x25: case 0x05: case 0x45: case 0xC5:
+            case 0xE6: case 0xC6:
+            case 0xAD: case 0x8D:
+            case 0x4C:
+            case 0x10: case 0x30: case 0x50: case 0x70: case 0x90: case 0xB0: case 0xD0: case 0xF0:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // The kernel for op, with its mode, length and cycles from
+    // cpu6502_opcodes
+    static constexpr Kernel kernel(uint8_t op)
+    {
+        typedef CPU6502Opcode O;
+        const CPU6502Opcode& info = cpu6502_opcodes<VARIANT>[op];
+        if(!has_kernel(op) || !info.implemented) {
+            return {NONE, 0, 0};
+        }
+        switch(info.mode) {
+            case O::IMP: case O::ACC: return {IMP, info.length, info.cycles};
+            case O::IMM: return {IMM, info.length, info.cycles};
+            case O::ZPG: return {ZPG, info.length, info.cycles};
+            case O::ABS: return {ABS, info.length, info.cycles};
+            case O::REL: return {REL, info.length, info.cycles};
+            default: return {NONE, 0, 0};
+        }
+    }
+
+    static constexpr bool is_adc_sbc(uint8_t op)
+    {
+        return (op == 0x69) || (op == 0xE9) || (op == 0x65) || (op == 0xE5);
+    }
+
+    bool any_masked() const
+    {
+        for(int l = 0; l < LANES; l++) {
+            if(mask[l]) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    CPU6502_VECTOR_CLONES
+    void run_kernel(uint8_t op)
+    {
+        uint8_t* m = memories.data();
+        const Kernel k = kernel(op);
+
+        // Fetch the operand, and its address for stores
+        if(k.mode != IMP) {
+            for(int l = 0; l < LANES; l++) {
+                fetch_at[l] = (uint32_t(l) << 16) | uint16_t(pc[l] + 1);
+            }
+        }
+        switch(k.mode) {
+            case IMM: case REL:
+                gather(m, fetch_at, operand);
+                break;
+            case ZPG:
+                gather(m, fetch_at, operand);
+                for(int l = 0; l < LANES; l++) {
+                    address[l] = (uint32_t(l) << 16) | operand[l];
+                }
+                gather(m, address, operand);
+                break;
+            case ABS:
+                gather_address(m, pc, address);
+                gather(m, address, operand);
+                break;
+            default:
+                break;
+        }
+
+        switch(op) {
+            case 0xAA: lanes_load(x, a); break; // TAX
+            case 0xA8: lanes_load(y, a); break; // TAY
+            case 0x8A: lanes_load(a, x); break; // TXA
+            case 0x98: lanes_load(a, y); break; // TYA
+            case 0xBA: lanes_load(x, s); break; // TSX
+            case 0x9A: // TXS
+                for(int l = 0; l < LANES; l++) {
+                    s[l] = select(mask[l], x[l], s[l]);
+                }
+                break;
+            case 0xE8: lanes_add(x, 1); break; // INX
+            case 0xC8: lanes_add(y, 1); break; // INY
+            case 0xCA: lanes_add(x, 0xFF); break; // DEX
+            case 0x88: lanes_add(y, 0xFF); break; // DEY
+            case 0x18: lanes_set(c_flag, 0); break; // CLC
+            case 0x38: lanes_set(c_flag, 1); break; // SEC
+            case 0xD8: lanes_set(d_flag, 0); break; // CLD
+            case 0xF8: lanes_set(d_flag, 1); break; // SED
+            case 0xB8: lanes_set(v_flag, 0); break; // CLV
+            case 0x58: lanes_set(i_flag, 0); break; // CLI
+            case 0x78: lanes_set(i_flag, 1); break; // SEI
+            case 0xEA: break; // NOP
+            case 0x0A: // ASL A
+                for(int l = 0; l < LANES; l++) {
+                    c_flag[l] = select(mask[l], a[l] >> 7, c_flag[l]);
+                    select_nz(l, a[l] << 1, a);
+                }
+                break;
+            case 0x4A: // LSR A
+                for(int l = 0; l < LANES; l++) {
+                    c_flag[l] = select(mask[l], a[l] & 1, c_flag[l]);
+                    select_nz(l, a[l] >> 1, a);
+                }
+                break;
+            case 0x2A: // ROL A
+                for(int l = 0; l < LANES; l++) {
+                    uint8_t carry = c_flag[l];
+                    c_flag[l] = select(mask[l], a[l] >> 7, carry);
+                    select_nz(l, (a[l] << 1) | carry, a);
+                }
+                break;
+            case 0x6A: // ROR A
+                for(int l = 0; l < LANES; l++) {
+                    uint8_t carry = c_flag[l];
+                    c_flag[l] = select(mask[l], a[l] & 1, carry);
+                    select_nz(l, (a[l] >> 1) | (carry << 7), a);
+                }
+                break;
+            case 0xA9: case 0xA5: case 0xAD: lanes_load(a, operand); break; // LDA
+            case 0xA2: case 0xA6: lanes_load(x, operand); break; // LDX
+            case 0xA0: case 0xA4: lanes_load(y, operand); break; // LDY
+            case 0x85: case 0x8D: scatter(m, address, mask, a); break; // STA
+            case 0x86: scatter(m, address, mask, x); break; // STX
+            case 0x84: scatter(m, address, mask, y); break; // STY
+            case 0x69: case 0x65: lanes_adc(0x00); break; // ADC
+            case 0xE9: case 0xE5: lanes_adc(0xFF); break; // SBC
+            case 0x29: case 0x25: // AND
+                for(int l = 0; l < LANES; l++) {
+                    select_nz(l, a[l] & operand[l], a);
+                }
+                break;
+            case 0x09: case 0x05: // ORA
+                for(int l = 0; l < LANES; l++) {
+                    select_nz(l, a[l] | operand[l], a);
+                }
+                break;
+            case 0x49: case 0x45: // EOR
+                for(int l = 0; l < LANES; l++) {
+                    select_nz(l, a[l] ^ operand[l], a);
+                }
+                break;
+            case 0xC9: case 0xC5: lanes_compare(a); break; // CMP
+            case 0xE0: lanes_compare(x); break; // CPX
+            case 0xC0: lanes_compare(y); break; // CPY
+            case 0xE6: case 0xC6: { // INC, DEC zpg
+                uint8_t delta = (op == 0xE6) ? 1 : 0xFF;
+                for(int l = 0; l < LANES; l++) {
+                    operand[l] += delta;
+                    n_result[l] = select(mask[l], operand[l], n_result[l]);
+                    z_result[l] = select(mask[l], operand[l], z_result[l]);
+                }
+                scatter(m, address, mask, operand);
+                break;
+            }
+            case 0x4C: // JMP abs
+                for(int l = 0; l < LANES; l++) {
+                    uint16_t in_group = int8_t(mask[l]);
+                    pc[l] = (uint16_t(address[l]) & in_group) | (pc[l] & ~in_group);
+                    cycles[l] += mask[l] & k.cycles;
+                }
+                return;
+            case 0x10: lanes_branch(n_result, 0x80, false); return; // BPL
+            case 0x30: lanes_branch(n_result, 0x80, true); return; // BMI
+            case 0x50: lanes_branch(v_flag, 1, false); return; // BVC
+            case 0x70: lanes_branch(v_flag, 1, true); return; // BVS
+            case 0x90: lanes_branch(c_flag, 1, false); return; // BCC
+            case 0xB0: lanes_branch(c_flag, 1, true); return; // BCS
+            case 0xD0: lanes_branch(z_result, 0xFF, true); return; // BNE
+            case 0xF0: lanes_branch(z_result, 0xFF, false); return; // BEQ
+        }
+
+        for(int l = 0; l < LANES; l++) {
+            pc[l] += mask[l] & k.length;
+            cycles[l] += mask[l] & k.cycles;
+        }
+    }
+
+    // Lanes are selected with masks of all ones or all zeros rather than
+    // by branching, which is what lets these loops vectorize
+    static uint8_t select(uint8_t mask, uint8_t v, uint8_t old)
+    {
+        return (v & mask) | (old & ~mask);
+    }
+
+    // The byte at each index, loaded as 32 bits so the loop becomes a
+    // gather; memories is padded so the last lane's load stays in bounds
+    static void gather(const uint8_t* __restrict m, const uint32_t* __restrict index, uint8_t* __restrict out)
+    {
+        for(int l = 0; l < LANES; l++) {
+            uint32_t word;
+            memcpy(&word, m + index[l], 4);
+            out[l] = word;
+        }
+    }
+
+    // The 16-bit address operand of each lane's instruction, in the same
+    // lane's memory.  Its bytes are gathered separately so an operand at
+    // $FFFF takes its high byte from $0000.
+    static void gather_address(const uint8_t* __restrict m, const uint16_t* __restrict pc, uint32_t* __restrict out)
+    {
+        for(int l = 0; l < LANES; l++) {
+            uint32_t low, high;
+            memcpy(&low, m + ((uint32_t(l) << 16) | uint16_t(pc[l] + 1)), 4);
+            memcpy(&high, m + ((uint32_t(l) << 16) | uint16_t(pc[l] + 2)), 4);
+            out[l] = (uint32_t(l) << 16) | uint8_t(low) | (uint32_t(uint8_t(high)) << 8);
+        }
+    }
+
+    static void scatter(uint8_t* __restrict m, const uint32_t* __restrict address, const uint8_t* __restrict mask, const uint8_t* __restrict v)
+    {
+        for(int l = 0; l < LANES; l++) {
+            if(mask[l]) {
+                m[address[l]] = v[l];
+            }
+        }
+    }
+
+    // Set lane l of dst and N and Z to v if lane l is in the group
+    void select_nz(int l, uint8_t v, uint8_t* dst)
+    {
+        dst[l] = select(mask[l], v, dst[l]);
+        n_result[l] = select(mask[l], v, n_result[l]);
+        z_result[l] = select(mask[l], v, z_result[l]);
+    }
+
+    void lanes_load(uint8_t* dst, const uint8_t* src)
+    {
+        for(int l = 0; l < LANES; l++) {
+            select_nz(l, src[l], dst);
+        }
+    }
+
+    void lanes_add(uint8_t* reg, uint8_t delta)
+    {
+        for(int l = 0; l < LANES; l++) {
+            select_nz(l, reg[l] + delta, reg);
+        }
+    }
+
+    void lanes_set(uint8_t* flag, uint8_t v)
+    {
+        for(int l = 0; l < LANES; l++) {
+            flag[l] = select(mask[l], v, flag[l]);
+        }
+    }
+
+    // Binary ADC, or SBC with invert 0xFF
+    void lanes_adc(uint8_t invert)
+    {
+        for(int l = 0; l < LANES; l++) {
+            uint8_t m = operand[l] ^ invert;
+            uint16_t sum = a[l] + m + c_flag[l];
+            uint8_t v = sum;
+            v_flag[l] = select(mask[l], ((a[l] ^ v) & (m ^ v)) >> 7, v_flag[l]);
+            c_flag[l] = select(mask[l], sum >> 8, c_flag[l]);
+            select_nz(l, v, a);
+        }
+    }
+
+    void lanes_compare(const uint8_t* reg)
+    {
+        for(int l = 0; l < LANES; l++) {
+            uint8_t v = reg[l] - operand[l];
+            c_flag[l] = select(mask[l], reg[l] >= operand[l], c_flag[l]);
+            n_result[l] = select(mask[l], v, n_result[l]);
+            z_result[l] = select(mask[l], v, z_result[l]);
+        }
+    }
+
+    // Taken when (flag & bits) != 0 equals when_set; one more cycle if
+    // taken and one more again if that crosses a page
+    void lanes_branch(const uint8_t* flag, uint8_t bits, bool when_set)
+    {
+        uint16_t invert = when_set ? 0 : 1;
+        for(int l = 0; l < LANES; l++) {
+            uint16_t next = pc[l] + 2;
+            uint16_t target = next + int8_t(operand[l]);
+            uint16_t set = (uint16_t(flag[l] & bits) + 0xFF) >> 8;
+            uint16_t taken = mask[l] & (set ^ invert);
+            uint16_t crossed = (uint16_t((next ^ target) >> 8) + 0xFF) >> 8;
+            uint16_t in_group = int8_t(mask[l]);
+            uint16_t jump = -taken;
+            pc[l] = (((target & jump) | (next & ~jump)) & in_group) | (pc[l] & ~in_group);
+            cycles[l] += (mask[l] & 2) + taken + (taken & crossed);
+        }
+    }
+
+    // Scalar path for opcodes without kernels
+    struct ScalarClock
+    {
+        void add_cpu_cycles(int) {}
+    };
+
+    struct ScalarBus
+    {
+        uint8_t* memory = nullptr;
+
+        uint8_t read(uint16_t addr)
+        {
+            return memory[addr];
+        }
+        void write(uint16_t addr, uint8_t data)
+        {
+            memory[addr] = data;
+        }
+    };
+
+    ScalarClock scalar_clock;
+    ScalarBus scalar_bus;
+    CPU6502<ScalarClock, ScalarBus, VARIANT> scalar;
+
+    void step_scalar(int l)
+    {
+        scalar_bus.memory = memory(l);
+        scalar.set_pc(pc[l]);
+        scalar.a = a[l];
+        scalar.x = x[l];
+        scalar.y = y[l];
+        scalar.s = s[l];
+        scalar.n_result = n_result[l];
+        scalar.z_result = z_result[l];
+        scalar.c_flag = c_flag[l];
+        scalar.v_flag = v_flag[l];
+        scalar.d_flag = d_flag[l];
+        scalar.i_flag = i_flag[l];
+
+        uint64_t before = scalar.total_cycles;
+        scalar.execute(before + 1);
+        cycles[l] += scalar.total_cycles - before;
+
+        pc[l] = scalar.pc;
+        a[l] = scalar.a;
+        x[l] = scalar.x;
+        y[l] = scalar.y;
+        s[l] = scalar.s;
+        n_result[l] = scalar.n_result;
+        z_result[l] = scalar.z_result;
+        c_flag[l] = scalar.c_flag;
+        v_flag[l] = scalar.v_flag;
+        d_flag[l] = scalar.d_flag;
+        i_flag[l] = scalar.i_flag;
+        if(scalar.halt != decltype(scalar)::RUNNING) {
+            stopped[l] = 1;
+            scalar.halt = decltype(scalar)::RUNNING;
+        }
+    }
+};
+
+#endif /* VEC6502_H */